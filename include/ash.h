@@ -15,6 +15,11 @@
 #include "subshell.h"
 #include "d3io.h"
 #include "convolvIR.h"
+#include "hrtfLoader.h"
+#include "headTracker.h"
+#ifdef UPOLS_REVERB
+#include "reverb.h"
+#endif
 
 class Ash
 {
@@ -25,9 +30,11 @@ public:
 
 private:
 	void motd(void);
+	static void reportOverload(void);
 
 	static void toggle(void *);
 	static void setAngle(void *);
+	static void hrtf(void *);
 	static void currentStatus(void *);
 	static void audioPassthrough(void *);
 	static void audioMemory(void *);
@@ -35,6 +42,13 @@ private:
 	static void reboot(void *);
 	static void clear(void *);
 	static void memoryUse(void *);
+	static void memoryMap(void *);
+	static void perf(void *);
+	static void overload(void *);
+	static void spdif(void *);
+#ifdef UPOLS_REVERB
+	static void reverb(void *);
+#endif
 	static void lscmds(void *);
 
 	static void unknownCommand(void *);
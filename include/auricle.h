@@ -17,11 +17,41 @@
 #include <math.h>
 #include <stdint.h>
 #include <stdbool.h>
+
+#ifdef ARDUINO
 #include <WProgram.h>
 
+// Memory placement, listed by ash memmap
+// ITCM: hot code, single-cycle fetch. Everything else in .text lands here too unless it is marked _section_flash
+// DTCM: hot data, single-cycle access without going through the D-cache. Zero-initialized .bss is in DTCM by
+// default, the explicit section keeps it there regardless of how the linker script orders its inputs
+// OCRAM2: DMA buffers and cold data, cached
+// EXTMEM: optional PSRAM, cached and much slower again, never initialized at startup
+// Flash: cold code with _section_flash and read-only tables with _section_progmem, a translation unit can't
+// put both in the same section
 #define _section_flash __attribute__((section(".flashmem")))
+#define _section_progmem __attribute__((section(".progmem")))
 #define _section_dma __attribute__((used, section(".dmabuffers")))
 #define _section_dma_aligned __attribute__((used, section(".dmabuffers"), aligned(32)))
+#define _section_dtcm __attribute__((section(".bss.dtcm")))
+#define _section_dtcm_aligned __attribute__((section(".bss.dtcm"), aligned(32)))
+#define _section_extmem __attribute__((section(".externalram")))
+#ifndef _section_itcm
+#define _section_itcm __attribute__((section(".fastrun"), noinline, noclone))
+#endif
+#else
+// Host builds (env:native) keep everything in the default sections
+#define _section_flash
+#define _section_progmem
+#define _section_dma
+#define _section_dma_aligned __attribute__((aligned(32)))
+#define _section_dtcm
+#define _section_dtcm_aligned __attribute__((aligned(32)))
+#define _section_extmem
+#ifndef _section_itcm
+#define _section_itcm __attribute__((noinline, noclone))
+#endif
+#endif
 
 enum Stereo
 {
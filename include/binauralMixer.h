@@ -0,0 +1,46 @@
+/**
+ * @file binauralMixer.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Multi-source binaural mixer for the Teensy Audio Library
+ * @version 0.1
+ * @date 2021-12-10
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ */
+
+#pragma once
+
+#include <arm_math.h>
+#include <wiring.h>
+#include <AudioStream.h>
+#include "auricle.h"
+#include "binaural.h"
+
+class BinauralMixer : public AudioStream
+{
+public:
+	BinauralMixer(void);
+	virtual void update(void);
+	bool setAngle(uint8_t source, uint16_t irIndex);
+
+private:
+	static void mixISR(void);
+
+	audio_block_t *inputQueueArray[SourceCount];
+	static audio_block_t *pendingSources[SourceCount]; // Mono inputs handed to mixISR(), NULL for a silent source
+	static audio_block_t *pendingOutput[2];			   // Output blocks handed to mixISR(), cleared once mixed
+	static audio_block_t *processedOutput[2];		   // Mixed blocks waiting to be transmitted by update()
+
+	enum DeferredMix
+	{
+		MixIRQ = IRQ_GPT1,	// Unused peripheral interrupt, pended by update() to run the mix
+		MixPriority = 240	// Same as the stereo convolution, below the audio library update (208), USB and DMA
+	};
+
+	enum Channels
+	{
+		LeftChannel,
+		RightChannel
+	};
+};
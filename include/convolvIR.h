@@ -17,6 +17,8 @@
 #include <AudioStream.h>
 #include "auricle.h"
 #include "upols.h"
+#include "overload.h"
+#include "spdifTx.h"
 
 class ConvolvIR : public AudioStream
 {
@@ -24,13 +26,36 @@ public:
 	ConvolvIR(void);
 	virtual void update(void);
 	bool togglePassthrough(void);
-	void convertIR(uint16_t irIndex);
+	bool toggleLazyUpdates(void);
+	bool acceptsAngle(void);
+	void attachQ23Output(SpdifTx *output);
+	bool toggleQ23Output(void);
+	bool toggleShedding(void);
+	uint32_t droppedBlocks(void);
+	bool setAngle(float32_t degrees);
+	bool loadSpectra(const float32_t *spectra);
 
 private:
+	static void convolveISR(void);
+
 	audio_block_t *inputQueueArray[2];
+	static audio_block_t *pendingAudio[2];	 // Blocks handed to convolveISR(), cleared once convolved
+	static audio_block_t *processedAudio[2]; // Convolved blocks waiting to be transmitted by update()
+	static bool processedDirect;			 // The processed blocks' output already went straight to q23Sink
+	static uint32_t dropped;				 // Input blocks dropped because the convolution overran
+
+	static SpdifTx *q23Sink; // Transmit buffer 24-bit output is written into, 16-bit blocks are transmitted when null
+	SpdifTx *q23Output;
 
 	bool audioPassthrough;
-	bool audioMute;
+	bool lazyUpdates; // Filters go live partition by partition instead of being prepared and crossfaded as a set
+	bool shedding;	  // Filter tails are shed by the overload monitor as the convolution nears its deadline
+
+	enum DeferredConvolution
+	{
+		ConvolveIRQ = IRQ_GPT2,	// Unused peripheral interrupt, pended by update() to run the convolution
+		ConvolvePriority = 240	// Below the audio library update (208), USB and DMA
+	};
 
 	enum Channels
 	{
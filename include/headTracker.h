@@ -0,0 +1,59 @@
+/**
+ * @file headTracker.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief USB MIDI head-tracker input, steering the convolution without going through the shell
+ * @version 0.1
+ * @date 2021-12-18
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ */
+
+#pragma once
+
+#include <wiring.h>
+#include <usb_midi.h>
+#include "auricle.h"
+#include "convolvIR.h"
+#include "hrtfLoader.h"
+
+/**
+ * @brief Orientation arrives as 14-bit pitch bends, which every MIDI stack can send at a few hundred Hz:
+ *
+ * Channel AzimuthChannel: azimuth, -8192 to 8191 across [-180, 180) degrees, 0 straight ahead
+ * Channel ElevationChannel: elevation, -8192 to 8191 across [-90, 90] degrees, only used with an .hrir dataset
+ *
+ * Messages are drained every poll() and only the newest orientation is kept. It's applied once the last one
+ * has gone live, so a fast tracker never keeps the engine restarting its filters.
+ */
+class HeadTracker
+{
+public:
+	HeadTracker(void);
+	void poll(void);
+
+	uint32_t received(void) { return messageCount; }
+	uint32_t applied(void) { return appliedCount; }
+
+private:
+	enum Channels
+	{
+		AzimuthChannel = 1,
+		ElevationChannel = 2
+	};
+
+	enum Limits
+	{
+		MessagesPerPoll = 64, // Bounds the time spent in poll() if the host floods the port
+		BendCenter = 8192,
+	};
+
+	float32_t azimuth;
+	float32_t elevation;
+	bool pending; // The orientation changed since it was last applied
+
+	uint32_t messageCount;
+	uint32_t appliedCount;
+};
+
+extern HeadTracker headTracker;
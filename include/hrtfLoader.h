@@ -0,0 +1,115 @@
+/**
+ * @file hrtfLoader.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Background loader for HRTF datasets on the SD card, cached as spectra in PSRAM
+ * @version 0.1
+ * @date 2021-12-12
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ */
+
+#pragma once
+
+#include <SD.h>
+#include <wiring.h>
+#include <AudioStream.h>
+#include "auricle.h"
+#include "upols.h"
+
+// PSRAM set aside for transformed measurements, fits on a single 8 MB chip by default, alongside the
+// reverb bus's tail when it's built in
+#ifndef HRTF_CACHE_BYTES
+#ifndef UPOLS_REVERB
+#define HRTF_CACHE_BYTES (7 * 1024 * 1024)
+#else
+#define HRTF_CACHE_BYTES (4 * 1024 * 1024)
+#endif
+#endif
+
+/**
+ * @brief Datasets are .hrir files written by tools/sofaHRIR.py, all values little-endian:
+ *
+ * hrir_header_t
+ * measurementCount x {float32 azimuth, float32 elevation} in degrees
+ * measurementCount x ceil(taps / partitionSize) x {partitionSize left taps, partitionSize right taps}
+ *
+ * Taps are grouped by partition so a measurement is read front to back, one partition at a time. Spectra
+ * are written next to the dataset as a .spc file, so the next boot streams them straight into PSRAM.
+ */
+typedef struct hrir_header_t
+{
+	char magic[4];		  // "HRIR"
+	uint16_t version;	  // HrirVersion
+	uint16_t measurementCount;
+	uint32_t sampleRate;
+	uint32_t taps;		  // Taps per channel of each measurement
+	uint32_t partitionSize; // Taps per channel and partition, must match PartitionSize
+} hrir_header_t;
+
+typedef struct spc_header_t
+{
+	char magic[4];		  // "HSPC"
+	uint16_t version;	  // HrirVersion
+	uint16_t measurementCount;
+	uint32_t partitionSize;
+	uint32_t partitionCount;
+	uint32_t sourceBytes; // Size of the .hrir file the spectra were transformed from
+} spc_header_t;
+
+class HrtfLoader
+{
+public:
+	HrtfLoader(void);
+	bool begin(const char *path);
+	void poll(void);
+	const float32_t *nearest(float32_t azimuth, float32_t elevation, uint16_t *measurement);
+
+	uint16_t measurements(void) { return measurementCount; }
+	uint16_t capacity(void) { return cachedCount; }
+	uint16_t loaded(void) { return loadedCount; }
+	bool fromCache(void) { return state == StreamingSpectra || (state == Complete && cacheHit); }
+	const char *stateName(void);
+
+private:
+	void fail(const char *reason);
+	bool openCache(uint32_t sourceBytes);
+	void transformStep(void);
+	void streamStep(void);
+
+	enum LoaderState
+	{
+		Idle,
+		TransformingTaps, // Reading taps from the .hrir, transforming them, and writing the .spc
+		StreamingSpectra, // Reading spectra straight from a matching .spc
+		Complete,
+		Failed
+	};
+
+	enum Limits
+	{
+		HrirVersion = 1,
+		PartitionsPerPoll = 8, // Partitions loaded by each call to poll()
+		PathLength = 64,
+		SetFloats = 4 * ImpulseSamples,
+		CacheSets = HRTF_CACHE_BYTES / (SetFloats * sizeof(float32_t)),
+	};
+
+	File dataset;
+	File cache;
+	char cachePath[PathLength];
+	LoaderState state;
+	bool cacheHit;
+	bool cacheWritable;
+
+	uint16_t measurementCount; // Measurements in the dataset
+	uint16_t cachedCount;	   // Measurements that fit in PSRAM, the first ones in the dataset
+	uint16_t loadedCount;	   // Measurements fully in PSRAM, they're loaded in order
+	uint16_t nextPartition;	 // Partition of measurement loadedCount being loaded
+	uint32_t taps;
+	uint32_t tapsOffset;	 // Start of the taps in the .hrir
+
+	float32_t directions[CacheSets][2]; // Azimuth and elevation of each cached measurement
+};
+
+extern HrtfLoader hrtfLoader;
@@ -15,24 +15,101 @@
 #include <AudioStream.h>
 #include <DMAChannel.h>
 
+// Blocks queued between update() and dmaISR(), a power of two. Deeper queues ride out burstier input but
+// every block they hold is a block of latency.
+#ifndef SPDIF_QUEUE_DEPTH
+#define SPDIF_QUEUE_DEPTH 4
+#endif
+
+// Blocks queued before playback starts, and restarts after an underrun. Also the fill the drift loop holds
+// the queue at, so it needs a block either side of it to follow sources running slow as well as fast.
+#ifndef SPDIF_QUEUE_PREFILL
+#define SPDIF_QUEUE_PREFILL 2
+#endif
+
+// Furthest the S/PDIF clock is pulled from nominal to follow the source, drift past this is resampled
+#ifndef SPDIF_PLL_TRIM_PPM
+#define SPDIF_PLL_TRIM_PPM 200
+#endif
+
+// Furthest the source is followed at all, by the PLL and the resampler combined
+#ifndef SPDIF_DRIFT_RANGE_PPM
+#define SPDIF_DRIFT_RANGE_PPM 1000
+#endif
+
+typedef struct spdif_queue_stats_t
+{
+	uint32_t depth;
+	uint32_t fill;		 // Blocks queued right now
+	uint32_t peakFill;	 // Most blocks ever queued at once
+	uint32_t underruns;	 // Times the queue ran dry while playing, silence is sent until it's prefilled again
+	uint32_t overruns;	 // Blocks dropped because the queue was full
+	uint32_t lateWrites; // Direct writes that were still going when their half started playing
+	float driftPpm;		 // Estimated source clock offset, positive when the source runs fast
+	float pllTrimPpm;	 // Part of it followed by trimming the audio PLL
+	float resamplePpm;	 // Part of it resampled
+} spdif_queue_stats_t;
+
 class SpdifTx : public AudioStream
 {
 public:
 	SpdifTx(void);
 	virtual void update(void);
+	int32_t *claimTxHalf(uint32_t *period);
+	bool releaseTxHalf(int32_t *claimed, uint32_t period);
+	void queueStats(spdif_queue_stats_t *stats);
+	void resetQueueStats(void);
+
+	enum DriftMode
+	{
+		DriftFixed,	   // Nominal PLL, the queue slips once the source has drifted a block
+		DriftTrimPll,  // Trim the audio PLL to the source, resampling only what's past SPDIF_PLL_TRIM_PPM
+		DriftResample, // Nominal PLL, resample everything, for outputs that have to stay on the nominal clock
+	};
+	void setDriftMode(DriftMode mode);
+	DriftMode driftMode(void) { return drift; }
 
 private:
 	void init(void);
 	static void configureSpdifRegisters(void);
 	static void spdifInterleave(int32_t *pTx, const int16_t *leftAudioData, const int16_t *rightAudioData);
 	static void dmaISR(void);
+	static bool queueBlock(audio_block_t *leftAudio, audio_block_t *rightAudio);
+	static void trackDrift(uint32_t fill);
+	static void resetDrift(DriftMode mode);
+	static void resample(const audio_block_t *leftAudio, const audio_block_t *rightAudio);
 
 	static uint8_t configureDMA(void);
 	static int32_t getTxOffset(uint32_t txSourceAddress, uint32_t sourceBufferSize);
 
 	audio_block_t *inputQueueArray[2];
-	static audio_block_t *leftAudioBuffer[2];
-	static audio_block_t *rightAudioBuffer[2];
+	// Single producer, single consumer ring, update() only moves the head and dmaISR() only moves the tail
+	static audio_block_t *queuedAudio[SPDIF_QUEUE_DEPTH][2];
+	static volatile uint32_t queueHead; // Free-running, the slot is queueHead % SPDIF_QUEUE_DEPTH
+	static volatile uint32_t queueTail;
+	static bool queuePlaying;			// Cleared by an underrun until SPDIF_QUEUE_PREFILL blocks are queued
+	static volatile uint32_t peakFill;
+	static volatile uint32_t underruns;
+	static volatile uint32_t overruns;
+
+	static volatile DriftMode drift;
+	static float smoothedFill;		  // Queue fill seen by dmaISR(), low-passed
+	static float driftIntegral;		  // Integral term of the drift loop, in ppm
+	static volatile float driftPpm;	  // Drift loop output
+	static volatile float pllTrimPpm; // Applied to the PLL, in whole steps of the numerator
+	static volatile float resamplePpm;
+	static uint32_t pllNum;
+
+	// Cubic resampler between update() and the queue, engaged once any drift has to be resampled
+	static volatile bool resampling;
+	static float resampleHistory[2][3]; // Last three input samples of each channel
+	static float resamplePhase;		   // Position of the next output sample, relative to the current input block
+	static audio_block_t *resampledAudio[2];
+	static size_t resampledCount;
+
+	static int32_t *volatile txHalf;	// Half of fifoTx refilled by the last dmaISR(), played from the next one
+	static volatile uint32_t txPeriods; // dmaISR() count, a claimed half is only writable while this is unchanged
+	static uint32_t lateHalves;			// Direct writes that were still going when their half started playing
 
 	static DMAChannel eDMA;
 	uint8_t dmaChannel;
@@ -52,6 +129,17 @@ private:
 		CCM_CDCR_SPDIF0_CLK_MASK = (CCM_CDCDR_SPDIF0_CLK_SEL_MASK | CCM_CDCDR_SPDIF0_CLK_PRED_MASK | CCM_CDCDR_SPDIF0_CLK_PODF_MASK),
 	};
 
+	enum TxBuffer
+	{
+		TxHalfWords = 2 * AUDIO_BLOCK_SAMPLES, // fifoTx is double-buffered, one block of interleaved samples per half
+		TxHalfBytes = TxHalfWords * sizeof(int32_t),
+	};
+
+	enum DriftLoop
+	{
+		DriftSmoothingShift = 6, // Fill is low-passed over 64 blocks, around 190 ms
+	};
+
 	enum SPDIF
 	{
 		SPDIF_LOOP_DIV = 28,
@@ -59,3 +147,5 @@ private:
 		GPIO_AD_B1_02_MUX_MODE_SPDIF = 0b011
 	};
 };
+
+extern SpdifTx spdifOut;
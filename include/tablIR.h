@@ -13,7 +13,7 @@
 
 #include "auricle.h"
 
-_section_flash float32_t irTable[] = {
+_section_progmem float32_t irTable[] = {
 	1.83507107098292e-07, 6.10621694180884e-06, 0.00172398499459143, -3.0349787919739e-05, 0.00295495403686216, -0.00066357356560214, 0.00152247936105203, -0.000196196644306652,
 	2.4566209998838e-06, 6.68637413136424e-06, 0.00180546604692738, -0.000245227110935882, 0.00135021262319248, -0.000887987300813504, 0.00134155497159498, -8.44526954506822e-05,
 	4.1848434938872e-06, 1.63529084672821e-05, 0.00160274329105507, -0.000444924020133244, 0.000543298141214723, -0.000982432857323195, 0.000990177658940143, -4.29695421748948e-05,
@@ -0,0 +1,347 @@
+/**
+ * @file binaural.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Multi-source binaural mixing on top of the UPOLS core
+ * @version 0.1
+ * @date 2021-12-10
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ * @details
+ * Each of the SourceCount mono sources is spatialised with the HRIR pair of its own angle and the results are
+ * mixed into a single binaural output. Sources are transformed two at a time, packed as a + j b, and every
+ * source keeps a delay line of its own mono half-spectra. All sources accumulate into the same pair of
+ * frequency-domain accumulators, so one inverse FFT yields both ears of the whole mix no matter how many
+ * sources there are.
+ *
+ * Filter sets come from a shared pool with one set more than there are sources. Sources at the same angle
+ * share a set, and the spare lets any one source change angle while every other source holds a set of its
+ * own. A source changing angle is convolved with both its sets for one block and crossfaded, which takes two
+ * more inverse FFTs on that block only.
+ *
+ */
+
+#include "binaural.h"
+#include "fft.h"
+#include "./../../include/auricle.h"
+
+_Static_assert((int)SourceImpulseSamples <= (int)TableImpulseSamples, "Source HRIRs are longer than the HRIRs in tablIR.h");
+
+typedef struct source_t
+{
+	const float32_t *volatile activeSet;	 // Filter set being convolved with, NULL until an angle is set
+	const float32_t *volatile pendingSet;	 // Fully prepared set waiting to be crossfaded in
+	uint16_t silentBlocks;					 // Consecutive blocks without audio, saturates past the FDL length
+} source_t;
+
+enum Accumulators
+{
+	SteadyAccum,	// Sources that aren't changing angle
+	OutgoingAccum,	// Sets being retired this block
+	IncomingAccum,	// Sets being crossfaded in this block
+	AccumCount
+};
+
+static source_t sources[SourceCount];
+static uint16_t currentIndex; // FDL partition written this block, shared by every source
+
+_section_dtcm_aligned static float32_t delayLines[SourceCount][SourceSpectrumLength * SourcePartitionCount];
+_section_dtcm_aligned static float32_t previousAudio[SourcePairCount][2 * PartitionSize];
+_section_dtcm_aligned static float32_t window[SpectraLength];
+_section_dtcm_aligned static float32_t accumulators[AccumCount][SpectraLength];
+
+_section_dma_aligned static float32_t setSpectra[SourceSetCount][4 * SourceImpulseSamples];
+_section_dma static float32_t sourceTaps[2 * PartitionSize]; // Partition of the HRIR pair being transformed
+static int32_t setAngles[SourceSetCount] = {[0 ... SourceSetCount - 1] = -1}; // HRIR held by each set, -1 if none
+static uint32_t setGeneration; // hrirGeneration() the sets were transformed under
+
+/**
+ * @brief Whether any source is convolving with, or about to crossfade to, a pool set. Runs below
+ * mixSources(), which can move a pending set to active between any two reads. Reading the pending set first
+ * means a set being moved is seen in one place or the other, both pointers are volatile so the reads stay in
+ * that order.
+ *
+ */
+static bool setInUse(const float32_t *set)
+{
+	for (size_t s = 0; s < SourceCount; s++)
+	{
+		if (sources[s].pendingSet == set || sources[s].activeSet == set)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @brief Point a source at a new angle. Sets already holding the HRIR pair are shared, otherwise an idle set
+ * of the pool is transformed while audio keeps running with the current one.
+ *
+ * @param source Index of the source
+ * @param irIndex Index of the HRIR pair, one per 3.6 degrees of azimuth
+ * @return Returns false if irIndex does not have a compiled-in HRIR or if every set of the pool is in use,
+ * which only lasts until the crossfade of another source completes on the next block
+ */
+_section_flash
+bool setSourceAngle(const uint8_t source, const uint16_t irIndex)
+{
+	if (source >= SourceCount || irIndex >= hrirCount())
+	{
+		return false;
+	}
+
+	// Withdraw a set that hasn't been picked up yet, mixSources() is never interrupted by this
+	source_t *target = &sources[source];
+	target->pendingSet = NULL;
+
+	// Sets transformed from a table since replaced keep playing but are never shared again
+	if (setGeneration != hrirGeneration())
+	{
+		for (size_t i = 0; i < SourceSetCount; i++)
+		{
+			setAngles[i] = -1;
+		}
+		setGeneration = hrirGeneration();
+	}
+
+	float32_t *idleSet = NULL;
+	for (size_t i = 0; i < SourceSetCount; i++)
+	{
+		if (setAngles[i] == irIndex)
+		{
+			if (target->activeSet != setSpectra[i])
+			{
+				target->pendingSet = setSpectra[i];
+			}
+			return true;
+		}
+
+		if (!idleSet && !setInUse(setSpectra[i]))
+		{
+			idleSet = setSpectra[i];
+		}
+	}
+
+	if (!idleSet)
+	{
+		return false;
+	}
+
+	const size_t set = (size_t)(idleSet - setSpectra[0]) / (4 * SourceImpulseSamples);
+	setAngles[set] = -1;
+
+	for (size_t j = 0; j < SourcePartitionCount; j++)
+	{
+		const size_t tapOffset = PartitionSize * j;
+		hrirTaps(irIndex, tapOffset, PartitionSize, sourceTaps, sourceTaps + PartitionSize);
+		transformPartition(sourceTaps, sourceTaps + PartitionSize, PartitionSize, CFFT_F32(FFTLength), &idleSet[4 * tapOffset]);
+	}
+
+	setAngles[set] = irIndex;
+	target->pendingSet = idleSet;
+	return true;
+}
+
+/**
+ * @brief Transform two mono sources packed as a + j b and split the result into the half-spectrum of each,
+ * A[k] = (Z[k] + Z*[-k]) / 2 and B[k] = (Z[k] - Z*[-k]) / 2j, for bins [0, N]
+ *
+ * @param previous Previous block of the pair, a in the even indexes and b in the odd
+ * @param a Samples of the first source, NULL if silent
+ * @param b Samples of the second source, NULL if silent or if there is no second source
+ * @param spectrumA Output half-spectrum of the first source, 2N floats
+ * @param spectrumB Output half-spectrum of the second source, 2N floats, NULL if there is no second source
+ */
+_section_itcm
+static void transformPair(float32_t *previous, const int16_t *a, const int16_t *b, float32_t *spectrumA, float32_t *spectrumB)
+{
+	for (size_t i = 0; i < PartitionSize; i++)
+	{
+		window[2 * i] = previous[2 * i];
+		window[2 * i + 1] = previous[2 * i + 1];
+
+		previous[2 * i] = a ? (float32_t)a[i] / 32768.0f : 0.0f;
+		previous[2 * i + 1] = b ? (float32_t)b[i] / 32768.0f : 0.0f;
+
+		window[2 * (PartitionSize + i)] = previous[2 * i];
+		window[2 * (PartitionSize + i) + 1] = previous[2 * i + 1];
+	}
+
+	fftForward(window);
+
+	// A and B are real at DC and Nyquist, Nyquist is next to DC in bit-reversed order
+	spectrumA[0] = window[0];
+	spectrumA[1] = window[2];
+	if (spectrumB)
+	{
+		spectrumB[0] = window[1];
+		spectrumB[1] = window[3];
+	}
+
+	for (size_t k = 1; k < PartitionSize; k++)
+	{
+		const size_t zk = 2 * fftBin(k);
+		const size_t zNk = 2 * fftBin(FFTLength - k);
+		const float32_t aRe = window[zk];
+		const float32_t aIm = window[zk + 1];
+		const float32_t bRe = window[zNk];
+		const float32_t bIm = window[zNk + 1];
+
+		spectrumA[2 * k] = 0.5f * (aRe + bRe);
+		spectrumA[2 * k + 1] = 0.5f * (aIm - bIm);
+		if (spectrumB)
+		{
+			spectrumB[2 * k] = 0.5f * (aIm + bIm);
+			spectrumB[2 * k + 1] = 0.5f * (bRe - aRe);
+		}
+	}
+}
+
+/**
+ * @brief Accumulate one source convolved with a filter set over its whole FDL
+ *
+ * @param delayLine FDL of the source
+ * @param set Filter set, left then right half-spectra of each partition
+ * @param halfAccum Accumulator to add the source to
+ */
+_section_itcm
+static void accumulateSource(const float32_t *delayLine, const float32_t *set, float32_t *halfAccum)
+{
+	size_t shiftIndex = currentIndex;
+	for (size_t i = 0; i < SourcePartitionCount; i++)
+	{
+		hmacMonoN(&delayLine[SourceSpectrumLength * shiftIndex], &set[SpectraLength * i], halfAccum, PartitionSize);
+
+		// Decrement with wraparound
+		shiftIndex = (shiftIndex + (SourcePartitionCount - 1)) % SourcePartitionCount;
+	}
+}
+
+/**
+ * @brief Take an accumulator back to the time domain, both ears come out of a single inverse FFT
+ *
+ * @param halfAccum Accumulated half-spectra
+ * @param leftOutput Left ear output, PartitionSize samples
+ * @param rightOutput Right ear output, PartitionSize samples
+ */
+static void inverseTransform(float32_t *halfAccum, float32_t *leftOutput, float32_t *rightOutput)
+{
+	mergeStereoReversed(halfAccum, window);
+	fftInverse(window);
+
+	// Time-aliased portion isn't copied
+	for (size_t i = 0; i < PartitionSize; i++)
+	{
+		leftOutput[i] = window[2 * i + LeftFilter];
+		rightOutput[i] = window[2 * i + RightFilter];
+	}
+}
+
+/**
+ * @brief Spatialise one block of every source and mix them into a binaural output
+ *
+ * @param sourceAudio SourceCount pointers to PartitionSize samples of mono audio, NULL for a silent source
+ * @param leftOutput Pointer to PartitionSize samples of left ear output
+ * @param rightOutput Pointer to PartitionSize samples of right ear output
+ */
+_section_itcm
+void mixSources(const int16_t *const *sourceAudio, int16_t *leftOutput, int16_t *rightOutput)
+{
+	const uint32_t mixStart = perfStart();
+
+	for (size_t s = 0; s < SourceCount; s++)
+	{
+		source_t *source = &sources[s];
+		source->silentBlocks = sourceAudio[s] ? 0 : (source->silentBlocks <= SourcePartitionCount) ? source->silentBlocks + 1 : source->silentBlocks;
+	}
+
+	for (size_t pair = 0; pair < SourcePairCount; pair++)
+	{
+		const size_t a = 2 * pair;
+		const size_t b = 2 * pair + 1;
+		transformPair(previousAudio[pair], sourceAudio[a], (b < SourceCount) ? sourceAudio[b] : NULL,
+					  &delayLines[a][SourceSpectrumLength * currentIndex], (b < SourceCount) ? &delayLines[b][SourceSpectrumLength * currentIndex] : NULL);
+	}
+
+	// Sets only change between calls, take them once for the whole block
+	const float32_t *incomingSets[SourceCount];
+	bool crossfading = false;
+	for (size_t s = 0; s < SourceCount; s++)
+	{
+		incomingSets[s] = sources[s].pendingSet;
+		crossfading |= (incomingSets[s] != NULL);
+	}
+
+	clearN(accumulators[SteadyAccum], SpectraLength);
+	if (crossfading)
+	{
+		clearN(accumulators[OutgoingAccum], SpectraLength);
+		clearN(accumulators[IncomingAccum], SpectraLength);
+	}
+
+	for (size_t s = 0; s < SourceCount; s++)
+	{
+		// Once the whole FDL has gone silent the source contributes nothing
+		const source_t *source = &sources[s];
+		if (source->silentBlocks > SourcePartitionCount)
+		{
+			continue;
+		}
+
+		if (incomingSets[s])
+		{
+			if (source->activeSet)
+			{
+				accumulateSource(delayLines[s], source->activeSet, accumulators[OutgoingAccum]);
+			}
+			accumulateSource(delayLines[s], incomingSets[s], accumulators[IncomingAccum]);
+		}
+		else if (source->activeSet)
+		{
+			accumulateSource(delayLines[s], source->activeSet, accumulators[SteadyAccum]);
+		}
+	}
+
+	float32_t leftMix[PartitionSize];
+	float32_t rightMix[PartitionSize];
+
+	inverseTransform(accumulators[SteadyAccum], leftMix, rightMix);
+
+	if (crossfading)
+	{
+		float32_t leftOutgoing[PartitionSize];
+		float32_t rightOutgoing[PartitionSize];
+		float32_t leftIncoming[PartitionSize];
+		float32_t rightIncoming[PartitionSize];
+		inverseTransform(accumulators[OutgoingAccum], leftOutgoing, rightOutgoing);
+		inverseTransform(accumulators[IncomingAccum], leftIncoming, rightIncoming);
+
+		// Same raised-cosine crossfade as the stereo engine
+		for (size_t i = 0; i < PartitionSize; i++)
+		{
+			const float32_t fadeIn = 0.5f - 0.5f * cosf(PI * ((float32_t)i + 0.5f) / PartitionSize);
+			leftMix[i] += leftOutgoing[i] + fadeIn * (leftIncoming[i] - leftOutgoing[i]);
+			rightMix[i] += rightOutgoing[i] + fadeIn * (rightIncoming[i] - rightOutgoing[i]);
+		}
+
+		// Retire the outgoing sets
+		for (size_t s = 0; s < SourceCount; s++)
+		{
+			if (incomingSets[s])
+			{
+				sources[s].activeSet = incomingSets[s];
+				sources[s].pendingSet = NULL;
+			}
+		}
+	}
+
+	// Increment with wraparound
+	currentIndex = (currentIndex + 1) % SourcePartitionCount;
+
+	// Saturates if the sources sum past full scale
+	arm_float_to_q15(leftMix, leftOutput, PartitionSize);
+	arm_float_to_q15(rightMix, rightOutput, PartitionSize);
+
+	perfStop(PerfMix, mixStart);
+}
@@ -0,0 +1,43 @@
+/**
+ * @file binaural.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Multi-source binaural mixing on top of the UPOLS core
+ * @version 0.1
+ * @date 2021-12-10
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ */
+
+#pragma once
+
+#include "upols.h"
+
+// Number of mono sources and the length of their HRIRs, override from build_flags. Every source carries its
+// own FDL and filter set, so the HRIRs are truncated well short of the stereo engine's filter to fit in RAM
+#ifndef UPOLS_SOURCE_COUNT
+#define UPOLS_SOURCE_COUNT 4
+#endif
+#ifndef UPOLS_SOURCE_PARTITION_COUNT
+#define UPOLS_SOURCE_PARTITION_COUNT 16
+#endif
+
+enum SourceLengths
+{
+	SourceCount = UPOLS_SOURCE_COUNT,						 // Number of mono inputs
+	SourcePairCount = (SourceCount + 1) / 2,				 // Number of packed forward FFTs, two sources each
+	SourcePartitionCount = UPOLS_SOURCE_PARTITION_COUNT,	 // Number of partitions making up each HRIR
+	SourceImpulseSamples = PartitionSize * SourcePartitionCount,
+	SourceSpectrumLength = 2 * PartitionSize,				 // Number of floats per mono half-spectrum partition
+	SourceSetCount = SourceCount + 1,						 // Filter sets in the pool, one more than the sources
+};
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+	bool setSourceAngle(const uint8_t source, const uint16_t irIndex);
+	void mixSources(const int16_t *const *sourceAudio, int16_t *leftOutput, int16_t *rightOutput);
+#ifdef __cplusplus
+}
+#endif
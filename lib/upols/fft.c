@@ -0,0 +1,260 @@
+/**
+ * @file fft.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief FFTLength-point complex FFT specialised for the head partitions, spectra in bit-reversed order
+ * @version 0.1
+ * @date 2021-12-23
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ * @details
+ * arm_cfft_f32 picks its radix-8/4/2 passes and twiddle strides from the instance at run time and finishes
+ * with a table-driven bit-reversal pass. The head partitions are always FFTLength points, so this kernel
+ * fixes every trip count and stride at compile time instead and leaves the bit reversal out altogether.
+ *
+ * The forward transform is radix-4 decimation in frequency, each stage two fused radix-2 stages, with a last
+ * radix-2 stage when the length is an odd power of two. It takes natural order in and leaves the spectrum in
+ * bit-reversed order. The inverse is the same stages transposed and run backwards, decimation in time, taking
+ * bit-reversed order in and giving natural order out. Overlap-save only reads the spectrum bin by bin in the
+ * split and writes it bin by bin in the merge, so those index through fftBin() and the FDL, the filters and the
+ * accumulators stay in natural order. The inverse isn't scaled, the merge folds in the 1 / FFTLength.
+ *
+ * The twiddles are folded by the compiler into a const table, which the startup code copies into DTCM along
+ * with the rest of .data. Both transforms are pinned to ITCM and run in place on buffers in DTCM.
+ *
+ */
+
+#include "fft.h"
+
+// W^n = exp(-j 2 pi n / FFTLength) as [Re, Im], doubled up to cover 2^k consecutive n
+#define FFT_ANGLE(n) (6.283185307179586476925286766559 * (double)(n) / (double)FFTLength)
+#define FFT_W1(n) (float32_t)__builtin_cos(FFT_ANGLE(n)), (float32_t)-__builtin_sin(FFT_ANGLE(n))
+#define FFT_W2(n) FFT_W1(n), FFT_W1((n) + 1)
+#define FFT_W4(n) FFT_W2(n), FFT_W2((n) + 2)
+#define FFT_W8(n) FFT_W4(n), FFT_W4((n) + 4)
+#define FFT_W16(n) FFT_W8(n), FFT_W8((n) + 8)
+#define FFT_W32(n) FFT_W16(n), FFT_W16((n) + 16)
+#define FFT_W64(n) FFT_W32(n), FFT_W32((n) + 32)
+#define FFT_W128(n) FFT_W64(n), FFT_W64((n) + 64)
+#define FFT_W256(n) FFT_W128(n), FFT_W128((n) + 128)
+#define FFT_W512(n) FFT_W256(n), FFT_W256((n) + 256)
+#define FFT_W1024(n) FFT_W512(n), FFT_W512((n) + 512)
+#define FFT_W2048(n) FFT_W1024(n), FFT_W1024((n) + 1024)
+
+// 3L / 4 twiddles as the first L / 2 followed by the next L / 4, with L / 2 = PartitionSize
+#if UPOLS_PARTITION_SIZE == 8
+#define FFT_TWIDDLE_TABLE FFT_W8(0), FFT_W4(8)
+#elif UPOLS_PARTITION_SIZE == 16
+#define FFT_TWIDDLE_TABLE FFT_W16(0), FFT_W8(16)
+#elif UPOLS_PARTITION_SIZE == 32
+#define FFT_TWIDDLE_TABLE FFT_W32(0), FFT_W16(32)
+#elif UPOLS_PARTITION_SIZE == 64
+#define FFT_TWIDDLE_TABLE FFT_W64(0), FFT_W32(64)
+#elif UPOLS_PARTITION_SIZE == 128
+#define FFT_TWIDDLE_TABLE FFT_W128(0), FFT_W64(128)
+#elif UPOLS_PARTITION_SIZE == 256
+#define FFT_TWIDDLE_TABLE FFT_W256(0), FFT_W128(256)
+#elif UPOLS_PARTITION_SIZE == 512
+#define FFT_TWIDDLE_TABLE FFT_W512(0), FFT_W256(512)
+#elif UPOLS_PARTITION_SIZE == 1024
+#define FFT_TWIDDLE_TABLE FFT_W1024(0), FFT_W512(1024)
+#elif UPOLS_PARTITION_SIZE == 2048
+#define FFT_TWIDDLE_TABLE FFT_W2048(0), FFT_W1024(2048)
+#else
+#error "UPOLS_PARTITION_SIZE must be a power of two between 8 and 2048"
+#endif
+
+const float32_t fftTwiddles[2 * FFT_TWIDDLES] = {FFT_TWIDDLE_TABLE};
+
+/**
+ * @brief One radix-4 decimation-in-frequency stage over every block of 4q points. Butterfly j of a block
+ * takes x[j + mq] for m = 0..3 and leaves (x0 + x1 + x2 + x3), (x0 - x1 + x2 - x3) W^2j,
+ * (x0 - j x1 - x2 + j x3) W^j and (x0 + j x1 - x2 - j x3) W^3j in their places, the same as two radix-2
+ * stages, with W = exp(-j 2 pi / 4q)
+ *
+ * @param data FFTLength interleaved complex values
+ * @param quarter Quarter of the block length, q
+ */
+_inline_always void forwardStage(float32_t *__restrict data, const size_t quarter)
+{
+	const size_t stride = 2 * (FFTLength / (4 * quarter)); // Twiddle step per butterfly, in floats
+
+	for (size_t j = 0; j < quarter; j++)
+	{
+		const float32_t w1Re = fftTwiddles[j * stride];
+		const float32_t w1Im = fftTwiddles[j * stride + 1];
+		const float32_t w2Re = fftTwiddles[2 * j * stride];
+		const float32_t w2Im = fftTwiddles[2 * j * stride + 1];
+		const float32_t w3Re = fftTwiddles[3 * j * stride];
+		const float32_t w3Im = fftTwiddles[3 * j * stride + 1];
+
+		for (float32_t *x = &data[2 * j]; x < &data[2 * FFTLength]; x += 8 * quarter)
+		{
+			float32_t *x1 = x + 2 * quarter;
+			float32_t *x2 = x + 4 * quarter;
+			float32_t *x3 = x + 6 * quarter;
+
+			const float32_t sRe = x[0] + x2[0];
+			const float32_t sIm = x[1] + x2[1];
+			const float32_t dRe = x[0] - x2[0];
+			const float32_t dIm = x[1] - x2[1];
+			const float32_t tRe = x1[0] + x3[0];
+			const float32_t tIm = x1[1] + x3[1];
+			const float32_t eRe = x1[0] - x3[0];
+			const float32_t eIm = x1[1] - x3[1];
+
+			x[0] = sRe + tRe;
+			x[1] = sIm + tIm;
+
+			const float32_t aRe = sRe - tRe;
+			const float32_t aIm = sIm - tIm;
+			x1[0] = aRe * w2Re - aIm * w2Im;
+			x1[1] = aRe * w2Im + aIm * w2Re;
+
+			// d - j e and d + j e
+			const float32_t bRe = dRe + eIm;
+			const float32_t bIm = dIm - eRe;
+			x2[0] = bRe * w1Re - bIm * w1Im;
+			x2[1] = bRe * w1Im + bIm * w1Re;
+
+			const float32_t cRe = dRe - eIm;
+			const float32_t cIm = dIm + eRe;
+			x3[0] = cRe * w3Re - cIm * w3Im;
+			x3[1] = cRe * w3Im + cIm * w3Re;
+		}
+	}
+}
+
+/**
+ * @brief Transposed forwardStage(), undoing it up to a factor of 4 with the conjugate twiddles
+ *
+ * @param data FFTLength interleaved complex values
+ * @param quarter Quarter of the block length, q
+ */
+_inline_always void inverseStage(float32_t *__restrict data, const size_t quarter)
+{
+	const size_t stride = 2 * (FFTLength / (4 * quarter));
+
+	for (size_t j = 0; j < quarter; j++)
+	{
+		const float32_t w1Re = fftTwiddles[j * stride];
+		const float32_t w1Im = fftTwiddles[j * stride + 1];
+		const float32_t w2Re = fftTwiddles[2 * j * stride];
+		const float32_t w2Im = fftTwiddles[2 * j * stride + 1];
+		const float32_t w3Re = fftTwiddles[3 * j * stride];
+		const float32_t w3Im = fftTwiddles[3 * j * stride + 1];
+
+		for (float32_t *x = &data[2 * j]; x < &data[2 * FFTLength]; x += 8 * quarter)
+		{
+			float32_t *x1 = x + 2 * quarter;
+			float32_t *x2 = x + 4 * quarter;
+			float32_t *x3 = x + 6 * quarter;
+
+			const float32_t aRe = x1[0] * w2Re + x1[1] * w2Im;
+			const float32_t aIm = x1[1] * w2Re - x1[0] * w2Im;
+			const float32_t bRe = x2[0] * w1Re + x2[1] * w1Im;
+			const float32_t bIm = x2[1] * w1Re - x2[0] * w1Im;
+			const float32_t cRe = x3[0] * w3Re + x3[1] * w3Im;
+			const float32_t cIm = x3[1] * w3Re - x3[0] * w3Im;
+
+			const float32_t sRe = x[0] + aRe;
+			const float32_t sIm = x[1] + aIm;
+			const float32_t tRe = x[0] - aRe;
+			const float32_t tIm = x[1] - aIm;
+			const float32_t dRe = bRe + cRe;
+			const float32_t dIm = bIm + cIm;
+			const float32_t eRe = bRe - cRe;
+			const float32_t eIm = bIm - cIm;
+
+			// s + d, t + j e, s - d and t - j e
+			x[0] = sRe + dRe;
+			x[1] = sIm + dIm;
+			x1[0] = tRe - eIm;
+			x1[1] = tIm + eRe;
+			x2[0] = sRe - dRe;
+			x2[1] = sIm - dIm;
+			x3[0] = tRe + eIm;
+			x3[1] = tIm - eRe;
+		}
+	}
+}
+
+/**
+ * @brief Radix-2 butterflies on neighbouring points, the last forward stage and the first inverse stage of an
+ * odd power of two. Both directions are the same without twiddles.
+ *
+ * @param data FFTLength interleaved complex values
+ */
+_inline_always void radix2Stage(float32_t *__restrict data)
+{
+	for (float32_t *x = data; x < &data[2 * FFTLength]; x += 4)
+	{
+		const float32_t aRe = x[0];
+		const float32_t aIm = x[1];
+		x[0] = aRe + x[2];
+		x[1] = aIm + x[3];
+		x[2] = aRe - x[2];
+		x[3] = aIm - x[3];
+	}
+}
+
+/**
+ * @brief Forward transform in place, natural order in and bit-reversed order out, unscaled like arm_cfft_f32
+ *
+ * @param data FFTLength interleaved complex values
+ */
+_section_itcm
+void fftForward(float32_t *data)
+{
+#pragma GCC unroll 8
+	for (size_t quarter = FFTLength / 4; quarter > 0; quarter /= 4)
+	{
+		forwardStage(data, quarter);
+	}
+	if (FFT_LOG2 & 1)
+	{
+		radix2Stage(data);
+	}
+}
+
+/**
+ * @brief Inverse transform in place, bit-reversed order in and natural order out. Not scaled, the output is
+ * FFTLength times what arm_cfft_f32 would give
+ *
+ * @param data FFTLength interleaved complex values
+ */
+_section_itcm
+void fftInverse(float32_t *data)
+{
+	if (FFT_LOG2 & 1)
+	{
+		radix2Stage(data);
+	}
+#pragma GCC unroll 8
+	for (size_t quarter = (FFT_LOG2 & 1) ? 2 : 1; quarter <= FFTLength / 4; quarter *= 4)
+	{
+		inverseStage(data, quarter);
+	}
+}
+
+/**
+ * @brief Swap a spectrum between bit-reversed and natural order, for callers that need the bins in place
+ *
+ * @param data FFTLength interleaved complex values
+ */
+void fftReorder(float32_t *data)
+{
+	for (size_t k = 1; k < FFTLength; k++)
+	{
+		const size_t r = fftBin(k);
+		if (k < r)
+		{
+			const float32_t re = data[2 * k];
+			const float32_t im = data[2 * k + 1];
+			data[2 * k] = data[2 * r];
+			data[2 * k + 1] = data[2 * r + 1];
+			data[2 * r] = re;
+			data[2 * r + 1] = im;
+		}
+	}
+}
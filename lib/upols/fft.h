@@ -0,0 +1,51 @@
+/**
+ * @file fft.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief FFTLength-point complex FFT specialised for the head partitions, spectra in bit-reversed order
+ * @version 0.1
+ * @date 2021-12-23
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ */
+
+#pragma once
+
+#include "upols.h"
+
+#define FFT_LOG2 __builtin_ctz(FFTLength)
+#define FFT_TWIDDLES (3 * FFTLength / 4) // W^n for n < 3L / 4 covers every stage of a radix-4 transform
+
+/**
+ * @brief Position of bin k in a spectrum left in bit-reversed order by fftForward()
+ *
+ * @param k Bin in [0, FFTLength)
+ * @return Complex index of the bin
+ */
+_inline_always size_t fftBin(const size_t k)
+{
+#ifdef ARDUINO
+	return __RBIT(k) >> (32 - FFT_LOG2);
+#else
+	uint32_t r = (uint32_t)k;
+	r = ((r >> 1) & 0x55555555u) | ((r & 0x55555555u) << 1);
+	r = ((r >> 2) & 0x33333333u) | ((r & 0x33333333u) << 2);
+	r = ((r >> 4) & 0x0f0f0f0fu) | ((r & 0x0f0f0f0fu) << 4);
+	r = ((r >> 8) & 0x00ff00ffu) | ((r & 0x00ff00ffu) << 8);
+	r = (r >> 16) | (r << 16);
+	return r >> (32 - FFT_LOG2);
+#endif
+}
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+	void fftForward(float32_t *data);
+	void fftInverse(float32_t *data);
+	void fftReorder(float32_t *data);
+
+	extern const float32_t fftTwiddles[2 * FFT_TWIDDLES];
+#ifdef __cplusplus
+}
+#endif
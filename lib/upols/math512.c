@@ -57,6 +57,20 @@ void cmac512(const float *cmplxA, const float *cmplxB, float *cmplxAccum)
 	}
 }
 
+/**
+ * @brief Hermitian multiply-accumulate for partitions of any length
+ *
+ * @param halfSpectra Pointer to the split stereo half-spectra of a delay-line partition
+ * @param filter Pointer to the left and right filter half-spectra of a partition
+ * @param halfAccum Pointer to accumulator buffer
+ * @param bins Number of unique bins, half the FFT length
+ */
+_section_itcm
+void hmac(const float *halfSpectra, const float *filter, float *halfAccum, size_t bins)
+{
+	hmacN(halfSpectra, filter, halfAccum, bins);
+}
+
 /**
  * @brief Copy contents of src over to dest. Somehow faster than memcpy with gccarmnoneeabi and -O2
  * 
@@ -65,13 +79,7 @@ void cmac512(const float *cmplxA, const float *cmplxB, float *cmplxAccum)
  */
 void cp512(const float *src, float *dest)
 {
-	for (size_t i = 128; i > 0; i--)
-	{
-		*dest++ = *src++;
-		*dest++ = *src++;
-		*dest++ = *src++;
-		*dest++ = *src++;
-	}
+	cpN(src, dest, 512);
 }
 
 /**
@@ -81,11 +89,5 @@ void cp512(const float *src, float *dest)
  */
 void clear512(float *dest)
 {
-	for (size_t i = 128; i > 0; i--)
-	{
-		*dest++ = 0;
-		*dest++ = 0;
-		*dest++ = 0;
-		*dest++ = 0;
-	}
+	clearN(dest, 512);
 }
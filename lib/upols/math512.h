@@ -1,7 +1,7 @@
 /**
  * @file math512.h
  * @author Jason Conway (jpc@jasonconway.dev)
- * @brief Optimized routines for block sizes of 512 (2048 bytes)
+ * @brief Optimized routines for block sizes of 512 (2048 bytes), plus the length-generic kernels they are built from
  * @version 0.1
  * @date 2021-11-26
  * 
@@ -16,11 +16,243 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+// Hot kernels are pinned to ITCM regardless of where the linker would otherwise put .text
+#ifndef _section_itcm
+#ifdef ARDUINO
+#define _section_itcm __attribute__((section(".fastrun"), noinline, noclone))
+#else
+#define _section_itcm __attribute__((noinline, noclone))
+#endif
+#endif
+
+// Length-generic kernels are always inlined so a compile-time length fixes the trip count at every call site
+#ifndef _inline_always
+#define _inline_always static inline __attribute__((always_inline))
+#endif
+
+/**
+ * @brief Multiply-accumulate the split stereo half-spectra of one partition against the Hermitian half-spectra
+ * of both filters. Bins 0 and N are purely real (or purely imaginary for the right channel) and are packed
+ * into the first four values so that every array is exactly 4 * bins long.
+ *
+ * halfSpectra / halfAccum: [U0, UN, V0 / j, VN / j] followed by [Re Uk, Im Uk, Re Vk, Im Vk] for 0 < k < N
+ * filter: [L0, LN, Re L1, Im L1 ... Re LN-1, Im LN-1] followed by the same layout for the right filter
+ *
+ * @param halfSpectra Pointer to the split stereo half-spectra of a delay-line partition
+ * @param filter Pointer to the left and right filter half-spectra of a partition
+ * @param halfAccum Pointer to accumulator buffer
+ * @param bins Number of unique bins, half the FFT length
+ */
+_inline_always void hmacN(const float *__restrict halfSpectra, const float *__restrict filter, float *__restrict halfAccum, const size_t bins)
+{
+	const float *__restrict left = filter;
+	const float *__restrict right = filter + 2 * bins;
+
+	halfAccum[0] += halfSpectra[0] * left[0];
+	halfAccum[1] += halfSpectra[1] * left[1];
+	halfAccum[2] += halfSpectra[2] * right[0];
+	halfAccum[3] += halfSpectra[3] * right[1];
+
+	halfSpectra += 4;
+	halfAccum += 4;
+	left += 2;
+	right += 2;
+
+#pragma GCC unroll 2
+	for (size_t i = bins - 1; i > 0; i--)
+	{
+		const float uRe = halfSpectra[0];
+		const float uIm = halfSpectra[1];
+		const float lRe = left[0];
+		const float lIm = left[1];
+
+		float pRe = halfAccum[0];
+		float pIm = halfAccum[1];
+		pRe += uRe * lRe;
+		const float vRe = halfSpectra[2];
+		pIm += uRe * lIm;
+		const float vIm = halfSpectra[3];
+		pRe -= uIm * lIm;
+		const float rRe = right[0];
+		pIm += uIm * lRe;
+		const float rIm = right[1];
+
+		float mRe = halfAccum[2];
+		float mIm = halfAccum[3];
+		mRe += vRe * rRe;
+		halfAccum[0] = pRe;
+		mIm += vRe * rIm;
+		halfAccum[1] = pIm;
+		mRe -= vIm * rIm;
+		mIm += vIm * rRe;
+		halfAccum[2] = mRe;
+		halfAccum[3] = mIm;
+
+		halfSpectra += 4;
+		halfAccum += 4;
+		left += 2;
+		right += 2;
+	}
+}
+
+/**
+ * @brief Four-path counterpart of hmacN(), both input channels reach both ears. Each delay-line bin is loaded once
+ * and multiplied against all four filters. With U = L and V = j R the crosstalk lands on the accumulators as
+ * P += -j V H_RL and M += j U H_LR, the rotations are folded into the signs of the products.
+ *
+ * filter: the left-in to left-ear and right-in to right-ear half-spectra in the layout hmacN() takes, followed
+ * by left-in to right-ear and right-in to left-ear in the same layout
+ *
+ * @param halfSpectra Pointer to the split stereo half-spectra of a delay-line partition
+ * @param filter Pointer to the four filter half-spectra of a partition
+ * @param halfAccum Pointer to accumulator buffer
+ * @param bins Number of unique bins, half the FFT length
+ */
+_inline_always void hmacQuadN(const float *__restrict halfSpectra, const float *__restrict filter, float *__restrict halfAccum, const size_t bins)
+{
+	const float *__restrict left = filter;
+	const float *__restrict right = filter + 2 * bins;
+	const float *__restrict leftCross = filter + 4 * bins;  // Left-in to right-ear
+	const float *__restrict rightCross = filter + 6 * bins; // Right-in to left-ear
+
+	// DC and Nyquist of both inputs are real, so are the filters'
+	halfAccum[0] += halfSpectra[0] * left[0] + halfSpectra[2] * rightCross[0];
+	halfAccum[1] += halfSpectra[1] * left[1] + halfSpectra[3] * rightCross[1];
+	halfAccum[2] += halfSpectra[2] * right[0] + halfSpectra[0] * leftCross[0];
+	halfAccum[3] += halfSpectra[3] * right[1] + halfSpectra[1] * leftCross[1];
+
+	halfSpectra += 4;
+	halfAccum += 4;
+	left += 2;
+	right += 2;
+	leftCross += 2;
+	rightCross += 2;
+
+	for (size_t i = bins - 1; i > 0; i--)
+	{
+		const float uRe = halfSpectra[0];
+		const float uIm = halfSpectra[1];
+		const float vRe = halfSpectra[2];
+		const float vIm = halfSpectra[3];
+
+		const float lRe = left[0];
+		const float lIm = left[1];
+		const float bRe = rightCross[0];
+		const float bIm = rightCross[1];
+
+		// U H_LL - j V H_RL
+		halfAccum[0] += uRe * lRe - uIm * lIm + vRe * bIm + vIm * bRe;
+		halfAccum[1] += uRe * lIm + uIm * lRe - vRe * bRe + vIm * bIm;
+
+		const float rRe = right[0];
+		const float rIm = right[1];
+		const float aRe = leftCross[0];
+		const float aIm = leftCross[1];
+
+		// V H_RR + j U H_LR
+		halfAccum[2] += vRe * rRe - vIm * rIm - uRe * aIm - uIm * aRe;
+		halfAccum[3] += vRe * rIm + vIm * rRe + uRe * aRe - uIm * aIm;
+
+		halfSpectra += 4;
+		halfAccum += 4;
+		left += 2;
+		right += 2;
+		leftCross += 2;
+		rightCross += 2;
+	}
+}
+
+/**
+ * @brief Mono counterpart of hmacN(). A single real source feeds both ears, so its one half-spectrum X is
+ * multiplied against both filters, accumulating P += X H_L and M += j X H_R in the layout hmacN() uses.
+ *
+ * spectrum: [X0, XN, Re X1, Im X1 ... Re XN-1, Im XN-1]
+ *
+ * @param spectrum Pointer to the half-spectrum of a mono delay-line partition, 2 * bins values
+ * @param filter Pointer to the left and right filter half-spectra of a partition
+ * @param halfAccum Pointer to accumulator buffer, 4 * bins values
+ * @param bins Number of unique bins, half the FFT length
+ */
+_inline_always void hmacMonoN(const float *__restrict spectrum, const float *__restrict filter, float *__restrict halfAccum, const size_t bins)
+{
+	const float *__restrict left = filter;
+	const float *__restrict right = filter + 2 * bins;
+
+	halfAccum[0] += spectrum[0] * left[0];
+	halfAccum[1] += spectrum[1] * left[1];
+	halfAccum[2] += spectrum[0] * right[0];
+	halfAccum[3] += spectrum[1] * right[1];
+
+	spectrum += 2;
+	halfAccum += 4;
+	left += 2;
+	right += 2;
+
+#pragma GCC unroll 2
+	for (size_t i = bins - 1; i > 0; i--)
+	{
+		const float xRe = spectrum[0];
+		const float xIm = spectrum[1];
+		const float lRe = left[0];
+		const float lIm = left[1];
+		const float rRe = right[0];
+		const float rIm = right[1];
+
+		halfAccum[0] += xRe * lRe - xIm * lIm;
+		halfAccum[1] += xRe * lIm + xIm * lRe;
+
+		// j (X H_R)
+		halfAccum[2] -= xRe * rIm + xIm * rRe;
+		halfAccum[3] += xRe * rRe - xIm * rIm;
+
+		spectrum += 2;
+		halfAccum += 4;
+		left += 2;
+		right += 2;
+	}
+}
+
+/**
+ * @brief Copy contents of src over to dest, four values per iteration
+ *
+ * @param src Source buffer
+ * @param dest Destination buffer
+ * @param length Number of values, a multiple of 4
+ */
+_inline_always void cpN(const float *__restrict src, float *__restrict dest, const size_t length)
+{
+	for (size_t i = length / 4; i > 0; i--)
+	{
+		*dest++ = *src++;
+		*dest++ = *src++;
+		*dest++ = *src++;
+		*dest++ = *src++;
+	}
+}
+
+/**
+ * @brief Zero out destination array, four values per iteration
+ *
+ * @param dest Destination buffer
+ * @param length Number of values, a multiple of 4
+ */
+_inline_always void clearN(float *dest, const size_t length)
+{
+	for (size_t i = length / 4; i > 0; i--)
+	{
+		*dest++ = 0;
+		*dest++ = 0;
+		*dest++ = 0;
+		*dest++ = 0;
+	}
+}
+
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 	void cmac512(const float *cmplxA, const float *cmplxB, float *cmplxAccum);
+	void hmac(const float *halfSpectra, const float *filter, float *halfAccum, size_t bins);
 	void cp512(const float *src, float *dest);
 	void clear512(float *dest);
 #ifdef __cplusplus
@@ -0,0 +1,221 @@
+/**
+ * @file mathq15.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Block floating-point routines for the fixed-point UPOLS engine
+ * @version 0.1
+ * @date 2021-12-08
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ */
+
+#include "mathq15.h"
+#include "math512.h"
+
+/**
+ * @brief Saturate a 64-bit value to the range of a q15_t
+ *
+ */
+_inline_always int16_t saturate16(const int64_t value)
+{
+	return (value > INT16_MAX) ? INT16_MAX : (value < INT16_MIN) ? INT16_MIN : (int16_t)value;
+}
+
+/**
+ * @brief Saturate a 64-bit value to the range of a q31_t
+ *
+ */
+_inline_always int32_t saturate32(const int64_t value)
+{
+	return (value > INT32_MAX) ? INT32_MAX : (value < INT32_MIN) ? INT32_MIN : (int32_t)value;
+}
+
+/**
+ * @brief Arithmetic shift right with rounding to nearest
+ *
+ */
+_inline_always int64_t roundShift(const int64_t value, const uint32_t shift)
+{
+	return (value + ((int64_t)1 << (shift - 1))) >> shift;
+}
+
+/**
+ * @brief Twice the split stereo half-spectra at index i of the layout used by splitStereoQ15(), DC and
+ * Nyquist are packed into the first four values
+ *
+ */
+_inline_always int64_t splitValue(const int32_t *spectrum, const size_t bins, const size_t i)
+{
+	if (i < 4)
+	{
+		const size_t bin = (i & 1) ? bins : 0;
+		return 2 * (int64_t)spectrum[2 * bin + (i >> 1)];
+	}
+
+	const size_t k = i / 4;
+	const int64_t aRe = spectrum[2 * k];
+	const int64_t aIm = spectrum[2 * k + 1];
+	const int64_t bRe = spectrum[2 * (2 * bins - k)];
+	const int64_t bIm = spectrum[2 * (2 * bins - k) + 1];
+
+	switch (i & 3)
+	{
+	case 0:
+		return aRe + bRe; // Re U
+	case 1:
+		return aIm - bIm; // Im U
+	case 2:
+		return aRe - bRe; // Re V
+	default:
+		return aIm + bIm; // Im V
+	}
+}
+
+/**
+ * @brief Split the Q31 spectrum of a packed stereo block into the Q15 half-spectra of each channel, same
+ * identities and layout as the floating-point splitStereo(). The partition is normalized to the full Q15
+ * range and shares a single exponent.
+ *
+ * @param spectrum Full Q31 spectrum of 2N interleaved complex values
+ * @param halfSpectra Output buffer of 4N Q15 mantissas
+ * @param bins Number of unique bins, N
+ * @return Exponent of the partition, halfSpectra[i] * 2^-(15 + exponent) is the value of the Q31 half-spectrum
+ */
+_section_itcm
+int8_t splitStereoQ15(const int32_t *spectrum, int16_t *halfSpectra, const size_t bins)
+{
+	uint64_t maxAbs = 0;
+	for (size_t i = 0; i < 4 * bins; i++)
+	{
+		const int64_t value = splitValue(spectrum, bins, i);
+		const uint64_t magnitude = (value < 0) ? (uint64_t)(-value) : (uint64_t)value;
+		maxAbs = (magnitude > maxAbs) ? magnitude : maxAbs;
+	}
+
+	// Values are twice the half-spectra, so shifting the largest into bit 31 puts its mantissa in bit 14
+	int exponent = maxAbs ? __builtin_clzll(maxAbs) - 32 : Q15_EXPONENT_MAX;
+	exponent = (exponent < 0) ? 0 : (exponent > Q15_EXPONENT_MAX) ? Q15_EXPONENT_MAX : exponent;
+
+	for (size_t i = 0; i < 4 * bins; i++)
+	{
+		const int64_t value = splitValue(spectrum, bins, i) * ((int64_t)1 << exponent);
+		halfSpectra[i] = saturate16(roundShift(value, 17));
+	}
+
+	return (int8_t)exponent;
+}
+
+/**
+ * @brief Quantize floating-point spectra to Q15 mantissas sharing a single exponent
+ *
+ * @param spectra Floating-point values
+ * @param mantissas Output buffer of Q15 mantissas
+ * @param length Number of values
+ * @return Exponent of the block, mantissas[i] * 2^-(15 + exponent) approximates spectra[i]
+ */
+int8_t quantizeSpectraQ15(const float *spectra, int16_t *mantissas, const size_t length)
+{
+	float maxAbs = 0.0f;
+	for (size_t i = 0; i < length; i++)
+	{
+		maxAbs = fmaxf(maxAbs, fabsf(spectra[i]));
+	}
+
+	int exponent = Q15_EXPONENT_MAX;
+	if (maxAbs > 0.0f)
+	{
+		frexpf(maxAbs, &exponent); // maxAbs = m * 2^exponent, 0.5 <= m < 1
+		exponent = -exponent;
+		exponent = (exponent < -Q15_EXPONENT_MAX) ? -Q15_EXPONENT_MAX : (exponent > Q15_EXPONENT_MAX) ? Q15_EXPONENT_MAX : exponent;
+	}
+
+	const float scale = ldexpf(1.0f, 15 + exponent);
+	for (size_t i = 0; i < length; i++)
+	{
+		mantissas[i] = saturate16(lrintf(spectra[i] * scale));
+	}
+
+	return (int8_t)exponent;
+}
+
+/**
+ * @brief Fixed-point counterpart of hmacN(). Each complex product of two Q15 mantissas is formed exactly in
+ * 32 bits, the SMUSD / SMUADX pattern, then aligned by the partition scale and accumulated in 64 bits with a
+ * single SMLAL, so no precision is lost across the FDL.
+ *
+ * @param halfSpectra Pointer to the Q15 split stereo half-spectra of a delay-line partition
+ * @param filter Pointer to the Q15 left and right filter half-spectra of a partition
+ * @param halfAccum Pointer to the 64-bit accumulator buffer
+ * @param scale Power of two aligning the exponents of this partition pair to the accumulator
+ * @param bins Number of unique bins, half the FFT length
+ */
+_section_itcm
+void hmacQ15(const int16_t *restrict halfSpectra, const int16_t *restrict filter, int64_t *restrict halfAccum, const int32_t scale, const size_t bins)
+{
+	const int16_t *restrict left = filter;
+	const int16_t *restrict right = filter + 2 * bins;
+
+	halfAccum[0] += (int64_t)(halfSpectra[0] * left[0]) * scale;
+	halfAccum[1] += (int64_t)(halfSpectra[1] * left[1]) * scale;
+	halfAccum[2] += (int64_t)(halfSpectra[2] * right[0]) * scale;
+	halfAccum[3] += (int64_t)(halfSpectra[3] * right[1]) * scale;
+
+	halfSpectra += 4;
+	halfAccum += 4;
+	left += 2;
+	right += 2;
+
+	for (size_t i = bins - 1; i > 0; i--)
+	{
+		const int32_t uRe = halfSpectra[0];
+		const int32_t uIm = halfSpectra[1];
+		const int32_t vRe = halfSpectra[2];
+		const int32_t vIm = halfSpectra[3];
+		const int32_t lRe = left[0];
+		const int32_t lIm = left[1];
+		const int32_t rRe = right[0];
+		const int32_t rIm = right[1];
+
+		// Mantissas are saturated to +/-32767, so neither sum of products can overflow
+		halfAccum[0] += (int64_t)(uRe * lRe - uIm * lIm) * scale;
+		halfAccum[1] += (int64_t)(uRe * lIm + uIm * lRe) * scale;
+		halfAccum[2] += (int64_t)(vRe * rRe - vIm * rIm) * scale;
+		halfAccum[3] += (int64_t)(vRe * rIm + vIm * rRe) * scale;
+
+		halfSpectra += 4;
+		halfAccum += 4;
+		left += 2;
+		right += 2;
+	}
+}
+
+/**
+ * @brief Fixed-point counterpart of mergeStereo(), rebuilding the full Q31 spectrum of the packed stereo
+ * output from the 64-bit accumulators
+ *
+ * @param halfAccum Accumulated half-spectra, 4N values
+ * @param spectrum Output buffer of 2N interleaved complex Q31 values
+ * @param bins Number of unique bins, N
+ * @param shift Right shift taking the accumulators to Q31, at least 1
+ */
+_section_itcm
+void mergeStereoQ31(const int64_t *halfAccum, int32_t *spectrum, const size_t bins, const uint32_t shift)
+{
+	spectrum[0] = saturate32(roundShift(halfAccum[0], shift));
+	spectrum[1] = saturate32(roundShift(halfAccum[2], shift));
+	spectrum[2 * bins] = saturate32(roundShift(halfAccum[1], shift));
+	spectrum[2 * bins + 1] = saturate32(roundShift(halfAccum[3], shift));
+
+	for (size_t k = 1; k < bins; k++)
+	{
+		const int64_t pRe = halfAccum[4 * k];
+		const int64_t pIm = halfAccum[4 * k + 1];
+		const int64_t mRe = halfAccum[4 * k + 2];
+		const int64_t mIm = halfAccum[4 * k + 3];
+
+		spectrum[2 * k] = saturate32(roundShift(pRe + mRe, shift));
+		spectrum[2 * k + 1] = saturate32(roundShift(pIm + mIm, shift));
+		spectrum[2 * (2 * bins - k)] = saturate32(roundShift(pRe - mRe, shift));
+		spectrum[2 * (2 * bins - k) + 1] = saturate32(roundShift(mIm - pIm, shift));
+	}
+}
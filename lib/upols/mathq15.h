@@ -0,0 +1,30 @@
+/**
+ * @file mathq15.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Block floating-point routines for the fixed-point UPOLS engine
+ * @version 0.1
+ * @date 2021-12-08
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Spectra are stored as Q15 mantissas sharing one exponent per partition, value = mantissa * 2^-(15 + exponent)
+#define Q15_EXPONENT_MAX 30
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+	int8_t splitStereoQ15(const int32_t *spectrum, int16_t *halfSpectra, size_t bins);
+	int8_t quantizeSpectraQ15(const float *spectra, int16_t *mantissas, size_t length);
+	void hmacQ15(const int16_t *halfSpectra, const int16_t *filter, int64_t *halfAccum, int32_t scale, size_t bins);
+	void mergeStereoQ31(const int64_t *halfAccum, int32_t *spectrum, size_t bins, uint32_t shift);
+#ifdef __cplusplus
+}
+#endif
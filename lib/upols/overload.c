@@ -0,0 +1,179 @@
+/**
+ * @file overload.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Deadline monitor that sheds filter tails when the convolution nears its cycle budget
+ * @version 0.1
+ * @date 2021-12-22
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ * @details
+ * convolve() hands the cycles each block took to overloadRecord(). A block over UPOLS_OVERLOAD_SHED_PERCENT
+ * of the budget raises the shed level by one, so a sustained overload keeps shedding on consecutive blocks
+ * until it's back under. Every level leaves the last eighth of each filter out of the MAC, the HRTF and the
+ * room reverb alike: the quiet end of the tail goes first and the direct sound always stays. Levels only
+ * come back one at a time after UPOLS_OVERLOAD_HOLD_BLOCKS blocks under UPOLS_OVERLOAD_RESTORE_PERCENT, an
+ * eighth of the MACs is well inside the gap between the two thresholds, so a restored level doesn't
+ * immediately shed again.
+ *
+ * Everything but overloadEvent() is called from the convolution interrupt, or with it disabled.
+ *
+ */
+
+#include "overload.h"
+#include <string.h>
+
+typedef struct overload_t
+{
+	overload_stats_t stats;
+	uint32_t calmBlocks; // Consecutive blocks under the restore threshold
+	overload_event_t events[OVERLOAD_EVENT_QUEUE];
+	volatile uint32_t eventsWritten;
+	uint32_t eventsRead; // Only touched by overloadEvent()
+} overload_t;
+
+static overload_t overload;
+
+/**
+ * @brief Queue a level change for the main loop
+ *
+ */
+static void pushEvent(const uint32_t load)
+{
+	overload_event_t *event = &overload.events[overload.eventsWritten % OVERLOAD_EVENT_QUEUE];
+	event->block = overload.stats.blocks;
+	event->level = overload.stats.level;
+	event->load = (uint16_t)((load < UINT16_MAX) ? load : UINT16_MAX);
+	overload.eventsWritten++;
+}
+
+/**
+ * @brief Set the time a block has before the next one is due and start monitoring
+ *
+ * @param cycles Cycles of perfCycles() per block, 0 turns the monitor off and brings every level back
+ */
+void setCycleBudget(const uint32_t cycles)
+{
+	overload.stats.budget = cycles;
+	overload.calmBlocks = 0;
+	if (cycles == 0 && overload.stats.level)
+	{
+		overload.stats.level = 0;
+		pushEvent(0);
+	}
+}
+
+/**
+ * @brief Account one block and shed or restore a level
+ *
+ * @param cycles Cycles the block took
+ */
+void overloadRecord(const uint32_t cycles)
+{
+	overload_stats_t *stats = &overload.stats;
+	if (stats->budget == 0)
+	{
+		return;
+	}
+
+	const uint32_t load = (uint32_t)(100 * (uint64_t)cycles / stats->budget);
+	stats->overruns += (cycles > stats->budget);
+	if (cycles > stats->peakCycles)
+	{
+		stats->peakCycles = cycles;
+	}
+
+	if (load >= UPOLS_OVERLOAD_SHED_PERCENT)
+	{
+		overload.calmBlocks = 0;
+		if (stats->level < OverloadMaxLevel)
+		{
+			stats->level++;
+			stats->sheds++;
+			if (stats->level > stats->peakLevel)
+			{
+				stats->peakLevel = stats->level;
+			}
+			pushEvent(load);
+		}
+	}
+	else if (load < UPOLS_OVERLOAD_RESTORE_PERCENT)
+	{
+		if (stats->level && ++overload.calmBlocks >= UPOLS_OVERLOAD_HOLD_BLOCKS)
+		{
+			overload.calmBlocks = 0;
+			stats->level--;
+			stats->restores++;
+			pushEvent(load);
+		}
+	}
+	else
+	{
+		overload.calmBlocks = 0;
+	}
+
+	stats->blocks++;
+}
+
+/**
+ * @brief Number of leading partitions of a filter that stay in the MAC at the current level
+ *
+ * @param partitionCount Partitions making up the filter
+ * @return At least one partition, all of them when nothing is shed
+ */
+size_t overloadKeep(const size_t partitionCount)
+{
+	const size_t keep = partitionCount * (OverloadSteps - overload.stats.level) / OverloadSteps;
+	return keep ? keep : 1;
+}
+
+/**
+ * @brief Take the oldest level change not reported yet, from the main loop. Events are dropped oldest first if
+ * more than OVERLOAD_EVENT_QUEUE arrive between calls
+ *
+ * @param event Receives the event
+ * @return Returns false if there is nothing new
+ */
+bool overloadEvent(overload_event_t *event)
+{
+	while (overload.eventsRead != overload.eventsWritten)
+	{
+		if (overload.eventsWritten - overload.eventsRead > OVERLOAD_EVENT_QUEUE)
+		{
+			overload.eventsRead = overload.eventsWritten - OVERLOAD_EVENT_QUEUE;
+		}
+		*event = overload.events[overload.eventsRead % OVERLOAD_EVENT_QUEUE];
+
+		// The slot may have been reused while it was copied
+		if (overload.eventsWritten - overload.eventsRead <= OVERLOAD_EVENT_QUEUE)
+		{
+			overload.eventsRead++;
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @brief Copy out the monitor's counters
+ *
+ */
+void overloadStats(overload_stats_t *stats)
+{
+	*stats = overload.stats;
+}
+
+/**
+ * @brief Clear the counters, the budget and the current level are kept
+ *
+ */
+void overloadReset(void)
+{
+	overload_stats_t *stats = &overload.stats;
+	const uint32_t budget = stats->budget;
+	const uint16_t level = stats->level;
+	memset(stats, 0, sizeof(*stats));
+	stats->budget = budget;
+	stats->level = level;
+	stats->peakLevel = level;
+}
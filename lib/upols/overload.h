@@ -0,0 +1,70 @@
+/**
+ * @file overload.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Deadline monitor that sheds filter tails when the convolution nears its cycle budget
+ * @version 0.1
+ * @date 2021-12-22
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// A block taking this much of the budget sheds a level, the level comes back once UPOLS_OVERLOAD_HOLD_BLOCKS
+// blocks in a row have stayed under UPOLS_OVERLOAD_RESTORE_PERCENT. Override from build_flags
+#ifndef UPOLS_OVERLOAD_SHED_PERCENT
+#define UPOLS_OVERLOAD_SHED_PERCENT 90
+#endif
+#ifndef UPOLS_OVERLOAD_RESTORE_PERCENT
+#define UPOLS_OVERLOAD_RESTORE_PERCENT 70
+#endif
+#ifndef UPOLS_OVERLOAD_HOLD_BLOCKS
+#define UPOLS_OVERLOAD_HOLD_BLOCKS 256
+#endif
+
+// Events queued for the main loop, older ones are overwritten if it falls behind
+#define OVERLOAD_EVENT_QUEUE 8
+
+enum OverloadLevels
+{
+	OverloadSteps = 8,					   // Every level sheds another eighth of each filter
+	OverloadMaxLevel = OverloadSteps - 1, // The first eighth always stays
+};
+
+typedef struct overload_stats_t
+{
+	uint32_t budget;	 // Cycles per block, 0 while the monitor is off
+	uint32_t blocks;	 // Blocks measured
+	uint32_t overruns;	 // Blocks that took longer than the budget
+	uint32_t peakCycles;
+	uint32_t sheds;		 // Levels shed
+	uint32_t restores;	 // Levels brought back
+	uint16_t level;		 // Current level, 0 when nothing is shed
+	uint16_t peakLevel;
+} overload_stats_t;
+
+typedef struct overload_event_t
+{
+	uint32_t block;	// Blocks measured before this one
+	uint16_t level; // Level the block moved to
+	uint16_t load;	// Percent of the budget the block took
+} overload_event_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+	void setCycleBudget(const uint32_t cycles);
+	void overloadRecord(const uint32_t cycles);
+	size_t overloadKeep(const size_t partitionCount);
+	bool overloadEvent(overload_event_t *event);
+	void overloadStats(overload_stats_t *stats);
+	void overloadReset(void);
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,93 @@
+/**
+ * @file perf.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Per-stage cycle accounting for the convolution hot path
+ * @version 0.1
+ * @date 2021-12-04
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ */
+
+#include "perf.h"
+#include <string.h>
+
+static perf_stat_t perfStats[PerfStageCount];
+
+static const char *const perfStageNames[PerfStageCount] = {
+	"q15->float",
+	"overlap",
+	"fft",
+	"mac",
+	"ifft",
+	"crossfade",
+	"tiers",
+	"reverb",
+	"float->q15",
+	"interpolate",
+	"convolve",
+	"mix",
+};
+
+/**
+ * @brief Account the cycles elapsed since start to a stage. Only called from the convolution interrupt
+ *
+ * @param stage Stage being timed
+ * @param start Value of perfCycles() when the stage began
+ */
+void perfRecord(const enum PerfStage stage, const uint32_t start)
+{
+#ifndef UPOLS_NO_PERF
+	const uint32_t cycles = perfCycles() - start; // Unsigned wraparound keeps this correct across overflow
+	perf_stat_t *stat = &perfStats[stage];
+
+	if (stat->count == 0 || cycles < stat->min)
+	{
+		stat->min = cycles;
+	}
+	if (cycles > stat->max)
+	{
+		stat->max = cycles;
+	}
+	stat->total += cycles;
+	stat->count++;
+
+	size_t bin = cycles ? (31 - __builtin_clz(cycles)) : 0;
+	bin = (bin < PERF_HISTOGRAM_SHIFT) ? 0 : bin - PERF_HISTOGRAM_SHIFT + 1;
+	stat->histogram[(bin < PERF_HISTOGRAM_BINS) ? bin : PERF_HISTOGRAM_BINS - 1]++;
+#else
+	(void)stage;
+	(void)start;
+#endif
+}
+
+/**
+ * @brief Copy out the statistics of every stage. Interrupts should be disabled around the call so a block
+ * can't be accounted halfway through the copy
+ *
+ * @param stats Buffer of PerfStageCount perf_stat_t
+ */
+void perfSnapshot(perf_stat_t *stats)
+{
+	memcpy(stats, perfStats, sizeof(perfStats));
+}
+
+/**
+ * @brief Clear the statistics of every stage
+ *
+ */
+void perfReset(void)
+{
+	memset(perfStats, 0, sizeof(perfStats));
+}
+
+/**
+ * @brief Short printable name of a stage
+ *
+ * @param stage Stage to look up
+ * @return Name of the stage
+ */
+const char *perfStageName(const enum PerfStage stage)
+{
+	return (stage < PerfStageCount) ? perfStageNames[stage] : "";
+}
@@ -0,0 +1,93 @@
+/**
+ * @file perf.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Per-stage cycle accounting for the convolution hot path
+ * @version 0.1
+ * @date 2021-12-04
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Cycle counter of the DWT, also used by msleep() in auricle.h
+#define DWT_CYCCNT_ADDRESS 0xE0001004
+
+// Timings are bucketed by powers of two, bin 0 collects everything under 2^PERF_HISTOGRAM_SHIFT cycles
+#define PERF_HISTOGRAM_BINS 16
+#define PERF_HISTOGRAM_SHIFT 5
+
+enum PerfStage
+{
+	PerfQ15ToFloat,		// arm_q15_to_float() of both channels
+	PerfOverlap,		// Sliding window update
+	PerfForwardFFT,		// Forward FFT and stereo split into the FDL
+	PerfMAC,			// One partition of one filter set, sampled once per partition
+	PerfInverseFFT,		// Stereo merge and inverse FFT of one filter set
+	PerfCrossfade,		// Crossfade to an incoming filter set
+	PerfTiers,			// Non-uniform tail tiers
+	PerfReverb,			// Room reverb bus, sampled once for its head MACs and once for its tail tiers
+	PerfFloatToQ15,		// arm_float_to_q15() of both channels, or their Q23 rounding
+	PerfInterpolate,	// Partitions of an interpolated filter set prepared after a block
+	PerfConvolve,		// Whole call to convolve()
+	PerfMix,			// Whole call to mixSources() of the multi-source engine
+	PerfStageCount
+};
+
+typedef struct perf_stat_t
+{
+	uint32_t count;
+	uint32_t min;
+	uint32_t max;
+	uint64_t total;
+	uint32_t histogram[PERF_HISTOGRAM_BINS];
+} perf_stat_t;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+	void perfRecord(const enum PerfStage stage, const uint32_t start);
+	void perfSnapshot(perf_stat_t *stats);
+	void perfReset(void);
+	const char *perfStageName(const enum PerfStage stage);
+#ifdef __cplusplus
+}
+#endif
+
+// The clock is always there for the overload monitor, UPOLS_NO_PERF only compiles out the stage accounting
+#ifdef ARDUINO
+/**
+ * @brief Current value of the free-running cycle counter
+ *
+ */
+static inline uint32_t perfCycles(void)
+{
+	return *(volatile uint32_t *)DWT_CYCCNT_ADDRESS;
+}
+#else
+#include <time.h>
+
+/**
+ * @brief Host builds have no DWT, stages are timed in nanoseconds of the monotonic clock instead
+ *
+ */
+static inline uint32_t perfCycles(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint32_t)((uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec);
+}
+#endif
+
+#ifndef UPOLS_NO_PERF
+#define perfStart() perfCycles()
+#define perfStop(stage, start) perfRecord((stage), (start))
+#else
+#define perfStart() 0
+#define perfStop(stage, start) ((void)(start))
+#endif
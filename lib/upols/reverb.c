@@ -0,0 +1,360 @@
+/**
+ * @file reverb.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Room reverb bus running alongside the HRTF convolution, on the same FDL
+ * @version 0.1
+ * @date 2021-12-20
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ * @details
+ * A stereo room impulse response, seconds long, convolved with the same input as the HRTFs and summed into
+ * their output. Its first ReverbHeadPartitions partitions are the HRTF partition size, so they are
+ * multiplied against the stereo engine's FDL and accumulated into the HRTF accumulator: the head costs its
+ * MACs and nothing else, no forward or inverse FFT of its own.
+ *
+ * The rest of the response is cut into the two non-uniform tiers convolveTier() already runs for
+ * UPOLS_NONUNIFORM, the second one with the largest partitions arm_const_structs.h has an FFT for. Their
+ * transforms and MACs are spread over the blocks making up each of their partitions, so only a sliver of the
+ * tail is processed on any one block. The second tier's spectra and FDL are the bulk of the bus and live in
+ * EXTMEM, everything the first tier touches fits in OCRAM2.
+ *
+ * Responses are streamed in with addReverbTaps() from the main loop, a partition is transformed as soon as
+ * its taps are all in. The bus is bypassed while loading, so the filter and the tier state are never
+ * touched while they're being convolved with.
+ *
+ */
+
+#include "reverb.h"
+#include "overload.h"
+#include "./../../include/auricle.h"
+
+#ifdef UPOLS_REVERB
+#ifdef UPOLS_FIXED
+#error "UPOLS_REVERB shares the FDL of the floating-point engine"
+#endif
+
+_Static_assert((int)ReverbHeadPartitions <= (int)PartitionCount, "The reverb head is longer than the FDL it shares");
+_Static_assert((int)ReverbTier1PartitionSize >= 2 * (int)PartitionSize && ReverbTier1PartitionSize < ReverbTier2PartitionSize,
+			   "UPOLS_REVERB_HEAD_PARTITIONS must leave the first tier between two blocks and the second tier's partition");
+_Static_assert(IS_CFFT_LENGTH(2 * ReverbTier1PartitionSize) && IS_CFFT_LENGTH(2 * ReverbTier2PartitionSize), "Reverb tier FFTs must exist in arm_const_structs.h");
+_Static_assert(ReverbImpulseSamples % ReverbTier2PartitionSize == 0 && ReverbTier2PartitionCount > 0,
+			   "UPOLS_REVERB_SAMPLES must be a multiple of 2048 and at least 6144");
+
+_section_dma_aligned static float32_t headSpectra[SpectraLength * ReverbHeadPartitions];
+static bool headAudible[ReverbHeadPartitions];
+
+_section_dma static float32_t tier1Spectra[4 * ReverbTier1PartitionSize * ReverbTier1PartitionCount];
+_section_dma static float32_t tier1DelayLine[4 * ReverbTier1PartitionSize * ReverbTier1PartitionCount];
+_section_dma static float32_t tier1Window[4 * ReverbTier1PartitionSize];
+_section_dma static float32_t tier1Accum[4 * ReverbTier1PartitionSize];
+_section_dma static float32_t tier1Spectrum[4 * ReverbTier1PartitionSize];
+_section_dma static float32_t tier1Output[2 * ReverbTier1PartitionSize];
+static bool tier1Audible[ReverbTier1PartitionCount];
+
+_section_extmem static float32_t tier2Spectra[4 * ReverbTier2PartitionSize * ReverbTier2PartitionCount];
+_section_extmem static float32_t tier2DelayLine[4 * ReverbTier2PartitionSize * ReverbTier2PartitionCount];
+_section_dma static float32_t tier2Window[4 * ReverbTier2PartitionSize];
+_section_dma static float32_t tier2Accum[4 * ReverbTier2PartitionSize];
+_section_dma static float32_t tier2Spectrum[4 * ReverbTier2PartitionSize];
+_section_dma static float32_t tier2Output[2 * ReverbTier2PartitionSize];
+static bool tier2Audible[ReverbTier2PartitionCount];
+
+static tier_t tiers[] = {
+	{
+		.partitionSize = ReverbTier1PartitionSize,
+		.partitionCount = ReverbTier1PartitionCount,
+		.fft = CFFT_F32(2 * ReverbTier1PartitionSize),
+		.slidingWindow = tier1Window,
+		.delayLine = tier1DelayLine,
+		.halfAccum = tier1Accum,
+		.spectrum = tier1Spectrum,
+		.output = tier1Output,
+	},
+	{
+		.partitionSize = ReverbTier2PartitionSize,
+		.partitionCount = ReverbTier2PartitionCount,
+		.fft = CFFT_F32(2 * ReverbTier2PartitionSize),
+		.slidingWindow = tier2Window,
+		.delayLine = tier2DelayLine,
+		.halfAccum = tier2Accum,
+		.spectrum = tier2Spectrum,
+		.output = tier2Output,
+	},
+};
+
+static float32_t *const tierSpectra[] = {tier1Spectra, tier2Spectra};
+static bool *const tierAudible[] = {tier1Audible, tier2Audible};
+
+#define TIER_COUNT (sizeof(tiers) / sizeof(tiers[0]))
+
+// Partitions of the whole response, head then tiers, overloadKeep() sheds them from the end
+#define REVERB_PARTITIONS (ReverbHeadPartitions + ReverbTier1PartitionCount + ReverbTier2PartitionCount)
+
+// The bus is idle while loading, so the second tier's scratch stages the partition being loaded
+static float32_t *const stagedTaps = tier2Spectrum;
+
+static volatile bool enabled; // Only set by finishReverb() once the whole filter and the tier state are ready
+static size_t loadedTaps;	  // Taps per channel received by addReverbTaps() since beginReverb()
+static float32_t loadGain;
+
+// Partition of the response a tap falls in, and where it's transformed to
+typedef struct reverb_partition_t
+{
+	size_t start;	 // First tap of the partition
+	size_t size;	 // Taps per channel
+	float32_t *spectra;
+	bool *audible;
+	const arm_cfft_instance_f32 *fft;
+} reverb_partition_t;
+
+/**
+ * @brief Find the partition holding a tap of the response, head then tiers
+ *
+ * @param tap Tap index, less than ReverbImpulseSamples
+ */
+static reverb_partition_t partitionOf(const size_t tap)
+{
+	if (tap < ReverbHeadSamples)
+	{
+		const size_t j = tap / PartitionSize;
+		return (reverb_partition_t){PartitionSize * j, PartitionSize, &headSpectra[SpectraLength * j], &headAudible[j], CFFT_F32(FFTLength)};
+	}
+
+	const size_t t = (tap < 2 * ReverbTier2PartitionSize) ? 0 : 1;
+	const size_t size = tiers[t].partitionSize;
+	const size_t j = tap / size - 2;
+	return (reverb_partition_t){size * (2 + j), size, &tierSpectra[t][4 * size * j], &tierAudible[t][j], tiers[t].fft};
+}
+
+/**
+ * @brief Transform the staged taps into their partition, the taps past loadedTaps are zero
+ *
+ */
+static void transformStaged(const reverb_partition_t partition)
+{
+	float32_t *leftTaps = stagedTaps;
+	float32_t *rightTaps = stagedTaps + partition.size;
+
+	// Same floor as the HRTF partitions, on the taps' energy rather than the spectrum's
+	const float32_t floor = powf(10.0f, UPOLS_PARTITION_FLOOR_DB / 10.0f);
+	float32_t leftEnergy = 0.0f;
+	float32_t rightEnergy = 0.0f;
+	for (size_t i = 0; i < partition.size; i++)
+	{
+		leftEnergy += leftTaps[i] * leftTaps[i];
+		rightEnergy += rightTaps[i] * rightTaps[i];
+	}
+
+	*partition.audible = (leftEnergy > floor) || (rightEnergy > floor);
+	if (*partition.audible)
+	{
+		transformPartition(leftTaps, rightTaps, partition.size, partition.fft, partition.spectra);
+	}
+}
+
+/**
+ * @brief Bypass the bus and start loading a new room response into it. Audio keeps running through the HRTFs
+ * alone until finishReverb().
+ *
+ * @param gain Linear gain the response is scaled by as it's loaded
+ */
+_section_flash
+void beginReverb(const float32_t gain)
+{
+	enabled = false;
+	loadedTaps = 0;
+	loadGain = gain;
+	memset(stagedTaps, 0, 2 * ReverbTier2PartitionSize * sizeof(float32_t));
+}
+
+/**
+ * @brief Append taps to the response being loaded, transforming each partition once it's complete. Taps past
+ * ReverbImpulseSamples are dropped.
+ *
+ * @param leftTaps Left channel taps
+ * @param rightTaps Right channel taps
+ * @param count Number of taps per channel
+ * @return Number of taps taken, less than count once the bus is full
+ */
+_section_flash
+size_t addReverbTaps(const float32_t *leftTaps, const float32_t *rightTaps, const size_t count)
+{
+	size_t taken = 0;
+	while (taken < count && loadedTaps < ReverbImpulseSamples)
+	{
+		const reverb_partition_t partition = partitionOf(loadedTaps);
+		const size_t offset = loadedTaps - partition.start;
+		const size_t run = (count - taken < partition.size - offset) ? count - taken : partition.size - offset;
+
+		for (size_t i = 0; i < run; i++)
+		{
+			stagedTaps[offset + i] = loadGain * leftTaps[taken + i];
+			stagedTaps[partition.size + offset + i] = loadGain * rightTaps[taken + i];
+		}
+		taken += run;
+		loadedTaps += run;
+
+		if (offset + run == partition.size)
+		{
+			transformStaged(partition);
+			memset(stagedTaps, 0, 2 * partition.size * sizeof(float32_t));
+		}
+	}
+	return taken;
+}
+
+/**
+ * @brief Complete the response with silence, clear the tiers' history and switch the bus in. The head is
+ * heard straight away, the tail builds up over its length as the tiers' FDLs fill.
+ *
+ * @return Returns false if no taps were loaded, leaving the bus bypassed
+ */
+_section_flash
+bool finishReverb(void)
+{
+	if (loadedTaps == 0)
+	{
+		return false;
+	}
+
+	// The partial partition is transformed zero-padded, the ones after it are skipped by the MAC
+	if (loadedTaps < ReverbImpulseSamples)
+	{
+		const reverb_partition_t partition = partitionOf(loadedTaps);
+		if (loadedTaps > partition.start)
+		{
+			transformStaged(partition);
+		}
+		for (size_t tap = partition.start + ((loadedTaps > partition.start) ? partition.size : 0); tap < ReverbImpulseSamples;)
+		{
+			const reverb_partition_t silent = partitionOf(tap);
+			*silent.audible = false;
+			tap += silent.size;
+		}
+	}
+
+	for (size_t t = 0; t < TIER_COUNT; t++)
+	{
+		tier_t *tier = &tiers[t];
+		const size_t spectraLength = 4 * tier->partitionSize;
+		tier->step = 0;
+		tier->currentIndex = 0;
+		memset(tier->slidingWindow, 0, spectraLength * sizeof(float32_t));
+		memset(tier->delayLine, 0, spectraLength * tier->partitionCount * sizeof(float32_t));
+		memset(tier->halfAccum, 0, spectraLength * sizeof(float32_t));
+		memset(tier->spectrum, 0, spectraLength * sizeof(float32_t));
+		memset(tier->output, 0, 2 * tier->partitionSize * sizeof(float32_t));
+	}
+
+	enabled = true;
+	return true;
+}
+
+/**
+ * @brief Bypass the bus, the loaded response is kept but has to be loaded again to switch it back in
+ *
+ */
+void disableReverb(void)
+{
+	enabled = false;
+	loadedTaps = 0;
+}
+
+bool reverbEnabled(void)
+{
+	return enabled;
+}
+
+/**
+ * @brief Length of the response loaded so far, or of the one playing
+ *
+ */
+size_t reverbTaps(void)
+{
+	return loadedTaps;
+}
+
+/**
+ * @brief Accumulate the head of the response against the stereo engine's FDL, partitions line up with the
+ * FDL exactly like the HRTF's
+ *
+ * @param delayLine FDL of the stereo engine, PartitionCount partitions of split stereo half-spectra
+ * @param currentIndex FDL partition written this block
+ * @param halfAccum Accumulator the HRTF is accumulated into
+ */
+_section_itcm
+void accumulateReverb(const float32_t *delayLine, const size_t currentIndex, float32_t *halfAccum)
+{
+	if (!enabled)
+	{
+		return;
+	}
+
+	uint32_t stageStart = perfStart();
+	const size_t kept = overloadKeep(REVERB_PARTITIONS);
+	const size_t last = (kept < ReverbHeadPartitions) ? kept : ReverbHeadPartitions;
+	size_t shiftIndex = currentIndex;
+	for (size_t i = 0; i < last; i++)
+	{
+		if (headAudible[i])
+		{
+			hmacN(&delayLine[SpectraLength * shiftIndex], &headSpectra[SpectraLength * i], halfAccum, PartitionSize);
+		}
+
+		// Decrement with wraparound
+		shiftIndex = (shiftIndex + (PartitionCount - 1)) % PartitionCount;
+	}
+	perfStop(PerfReverb, stageStart);
+}
+
+/**
+ * @brief Advance the tail of the response by one block and add it to the output
+ *
+ * @param audioData Current input block with the left channel in the even indexes and right in the odd
+ * @param leftOutput Pointer to the left channel time-domain output buffer, accumulated into
+ * @param rightOutput Pointer to the right channel time-domain output buffer, accumulated into
+ */
+_section_itcm
+void convolveReverb(const float32_t *audioData, float32_t *leftOutput, float32_t *rightOutput)
+{
+	if (!enabled)
+	{
+		return;
+	}
+
+	uint32_t stageStart = perfStart();
+	const size_t kept = overloadKeep(REVERB_PARTITIONS);
+	size_t first = ReverbHeadPartitions;
+	for (size_t t = 0; t < TIER_COUNT; t++)
+	{
+		const size_t partitionLimit = (kept > first) ? kept - first : 0;
+		convolveTier(&tiers[t], tierSpectra[t], tierAudible[t], partitionLimit, audioData, leftOutput, rightOutput);
+		first += tiers[t].partitionCount;
+	}
+	perfStop(PerfReverb, stageStart);
+}
+
+static const memmap_entry_t memoryMap[] = {
+	{"reverbHead", headSpectra, sizeof(headSpectra)},
+	{"reverbTier1", tier1Spectra, sizeof(tier1Spectra)},
+	{"reverbTier1DelayLine", tier1DelayLine, sizeof(tier1DelayLine)},
+	{"reverbTier1Buffers", tier1Window, sizeof(tier1Window) + sizeof(tier1Accum) + sizeof(tier1Spectrum) + sizeof(tier1Output)},
+	{"reverbTier2", tier2Spectra, sizeof(tier2Spectra)},
+	{"reverbTier2DelayLine", tier2DelayLine, sizeof(tier2DelayLine)},
+	{"reverbTier2Buffers", tier2Window, sizeof(tier2Window) + sizeof(tier2Accum) + sizeof(tier2Spectrum) + sizeof(tier2Output)},
+	{"accumulateReverb", (const void *)accumulateReverb, 0},
+	{"convolveReverb", (const void *)convolveReverb, 0},
+};
+
+/**
+ * @brief Where each buffer and kernel of the reverb bus landed, in the format of upolsMemoryMap()
+ *
+ * @param entryCount Receives the number of entries
+ */
+const memmap_entry_t *reverbMemoryMap(size_t *entryCount)
+{
+	*entryCount = sizeof(memoryMap) / sizeof(memoryMap[0]);
+	return memoryMap;
+}
+#endif
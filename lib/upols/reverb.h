@@ -0,0 +1,57 @@
+/**
+ * @file reverb.h
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Room reverb bus running alongside the HRTF convolution, on the same FDL
+ * @version 0.1
+ * @date 2021-12-20
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ */
+
+#pragma once
+
+#include "upols.h"
+
+// Length of the room impulse response and how many of its first partitions are convolved straight off the
+// stereo engine's FDL, override from build_flags. The rest goes to two tiers of larger partitions in EXTMEM
+#ifndef UPOLS_REVERB_SAMPLES
+#define UPOLS_REVERB_SAMPLES 98304
+#endif
+#ifndef UPOLS_REVERB_HEAD_PARTITIONS
+#ifndef UPOLS_NONUNIFORM
+#define UPOLS_REVERB_HEAD_PARTITIONS 16
+#else
+#define UPOLS_REVERB_HEAD_PARTITIONS 8
+#endif
+#endif
+
+enum ReverbLengths
+{
+	ReverbHeadPartitions = UPOLS_REVERB_HEAD_PARTITIONS,	  // Partitions sharing the stereo engine's FDL and inverse FFT
+	ReverbHeadSamples = PartitionSize * ReverbHeadPartitions, // Number of taps covered by the head
+	ReverbTier1PartitionSize = ReverbHeadSamples / 2,		  // A tier starts exactly twice its partition size in
+	ReverbTier2PartitionSize = 2048,						  // Largest partition whose packed stereo FFT is in arm_const_structs.h
+	ReverbTier1PartitionCount = 2 * ReverbTier2PartitionSize / ReverbTier1PartitionSize - 2,
+	ReverbImpulseSamples = UPOLS_REVERB_SAMPLES,			  // 2.2 s at 44.1 kHz by default
+	ReverbTier2PartitionCount = ReverbImpulseSamples / ReverbTier2PartitionSize - 2,
+};
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+	void beginReverb(const float32_t gain);
+	size_t addReverbTaps(const float32_t *leftTaps, const float32_t *rightTaps, const size_t count);
+	bool finishReverb(void);
+	void disableReverb(void);
+	bool reverbEnabled(void);
+	size_t reverbTaps(void);
+	const memmap_entry_t *reverbMemoryMap(size_t *entryCount);
+
+	// Called by the stereo engine on every block
+	void accumulateReverb(const float32_t *delayLine, const size_t currentIndex, float32_t *halfAccum);
+	void convolveReverb(const float32_t *audioData, float32_t *leftOutput, float32_t *rightOutput);
+#ifdef __cplusplus
+}
+#endif
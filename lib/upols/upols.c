@@ -12,148 +12,2359 @@
  * HRTF - Head-Related Transfer Function
  * The HRTF is the Discrete Fourier Transform of the HRIR
  * The filters_t struct holds two filters, one for each ear.
+ * The HRTF of a real HRIR is Hermitian-symmetric, so only bins [0, N] of each partition are stored, left
+ * then right. The FDL likewise holds the left and right input spectra split out of the packed stereo FFT,
+ * halving both the filter memory and the complex MACs.
+ * Two filters_t sets are kept so a new HRTF can be prepared while the other is still in use. The new set is
+ * crossfaded in over the course of a single audio block, then the old set is retired.
  *
+ * The head partitions are transformed by the fixed-length kernel in fft.c rather than arm_cfft_f32. Its spectra
+ * are in bit-reversed order, the stereo split and merge index through fftBin() so nothing else sees it.
+ *
+ * Building with UPOLS_NONUNIFORM splits the filter into a head of PartitionSize partitions convolved every
+ * block plus tail tiers of progressively larger partitions. A tier with partition size N only has to deliver
+ * N output samples every N / PartitionSize blocks, so its forward FFT, complex MACs, and inverse FFT are
+ * scheduled across those blocks. Tiers pick up a new filter set partition by partition as it's swapped in.
+ *
+ * Building with UPOLS_FOUR_PATH adds the crosstalk paths of a virtual speaker pair. Each partition of a
+ * filters_t set holds four filters, both ears of each input channel, and the MAC runs every FDL bin through
+ * all four. The split stereo FDL already holds both inputs, so this costs MACs and filter memory only.
+ *
+ * Building with UPOLS_FIXED swaps in a fixed-point engine. The FDL and filter spectra are held as Q15
+ * mantissas with one exponent per partition, halving their memory. The forward and inverse transforms are
+ * arm_cfft_q31, and the MACs accumulate exact 32-bit products in 64 bits, so the q15 audio is never
+ * converted to float.
+ *
+ * convolve() reports the cycles of every block to the overload monitor in overload.c. Near the deadline it
+ * leaves the tail partitions out of the MAC, an eighth of the filter at a time, and brings them back once the
+ * load has stayed down.
+ *
+ * Fractional angles are rendered with the frequency-domain blend of the two neighbouring HRTFs. The blend is
+ * prepared by convolve() a few partitions at a time after each block, so the audio never stalls on it.
+ *
+ * Placement is explicit rather than left to the linker. The FDL, the first filter set, and the accumulators
+ * are read or written every block and live in DTCM, 32-byte aligned. The second filter set doesn't fit and
+ * goes in OCRAM2, behind the D-cache. The per-block kernels are pinned to ITCM while the filter preparation
+ * only runs on an angle change and stays in flash. ash memmap lists where each of them landed.
+ *
+ * convolve() and the filter loading functions drive a default upols_instance_t over those placed buffers.
+ * upolsInit() sets up further instances over an arena the caller supplies, so several convolvers can run
+ * side by side, each with its own FDL and filter sets. They share the overload shed level, and only the default
+ * engine interpolates, caches filter sets and feeds the room reverb.
+ *
+ */
+
+#include "upols.h"
+#include "fft.h"
+#include "overload.h"
+#ifdef UPOLS_REVERB
+#include "reverb.h"
+#endif
+#ifndef UPOLS_PACKED_IR
+#include "./../../include/tablIR.h"
+#else
+#include "./../../include/packIR.h"
+_Static_assert(PACK_IR_SAMPLES == TableImpulseSamples && PartitionSize % PACK_IR_BLOCK_SIZE == 0, "packIR.h is stale, rerun tools/packIR.py");
+#endif
+
+_Static_assert(IS_CFFT_LENGTH(FFTLength), "PartitionSize must be a power of two between 8 and 2048");
+_Static_assert(ImpulseSamples <= TableImpulseSamples, "Filter is longer than the HRIRs in tablIR.h");
+
+#ifdef UPOLS_FIXED
+#ifdef UPOLS_NONUNIFORM
+#error "UPOLS_FIXED only supports the uniform partitioning"
+#endif
+
+#include "mathq15.h"
+
+/**
+ * @brief arm_cfft_q31 counterpart of CFFT_F32()
+ *
+ */
+#define CFFT_Q31(length) \
+	((length) == 16 ? &arm_cfft_sR_q31_len16 : (length) == 32 ? &arm_cfft_sR_q31_len32 : (length) == 64 ? &arm_cfft_sR_q31_len64 : \
+	(length) == 128 ? &arm_cfft_sR_q31_len128 : (length) == 256 ? &arm_cfft_sR_q31_len256 : (length) == 512 ? &arm_cfft_sR_q31_len512 : \
+	(length) == 1024 ? &arm_cfft_sR_q31_len1024 : (length) == 2048 ? &arm_cfft_sR_q31_len2048 : (length) == 4096 ? &arm_cfft_sR_q31_len4096 : NULL)
+
+// Accumulators hold products of mantissas scaled by 2^(ACCUM_EXPONENT - input exponent - filter exponent).
+// Pairs whose exponents sum past ACCUM_EXPONENT land well below the output LSB and are skipped
+#define ACCUM_EXPONENT 22
+
+// arm_cfft_q31 scales both directions by 1 / FFTLength, the output is left at y / (2 * FFTLength)
+#define OUTPUT_SHIFT (15 - __builtin_ctz(FFTLength))
+#endif
+
+#if defined(UPOLS_FOUR_PATH) && (defined(UPOLS_FIXED) || defined(UPOLS_NONUNIFORM))
+#error "UPOLS_FOUR_PATH only supports the floating-point engine with the uniform partitioning"
+#endif
+
+// Filters per partition, one per ear or one per ear of each input channel
+#ifndef UPOLS_FOUR_PATH
+#define FILTER_PATHS 2
+#else
+#define FILTER_PATHS 4
+#endif
+
+// Every partition is zero-padded to twice its length, each filter's half-spectrum takes 2 * N floats
+#define FILTER_LENGTH (2 * FILTER_PATHS * ImpulseSamples)
+#define PARTITION_SPECTRA (2 * FILTER_PATHS * PartitionSize)
+
+// Partitions of the whole filter, head then tail tiers
+#ifndef UPOLS_NONUNIFORM
+#define FILTER_PARTITIONS PartitionCount
+#else
+#define FILTER_PARTITIONS (PartitionCount + Tier1PartitionCount + Tier2PartitionCount)
+#endif
+
+// Partitions in head partition units (0 to 255) that convolve() prepares after a block while interpolating
+#ifndef UPOLS_INTERPOLATION_BUDGET
+#define UPOLS_INTERPOLATION_BUDGET 8
+#endif
+
+// Whole HRIR pairs kept in PSRAM by the filter loading functions, the least recently used one is replaced first
+#ifndef UPOLS_FILTER_CACHE_SETS
+#define UPOLS_FILTER_CACHE_SETS 4
+#endif
+_Static_assert(UPOLS_FILTER_CACHE_SETS > 0, "UPOLS_FILTER_CACHE_SETS must be at least 1");
+
+// Blend of two neighbouring HRIR pairs a partition was prepared from
+typedef struct partition_origin_t
+{
+	uint16_t irSlot;	// irIndex + 1 of the lower neighbour, 0 if the partition was never prepared
+	uint16_t weight;	// Weight of the upper neighbour in 1 / 65536ths
+} partition_origin_t;
+
+// Filter impulse responses
+typedef struct filters_t
+{
+#ifndef UPOLS_FIXED
+	float32_t spectra[FILTER_LENGTH]; // Left then right half-spectra of each partition, then the crosstalk paths
+#else
+	int16_t spectra[FILTER_LENGTH];	  // Q15 mantissas of the left then right half-spectra of each partition
+	int8_t exponents[PartitionCount]; // Block exponent of each partition
+#endif
+	partition_origin_t origins[FILTER_PARTITIONS]; // What each partition currently holds
+	bool audible[FILTER_PARTITIONS];			   // Partitions above UPOLS_PARTITION_FLOOR_DB, the rest are skipped
+} filters_t;
+
+// Interpolation toward a fractional angle, carried out by convolve() a few partitions per block
+typedef struct interpolation_t
+{
+	volatile bool active;	// Only cleared by the filter loading functions or once the target is reached
+	bool progressive;		// Partitions go live one by one as they are prepared instead of as a whole set
+	partition_origin_t target;
+	uint16_t nextPartition;
+	uint16_t fadeFirst;		// Head partitions [fadeFirst, fadeLast) of the idle set fade in on the next block
+	uint16_t fadeLast;
+} interpolation_t;
+
+// Bookkeeping of the filter set cache, the sets themselves are in cachedFilters
+typedef struct filter_cache_t
+{
+	uint16_t irSlots[UPOLS_FILTER_CACHE_SETS];	// irIndex + 1 of each cached set, 0 if empty
+	uint32_t lastUsed[UPOLS_FILTER_CACHE_SETS]; // useCount when each set was last stored or hit
+	uint32_t useCount;
+	uint32_t hits;
+	uint32_t misses;
+	uint16_t interpolatedSlot; // irIndex + 1 of a missed set convolve() is preparing, cached once complete
+} filter_cache_t;
+
+#ifndef UPOLS_FIXED
+typedef struct upols_t
+{
+	int16_t currentIndex;					   // Current partition index
+	float32_t previousAudioData[2 * PartitionSize];		 // Previous block, left channel in the even indexes and right in the odd
+	float32_t slidingWindow[SpectraLength];				 // Time-domain sliding window
+	float32_t delayLine[SpectraLength * PartitionCount]; // Frequency-domain delay line of split stereo half-spectra
+} upols_t;
+#else
+typedef struct upols_t
+{
+	int16_t currentIndex;								 // Current partition index
+	int16_t previousAudioData[2 * PartitionSize];		 // Previous block, left channel in the even indexes and right in the odd
+	int32_t slidingWindow[SpectraLength];				 // Q31 time-domain sliding window, samples are halved for FFT headroom
+	int16_t delayLine[SpectraLength * PartitionCount]; // Q15 mantissas of the split stereo half-spectra
+	int8_t exponents[PartitionCount];					 // Block exponent of each FDL partition
+} upols_t;
+#endif
+
+#ifdef UPOLS_NONUNIFORM
+_Static_assert(PartitionSize * PartitionCount == 2 * Tier1PartitionSize, "Tier 1 must start two partitions in");
+_Static_assert(PartitionSize * PartitionCount + Tier1PartitionSize * Tier1PartitionCount == 2 * Tier2PartitionSize, "Tier 2 must start two partitions in");
+_Static_assert(IS_CFFT_LENGTH(2 * Tier1PartitionSize) && IS_CFFT_LENGTH(2 * Tier2PartitionSize), "Tier FFTs must exist in arm_const_structs.h");
+
+_section_dtcm_aligned static float32_t tier1DelayLine[4 * Tier1PartitionSize * Tier1PartitionCount];
+_section_dma static float32_t tier1Window[4 * Tier1PartitionSize];
+_section_dma static float32_t tier1Accum[4 * Tier1PartitionSize];
+_section_dma static float32_t tier1Spectrum[4 * Tier1PartitionSize];
+_section_dma static float32_t tier1Output[2 * Tier1PartitionSize];
+
+_section_dtcm_aligned static float32_t tier2DelayLine[4 * Tier2PartitionSize * Tier2PartitionCount];
+_section_dma static float32_t tier2Window[4 * Tier2PartitionSize];
+_section_dma static float32_t tier2Accum[4 * Tier2PartitionSize];
+_section_dma static float32_t tier2Spectrum[4 * Tier2PartitionSize];
+_section_dma static float32_t tier2Output[2 * Tier2PartitionSize];
+
+static tier_t tiers[] = {
+	{
+		.partitionSize = Tier1PartitionSize,
+		.partitionCount = Tier1PartitionCount,
+		.filterOffset = 8 * Tier1PartitionSize,
+		.firstPartition = PartitionCount,
+		.fft = CFFT_F32(2 * Tier1PartitionSize),
+		.slidingWindow = tier1Window,
+		.delayLine = tier1DelayLine,
+		.halfAccum = tier1Accum,
+		.spectrum = tier1Spectrum,
+		.output = tier1Output,
+	},
+	{
+		.partitionSize = Tier2PartitionSize,
+		.partitionCount = Tier2PartitionCount,
+		.filterOffset = 8 * Tier2PartitionSize,
+		.firstPartition = PartitionCount + Tier1PartitionCount,
+		.fft = CFFT_F32(2 * Tier2PartitionSize),
+		.slidingWindow = tier2Window,
+		.delayLine = tier2DelayLine,
+		.halfAccum = tier2Accum,
+		.spectrum = tier2Spectrum,
+		.output = tier2Output,
+	},
+};
+
+#define TIER_COUNT (sizeof(tiers) / sizeof(tiers[0]))
+#endif
+
+_section_dtcm_aligned filters_t filters;	// Filter set in DTCM
+_section_dma_aligned filters_t altFilters;	// Second filter set in OCRAM, there isn't enough DTCM for both
+
+_section_dtcm_aligned static upols_t instance; // Sliding window and FDL
+
+// Frequency-domain accumulators of _convolve(), kept off the stack so their placement is fixed
+#ifndef UPOLS_FIXED
+_section_dtcm_aligned static float32_t convolveAccum[SpectraLength];
+_section_dtcm_aligned static float32_t convolveSpectrum[SpectraLength];
+#else
+_section_dtcm_aligned static int64_t convolveAccum[SpectraLength];
+_section_dtcm_aligned static int32_t convolveSpectrum[SpectraLength];
+#endif
+#ifndef UPOLS_FIXED
+_section_dtcm_aligned static float32_t fadeAccum[SpectraLength]; // Incoming accumulator while partitions fade in
+#else
+_section_dtcm_aligned static int64_t fadeAccum[SpectraLength];
+#endif
+
+// The engine behind convolve() and the filter loading functions, an instance over the buffers above
+static upols_instance_t engine = {
+	.state = &instance,
+	.sets = {&filters, &altFilters},
+	.activeSet = &filters,
+	.pendingSet = NULL,
+	.halfAccum = convolveAccum,
+	.fadeAccum = fadeAccum,
+	.spectrum = convolveSpectrum,
+#ifdef UPOLS_NONUNIFORM
+	.tiers = tiers,
+#endif
+	.keptPartitions = FILTER_PARTITIONS,
+};
+static interpolation_t interpolation; // Only the default engine interpolates
+
+#ifdef UPOLS_REVERB
+/**
+ * @brief Whether an instance feeds the room reverb, there is only the one bus and it runs off the default engine's FDL
+ *
+ */
+static inline bool reverbBus(const upols_instance_t *upols)
+{
+	return upols == &engine;
+}
+#endif
+
+_section_extmem static filters_t cachedFilters[UPOLS_FILTER_CACHE_SETS]; // Only touched from the main loop
+static filter_cache_t filterCache;
+
+// The bank is laid out for the uniform floating-point partitioning, packed builds decode the HRIRs instead
+#if __has_include("./../../include/bankIR.h") && !defined(UPOLS_NONUNIFORM) && !defined(UPOLS_FIXED) && !defined(UPOLS_PACKED_IR)
+#include "./../../include/bankIR.h"
+_Static_assert(BANK_IR_PARTITION_SIZE == PartitionSize && BANK_IR_PARTITION_COUNT == PartitionCount, "bankIR.h is stale, rerun tools/bankIR.py");
+#endif
+
+#ifndef UPOLS_PACKED_IR
+/**
+ * @brief Number of HRIR pairs compiled into irTable
+ *
+ */
+#define TABLE_IR_COUNT (sizeof(irTable) / (2 * TableImpulseSamples * sizeof(float32_t)))
+
+/**
+ * @brief Read one tap of an HRIR pair out of irTable
+ *
+ */
+static inline float32_t tableTap(const uint16_t irIndex, const size_t channel, const size_t tap)
+{
+	return irTable[TableImpulseSamples * (2 * irIndex + channel) + tap];
+}
+#else
+#define TABLE_IR_COUNT PACK_IR_COUNT
+
+/**
+ * @brief Decode one tap of an HRIR pair out of packedIR. The scale of its block is 2^(exponent - 15), built
+ * straight from the float bits, tools/packIR.py keeps the exponent in the range where that's a normal float.
+ *
+ */
+static inline float32_t tableTap(const uint16_t irIndex, const size_t channel, const size_t tap)
+{
+	const size_t index = TableImpulseSamples * (2 * irIndex + channel) + tap;
+	const int8_t *exponents = (const int8_t *)&packedIR[2 * TableImpulseSamples * PACK_IR_COUNT];
+	const union
+	{
+		uint32_t bits;
+		float32_t value;
+	} scale = {.bits = (uint32_t)(exponents[index / PACK_IR_BLOCK_SIZE] - 15 + 127) << 23};
+	return packedIR[index] * scale.value;
+}
+#endif
+
+// HRIR pairs handed to loadHrirTable(), served in place of the compiled-in table while set
+static const float32_t *loadedTable;
+static uint16_t loadedCount;
+static uint32_t tableGeneration; // Bumped whenever the HRIRs behind an irIndex change
+
+/**
+ * @brief Read one tap of an HRIR pair out of whichever table is being served
+ *
+ */
+static inline float32_t hrirTap(const uint16_t irIndex, const size_t channel, const size_t tap)
+{
+	if (loadedTable)
+	{
+		return loadedTable[TableImpulseSamples * (2 * irIndex + channel) + tap];
+	}
+	return tableTap(irIndex, channel, tap);
+}
+
+/**
+ * @brief Number of HRIR pairs available, whichever format the table is stored in
+ *
+ */
+uint16_t hrirCount(void)
+{
+	return loadedTable ? loadedCount : TABLE_IR_COUNT;
+}
+
+/**
+ * @brief Changes whenever loadHrirTable() swaps the table, for anything keeping spectra by irIndex
+ *
+ */
+uint32_t hrirGeneration(void)
+{
+	return tableGeneration;
+}
+
+/**
+ * @brief Copy a run of taps of an HRIR pair out of the compiled-in table, decoding them if it's packed
+ *
+ * @param irIndex Index of the HRIR pair
+ * @param offset First tap to copy
+ * @param count Number of taps per channel
+ * @param leftTaps Output left channel taps
+ * @param rightTaps Output right channel taps
+ * @return Returns false if irIndex is out of range or the run is past the end of the HRIRs
+ */
+bool hrirTaps(const uint16_t irIndex, const size_t offset, const size_t count, float32_t *leftTaps, float32_t *rightTaps)
+{
+	if (irIndex >= hrirCount() || offset + count > TableImpulseSamples)
+	{
+		return false;
+	}
+
+	for (size_t i = 0; i < count; i++)
+	{
+		leftTaps[i] = hrirTap(irIndex, LeftFilter, offset + i);
+		rightTaps[i] = hrirTap(irIndex, RightFilter, offset + i);
+	}
+	return true;
+}
+
+/**
+ * @brief Compute the left and right half-spectra of a filter partition in place. Both real partitions are
+ * zero-padded on the left side and transformed together as hL + j hR, then separated using
+ * HL[k] = (Z[k] + Z*[-k]) / 2 and HR[k] = -j (Z[k] - Z*[-k]) / 2. The bins feeding each output come in
+ * groups of four (k, N - k, N + k, 2N - k) whose outputs land on exactly those positions, so no scratch is needed.
+ *
+ * @param leftTaps Pointer to the first left impulse response sample of the partition
+ * @param rightTaps Pointer to the first right impulse response sample of the partition
+ * @param partitionSize Number of samples in the partition, N
+ * @param fft FFT instance of length 2N
+ * @param subfilterSpectra Output buffer of 4N floats, left then right half-spectra
+ */
+void transformPartition(const float32_t *leftTaps, const float32_t *rightTaps, const size_t partitionSize, const arm_cfft_instance_f32 *fft, float32_t *subfilterSpectra)
+{
+	const size_t n = partitionSize;
+	float32_t *z = subfilterSpectra;
+
+	memset(z, 0, 4 * n * sizeof(float32_t));
+
+	for (size_t k = 0; k < n; k++)
+	{
+		z[2 * (n + k)] = leftTaps[k];
+		z[2 * (n + k) + 1] = rightTaps[k];
+	}
+
+	// Head partitions take the specialised kernel, the in-place separation below needs the bins back in natural order
+	if (fft == CFFT_F32(FFTLength))
+	{
+		fftForward(z);
+		fftReorder(z);
+	}
+	else
+	{
+		arm_cfft_f32(fft, z, ForwardFFT, 1);
+	}
+
+	// DC and Nyquist are real for both filters
+	const float32_t dcRe = z[0];
+	const float32_t dcIm = z[1];
+	const float32_t nyquistRe = z[2 * n];
+	const float32_t nyquistIm = z[2 * n + 1];
+	z[0] = dcRe;
+	z[1] = nyquistRe;
+	z[2 * n] = dcIm;
+	z[2 * n + 1] = nyquistIm;
+
+	for (size_t k = 1; k <= n / 2; k++)
+	{
+		const size_t bins[2][2] = {{k, 2 * n - k}, {n - k, n + k}}; // Bin and its mirror, for k and N - k
+
+		float32_t left[2][2];
+		float32_t right[2][2];
+		for (size_t i = 0; i < 2; i++)
+		{
+			const float32_t aRe = z[2 * bins[i][0]];
+			const float32_t aIm = z[2 * bins[i][0] + 1];
+			const float32_t bRe = z[2 * bins[i][1]];
+			const float32_t bIm = z[2 * bins[i][1] + 1];
+
+			left[i][0] = 0.5f * (aRe + bRe);
+			left[i][1] = 0.5f * (aIm - bIm);
+			right[i][0] = 0.5f * (aIm + bIm);
+			right[i][1] = 0.5f * (bRe - aRe);
+		}
+
+		// Left bin k sits at bin k, right bin k at bin N + k
+		z[2 * k] = left[0][0];
+		z[2 * k + 1] = left[0][1];
+		z[2 * (n + k)] = right[0][0];
+		z[2 * (n + k) + 1] = right[0][1];
+
+		if (k != n - k)
+		{
+			z[2 * (n - k)] = left[1][0];
+			z[2 * (n - k) + 1] = left[1][1];
+			z[2 * (2 * n - k)] = right[1][0];
+			z[2 * (2 * n - k) + 1] = right[1][1];
+		}
+	}
+}
+
+/**
+ * @brief Whether an HRIR pair can be loaded, from the bank when there is one
+ *
+ */
+static bool irAvailable(const uint16_t irIndex)
+{
+	if (loadedTable)
+	{
+		return irIndex < loadedCount;
+	}
+#ifdef BANK_IR_COUNT
+	return irIndex < BANK_IR_COUNT;
+#else
+	return irIndex < TABLE_IR_COUNT;
+#endif
+}
+
+// Taps of the partition being prepared, copied or decoded out of the table and blended in place, sized for
+// the largest partition
+#ifndef UPOLS_NONUNIFORM
+_section_dma static float32_t interpolatedTaps[2 * PartitionSize];
+#else
+_section_dma static float32_t interpolatedTaps[2 * Tier2PartitionSize];
+#endif
+
+/**
+ * @brief Whether either channel of a transformed partition carries enough energy to be worth its MAC. By
+ * Parseval the taps' energy is the half-spectrum's, with every bin but DC and Nyquist counted twice, over
+ * the transform length.
+ *
+ * @param spectra Left then right half-spectra of the partition
+ * @param partitionSize Number of taps per channel
+ */
+static bool partitionAudible(const float32_t *spectra, const size_t partitionSize)
+{
+	const float32_t floor = 2.0f * partitionSize * powf(10.0f, UPOLS_PARTITION_FLOOR_DB / 10.0f);
+	for (size_t channel = 0; channel < 2; channel++)
+	{
+		const float32_t *spectrum = &spectra[2 * partitionSize * channel];
+		float32_t energy = spectrum[0] * spectrum[0] + spectrum[1] * spectrum[1];
+		for (size_t k = 1; k < partitionSize; k++)
+		{
+			energy += 2.0f * (spectrum[2 * k] * spectrum[2 * k] + spectrum[2 * k + 1] * spectrum[2 * k + 1]);
+		}
+		if (energy > floor)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+#ifdef UPOLS_FOUR_PATH
+/**
+ * @brief Fill in the right speaker of a partition from the left speaker's HRTF pair. The right speaker is its
+ * mirror image, so with a symmetric head it reaches each ear the way the left speaker reaches the other one:
+ * the right input takes the left ear's filter to the right ear and the right ear's filter to the left ear.
+ *
+ * @param spectra Partition holding the left then right half-spectra of the pair, expanded in place
+ * @param partitionSize Number of taps per filter, N
+ */
+static void mirrorSpeaker(float32_t *spectra, const size_t partitionSize)
+{
+	const size_t length = 2 * partitionSize;
+	cpN(&spectra[length], &spectra[2 * length], length);	// Left-in to right-ear
+	cpN(&spectra[length], &spectra[3 * length], length);	// Right-in to left-ear
+	cpN(&spectra[0], &spectra[length], length);			// Right-in to right-ear
+}
+#endif
+
+/**
+ * @brief Prepare one filter partition from a blend of the HRIR pairs at origin.irSlot - 1 and the one after
+ * it. Transforms are linear, so blending the taps and then transforming gives exactly the blend of the two
+ * HRTFs. With a bank the flash spectra are blended directly instead.
+ *
+ * @param filterSet Set the partition is written to
+ * @param partition Index of the partition, head then tail tiers
+ * @param origin HRIR pairs and weight to prepare it from, both pairs must be available
+ * @return Cost in head partition units
+ */
+static size_t preparePartition(filters_t *filterSet, const size_t partition, const partition_origin_t origin)
+{
+	size_t tapOffset = PartitionSize * partition;
+	size_t partitionSize = PartitionSize;
+	const arm_cfft_instance_f32 *fft = CFFT_F32(FFTLength);
+
+#ifdef UPOLS_NONUNIFORM
+	// Tier partitions start at twice their size, so taps and spectra share the same offset arithmetic
+	size_t first = PartitionCount;
+	for (size_t t = 0; t < TIER_COUNT; t++)
+	{
+		const tier_t *tier = &tiers[t];
+		if (partition >= first && partition < first + tier->partitionCount)
+		{
+			tapOffset = tier->partitionSize * (2 + partition - first);
+			partitionSize = tier->partitionSize;
+			fft = tier->fft;
+		}
+		first += tier->partitionCount;
+	}
+#endif
+
+	const uint16_t lower = origin.irSlot - 1;
+	const uint16_t upper = (lower + 1) % AngleCount;
+	const float32_t weight = (float32_t)origin.weight / 65536.0f;
+
+#ifdef BANK_IR_COUNT
+	// The bank only holds the compiled-in table
+	if (!loadedTable)
+	{
+		float32_t *spectra = &filterSet->spectra[2 * FILTER_PATHS * tapOffset];
+		if (origin.weight == 0)
+		{
+			cpN(&bankIR[lower][4 * tapOffset], spectra, 4 * partitionSize);
+		}
+		else
+		{
+			const float32_t *lowerSpectra = &bankIR[lower][4 * tapOffset];
+			const float32_t *upperSpectra = &bankIR[upper][4 * tapOffset];
+			for (size_t i = 0; i < 4 * partitionSize; i++)
+			{
+				spectra[i] = lowerSpectra[i] + weight * (upperSpectra[i] - lowerSpectra[i]);
+			}
+		}
+		filterSet->audible[partition] = partitionAudible(spectra, partitionSize);
+#ifdef UPOLS_FOUR_PATH
+		mirrorSpeaker(spectra, partitionSize);
+#endif
+		filterSet->origins[partition] = origin;
+		return partitionSize / PartitionSize;
+	}
+#endif
+
+	float32_t *leftTaps = interpolatedTaps;
+	float32_t *rightTaps = interpolatedTaps + partitionSize;
+	hrirTaps(lower, tapOffset, partitionSize, leftTaps, rightTaps);
+	if (origin.weight)
+	{
+		for (size_t i = 0; i < partitionSize; i++)
+		{
+			leftTaps[i] += weight * (hrirTap(upper, LeftFilter, tapOffset + i) - leftTaps[i]);
+			rightTaps[i] += weight * (hrirTap(upper, RightFilter, tapOffset + i) - rightTaps[i]);
+		}
+	}
+
+#ifndef UPOLS_FIXED
+	float32_t *spectra = &filterSet->spectra[2 * FILTER_PATHS * tapOffset];
+	transformPartition(leftTaps, rightTaps, partitionSize, fft, spectra);
+	filterSet->audible[partition] = partitionAudible(spectra, partitionSize);
+#ifdef UPOLS_FOUR_PATH
+	mirrorSpeaker(spectra, partitionSize);
+#endif
+#else
+	// Transformed in floating-point, then quantized with an exponent of its own
+	float32_t subfilterSpectra[SpectraLength];
+	transformPartition(leftTaps, rightTaps, partitionSize, fft, subfilterSpectra);
+	filterSet->exponents[partition] = quantizeSpectraQ15(subfilterSpectra, &filterSet->spectra[4 * tapOffset], SpectraLength);
+	filterSet->audible[partition] = partitionAudible(subfilterSpectra, partitionSize);
+#endif
+
+	filterSet->origins[partition] = origin;
+	return partitionSize / PartitionSize;
+}
+
+/**
+ * @brief Whether a partition already holds exactly the blend asked for
+ *
+ */
+static bool partitionCurrent(const filters_t *filterSet, const size_t partition, const partition_origin_t origin)
+{
+	return filterSet->origins[partition].irSlot == origin.irSlot && filterSet->origins[partition].weight == origin.weight;
+}
+
+/**
+ * @brief Whether every partition of a set already holds exactly the blend asked for
+ *
+ */
+static bool setCurrent(const filters_t *filterSet, const partition_origin_t origin)
+{
+	for (size_t j = 0; j < FILTER_PARTITIONS; j++)
+	{
+		if (!partitionCurrent(filterSet, j, origin))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief Set of an instance that isn't being convolved with, free for the main loop to prepare. Both set
+ * pointers are volatile, so this read can't be hoisted above the caller's store to pendingSet and sees
+ * the active set as upolsProcess() left it when it retired the outgoing one.
+ *
+ */
+static filters_t *idleSet(const upols_instance_t *upols)
+{
+	return (upols->activeSet == upols->sets[0]) ? upols->sets[1] : upols->sets[0];
+}
+
+/**
+ * @brief Prepare every partition of a set that doesn't already hold origin
+ *
+ */
+static void prepareSet(filters_t *filterSet, const partition_origin_t origin)
+{
+	for (size_t j = 0; j < FILTER_PARTITIONS; j++)
+	{
+		if (!partitionCurrent(filterSet, j, origin))
+		{
+			preparePartition(filterSet, j, origin);
+		}
+	}
+}
+
+/**
+ * @brief Number of cached sets backed by populated PSRAM, EXTMEM hangs the bus when nothing is soldered there
+ *
+ */
+static size_t filterCacheCapacity(void)
+{
+#ifdef ARDUINO
+	const uintptr_t psramEnd = 0x70000000 + (uintptr_t)external_psram_size * 1024 * 1024;
+	size_t capacity = 0;
+	while (capacity < UPOLS_FILTER_CACHE_SETS && (uintptr_t)&cachedFilters[capacity + 1] <= psramEnd)
+	{
+		capacity++;
+	}
+	return capacity;
+#else
+	return UPOLS_FILTER_CACHE_SETS;
+#endif
+}
+
+/**
+ * @brief Find the cached set for irIndex and mark it most recently used
+ *
+ * @return Pointer to the set, or NULL on a miss
+ */
+static const filters_t *filterCacheLookup(const uint16_t irIndex)
+{
+	const size_t capacity = filterCacheCapacity();
+	for (size_t i = 0; i < capacity; i++)
+	{
+		if (filterCache.irSlots[i] == irIndex + 1)
+		{
+			filterCache.lastUsed[i] = ++filterCache.useCount;
+			filterCache.hits++;
+			return &cachedFilters[i];
+		}
+	}
+	filterCache.misses++;
+	return NULL;
+}
+
+/**
+ * @brief Copy a freshly prepared set into an empty slot, or over the least recently used one
+ *
+ */
+static void filterCacheStore(const uint16_t irIndex, const filters_t *filterSet)
+{
+	const size_t capacity = filterCacheCapacity();
+	if (capacity == 0)
+	{
+		return;
+	}
+
+	size_t victim = 0;
+	for (size_t i = 0; i < capacity; i++)
+	{
+		if (filterCache.irSlots[i] == 0)
+		{
+			victim = i;
+			break;
+		}
+		if (filterCache.lastUsed[i] < filterCache.lastUsed[victim])
+		{
+			victim = i;
+		}
+	}
+
+	memcpy(&cachedFilters[victim], filterSet, sizeof(filters_t));
+	filterCache.irSlots[victim] = (uint16_t)(irIndex + 1);
+	filterCache.lastUsed[victim] = ++filterCache.useCount;
+}
+
+/**
+ * @brief Cache the set the last interpolation missed on, if convolve() got to finish preparing it. A whole set
+ * is too much to copy from the interrupt, so it's done here on the next filter change. Only called once
+ * interpolation has been stopped, nothing writes either set until the next one starts.
+ *
+ */
+static void filterCacheInterpolated(void)
+{
+	const partition_origin_t origin = {.irSlot = filterCache.interpolatedSlot, .weight = 0};
+	filterCache.interpolatedSlot = 0;
+	if (origin.irSlot == 0)
+	{
+		return;
+	}
+
+	for (size_t i = 0; i < 2; i++)
+	{
+		if (setCurrent(engine.sets[i], origin))
+		{
+			filterCacheStore(origin.irSlot - 1, engine.sets[i]);
+			return;
+		}
+	}
+}
+
+/**
+ * @brief Load the partitioned HRTF pair for irIndex into the idle filter set and queue it to be crossfaded in
+ * by the next call to convolve(). Spectra are copied straight out of the precomputed flash bank when
+ * tools/bankIR.py has generated one, otherwise every partition is transformed from the HRIR table on the spot.
+ * Partitions the idle set already holds are skipped. Audio keeps running with the current set throughout.
+ *
+ * @param irIndex Index of the HRIR pair, one per 3.6 degrees of azimuth
+ * @return Returns false if irIndex does not have a compiled-in HRIR
+ */
+_section_flash
+bool processFilters(const uint16_t irIndex)
+{
+	if (!irAvailable(irIndex))
+	{
+		return false;
+	}
+
+	// Stop any interpolation and withdraw a set that hasn't been picked up yet so it can be overwritten.
+	// convolve() runs from an interrupt and is never interrupted by this, so once these stores land
+	// the active set can no longer change and convolve() leaves the idle set alone
+	interpolation.active = false;
+	engine.pendingSet = NULL;
+	filterCacheInterpolated();
+	filters_t *idleFilters = idleSet(&engine);
+
+	const partition_origin_t origin = {.irSlot = (uint16_t)(irIndex + 1), .weight = 0};
+	const filters_t *cachedSet = filterCacheLookup(irIndex);
+	if (cachedSet)
+	{
+		if (!setCurrent(idleFilters, origin))
+		{
+			memcpy(idleFilters, cachedSet, sizeof(filters_t));
+		}
+	}
+	else
+	{
+		prepareSet(idleFilters, origin);
+		filterCacheStore(irIndex, idleFilters);
+	}
+
+	engine.pendingSet = idleFilters;
+	return true;
+}
+
+/**
+ * @brief Serve HRIR pairs from a table in memory in place of the compiled-in one, such as HRIRs measured for
+ * the listener. Cached sets are dropped and every partition of the default engine's sets is marked stale, so
+ * the next filter load transforms the new HRIRs. The current filters keep playing until then. Instances from
+ * upolsInit() hold on to their partitions, set them up again to move them over.
+ *
+ * @param table HRIR pairs laid out like irTable, TableImpulseSamples left taps then as many right taps per
+ * pair. Read whenever a filter is prepared so it has to outlive its use, NULL goes back to the compiled-in table
+ * @param count Number of HRIR pairs in table
+ * @return Returns false if count is zero or more than AngleCount, leaving the current table in place
+ */
+_section_flash
+bool loadHrirTable(const float32_t *table, const uint16_t count)
+{
+	if (table && (count == 0 || count > AngleCount))
+	{
+		return false;
+	}
+
+	// Nothing is prepared behind convolve()'s back once these stores land, as in processFilters()
+	interpolation.active = false;
+	engine.pendingSet = NULL;
+	for (size_t i = 0; i < 2; i++)
+	{
+		for (size_t j = 0; j < FILTER_PARTITIONS; j++)
+		{
+			engine.sets[i]->origins[j].irSlot = 0;
+		}
+	}
+	memset(filterCache.irSlots, 0, sizeof(filterCache.irSlots));
+	filterCache.interpolatedSlot = 0;
+
+	loadedTable = table;
+	loadedCount = table ? count : 0;
+	tableGeneration++;
+	return true;
+}
+
+/**
+ * @brief Filter set cache counters, for the status command
+ *
+ */
+void filterCacheStats(filter_cache_stats_t *stats)
+{
+	const size_t capacity = filterCacheCapacity();
+	stats->hits = filterCache.hits;
+	stats->misses = filterCache.misses;
+	stats->capacity = (uint16_t)capacity;
+	stats->sets = 0;
+	for (size_t i = 0; i < capacity; i++)
+	{
+		stats->sets += (filterCache.irSlots[i] != 0);
+	}
+}
+
+/**
+ * @brief Number of partitions of the running filter that make it into the MAC
+ *
+ * @param partitionCount Total number of partitions, head and tail tiers
+ * @return Partitions above UPOLS_PARTITION_FLOOR_DB
+ */
+size_t audiblePartitions(size_t *partitionCount)
+{
+	size_t count = 0;
+	for (size_t j = 0; j < FILTER_PARTITIONS; j++)
+	{
+		count += engine.activeSet->audible[j];
+	}
+	*partitionCount = FILTER_PARTITIONS;
+	return count;
+}
+
+/**
+ * @brief Queue a filter set transformed elsewhere, such as an HRTF dataset streamed from SD, to be crossfaded
+ * in by the next call to convolve()
+ *
+ * @param spectra 4 * ImpulseSamples floats, laid out like the precomputed bank: the left then right
+ * half-spectrum of each partition. Four-path builds place the left speaker with them and mirror the right one
+ * @return Returns false if the engine's filters aren't laid out that way, the non-uniform tiers aren't
+ */
+_section_flash
+bool loadFilterSpectra(const float32_t *spectra)
+{
+#ifdef UPOLS_NONUNIFORM
+	(void)spectra;
+	return false;
+#else
+	interpolation.active = false;
+	return upolsSetSpectra(&engine, spectra);
+#endif
+}
+
+#ifndef UPOLS_NONUNIFORM
+/**
+ * @brief Copy spectra laid out like the precomputed bank into a filter set
+ *
+ */
+static void copySpectra(filters_t *idleFilters, const float32_t *spectra)
+{
+	for (size_t j = 0; j < PartitionCount; j++)
+	{
+#ifndef UPOLS_FIXED
+		cpN(&spectra[SpectraLength * j], &idleFilters->spectra[PARTITION_SPECTRA * j], SpectraLength);
+#ifdef UPOLS_FOUR_PATH
+		mirrorSpeaker(&idleFilters->spectra[PARTITION_SPECTRA * j], PartitionSize);
+#endif
+#else
+		idleFilters->exponents[j] = quantizeSpectraQ15(&spectra[SpectraLength * j], &idleFilters->spectra[SpectraLength * j], SpectraLength);
+#endif
+		// Not from irTable, so never mistaken for one of its HRIR pairs
+		idleFilters->origins[j].irSlot = 0;
+		idleFilters->audible[j] = partitionAudible(&spectra[SpectraLength * j], PartitionSize);
+	}
+}
+#endif
+
+/**
+ * @brief loadFilterSpectra() with all four paths given, such as the responses of a measured pair of speakers
+ *
+ * @param spectra 8 * ImpulseSamples floats: for each partition the half-spectra of left-in to left-ear,
+ * right-in to right-ear, left-in to right-ear and right-in to left-ear, each laid out like the bank's
+ * @return Returns false unless the engine was built with UPOLS_FOUR_PATH
+ */
+_section_flash
+bool loadFourPathSpectra(const float32_t *spectra)
+{
+#ifndef UPOLS_FOUR_PATH
+	(void)spectra;
+	return false;
+#else
+	interpolation.active = false;
+	engine.pendingSet = NULL;
+	filters_t *idleFilters = idleSet(&engine);
+
+	for (size_t j = 0; j < PartitionCount; j++)
+	{
+		const float32_t *partitionSpectra = &spectra[PARTITION_SPECTRA * j];
+		cpN(partitionSpectra, &idleFilters->spectra[PARTITION_SPECTRA * j], PARTITION_SPECTRA);
+		idleFilters->origins[j].irSlot = 0;
+		idleFilters->audible[j] = partitionAudible(partitionSpectra, PartitionSize) || partitionAudible(&partitionSpectra[SpectraLength], PartitionSize);
+	}
+
+	engine.pendingSet = idleFilters;
+	return true;
+#endif
+}
+
+/**
+ * @brief Reserve the next buffer of an arena
+ *
+ * @param offset Bytes of the arena taken so far, advanced past the buffer and rounded up to UPOLS_ARENA_ALIGNMENT
+ * @param size Bytes of the buffer
+ * @return Offset of the buffer from the start of the arena
+ */
+static size_t arenaCarve(size_t *offset, const size_t size)
+{
+	const size_t start = *offset;
+	*offset = (start + size + UPOLS_ARENA_ALIGNMENT - 1) & ~(size_t)(UPOLS_ARENA_ALIGNMENT - 1);
+	return start;
+}
+
+#ifdef UPOLS_NONUNIFORM
+/**
+ * @brief Floats of a tier's FDL, window, accumulator, spectrum scratch and output, in that order
+ *
+ */
+static size_t tierFloats(const tier_t *tier)
+{
+	return 4 * tier->partitionSize * tier->partitionCount + 3 * 4 * tier->partitionSize + 2 * tier->partitionSize;
+}
+
+/**
+ * @brief Point a tier at its buffers, one block of tierFloats() floats
+ *
+ */
+static void placeTier(tier_t *tier, float32_t *buffers)
+{
+	const size_t spectraLength = 4 * tier->partitionSize;
+	tier->delayLine = buffers;
+	tier->slidingWindow = &buffers[spectraLength * tier->partitionCount];
+	tier->halfAccum = tier->slidingWindow + spectraLength;
+	tier->spectrum = tier->halfAccum + spectraLength;
+	tier->output = tier->spectrum + spectraLength;
+}
+#endif
+
+/**
+ * @brief Lay the buffers of an instance out in an arena
+ *
+ * @param upols Instance to point at the buffers, NULL to only measure the layout
+ * @param arena Start of the arena
+ * @return Bytes the layout takes
+ */
+static size_t layoutArena(upols_instance_t *upols, uint8_t *arena)
+{
+	size_t offset = 0;
+	const size_t state = arenaCarve(&offset, sizeof(upols_t));
+	const size_t sets[2] = {arenaCarve(&offset, sizeof(filters_t)), arenaCarve(&offset, sizeof(filters_t))};
+	const size_t halfAccum = arenaCarve(&offset, SpectraLength * sizeof(upols_accum_t));
+	const size_t incomingAccum = arenaCarve(&offset, SpectraLength * sizeof(upols_accum_t));
+	const size_t spectrum = arenaCarve(&offset, SpectraLength * sizeof(upols_spectrum_t));
+#ifdef UPOLS_NONUNIFORM
+	const size_t tierStates = arenaCarve(&offset, sizeof(tiers));
+	size_t tierBuffers[TIER_COUNT];
+	for (size_t t = 0; t < TIER_COUNT; t++)
+	{
+		tierBuffers[t] = arenaCarve(&offset, tierFloats(&tiers[t]) * sizeof(float32_t));
+	}
+#endif
+
+	if (upols)
+	{
+		upols->state = (upols_t *)&arena[state];
+		upols->sets[0] = (filters_t *)&arena[sets[0]];
+		upols->sets[1] = (filters_t *)&arena[sets[1]];
+		upols->halfAccum = (upols_accum_t *)&arena[halfAccum];
+		upols->fadeAccum = (upols_accum_t *)&arena[incomingAccum];
+		upols->spectrum = (upols_spectrum_t *)&arena[spectrum];
+		upols->tiers = NULL;
+#ifdef UPOLS_NONUNIFORM
+		// The geometry comes from the default engine's tiers, the running state and buffers are the instance's own
+		upols->tiers = (tier_t *)&arena[tierStates];
+		memcpy(upols->tiers, tiers, sizeof(tiers));
+		for (size_t t = 0; t < TIER_COUNT; t++)
+		{
+			placeTier(&upols->tiers[t], (float32_t *)&arena[tierBuffers[t]]);
+		}
+#endif
+	}
+	return offset;
+}
+
+/**
+ * @brief Bytes of arena upolsInit() needs for one instance
+ *
+ */
+size_t upolsArenaSize(void)
+{
+	return layoutArena(NULL, NULL);
+}
+
+/**
+ * @brief Set up an instance of the re-entrant API over a caller-supplied arena. The instance starts out silent
+ * until a filter is set, and owns the arena until it's no longer used
+ *
+ * @param upols Instance to set up
+ * @param arena Memory for every buffer of the instance, aligned to UPOLS_ARENA_ALIGNMENT
+ * @param arenaSize Bytes of arena, at least upolsArenaSize()
+ * @return Returns false if the arena is misaligned or too small
+ */
+_section_flash
+bool upolsInit(upols_instance_t *upols, void *arena, const size_t arenaSize)
+{
+	if (!arena || (uintptr_t)arena % UPOLS_ARENA_ALIGNMENT || arenaSize < upolsArenaSize())
+	{
+		return false;
+	}
+
+	memset(arena, 0, upolsArenaSize());
+	layoutArena(upols, (uint8_t *)arena);
+	upols->activeSet = upols->sets[0];
+	upols->pendingSet = NULL;
+	upols->keptPartitions = FILTER_PARTITIONS;
+	upolsReset(upols);
+	return true;
+}
+
+/**
+ * @brief Clear the input history of an instance, the filters are kept. Not while upolsProcess() might be
+ * running on it
+ *
+ */
+_section_flash
+void upolsReset(upols_instance_t *upols)
+{
+	memset(upols->state, 0, sizeof(upols_t));
+	memset(upols->halfAccum, 0, SpectraLength * sizeof(upols_accum_t));
+	memset(upols->fadeAccum, 0, SpectraLength * sizeof(upols_accum_t));
+#ifdef UPOLS_NONUNIFORM
+	for (size_t t = 0; t < TIER_COUNT; t++)
+	{
+		tier_t *tier = &upols->tiers[t];
+		memset(tier->delayLine, 0, tierFloats(tier) * sizeof(float32_t));
+		tier->step = 0;
+		tier->currentIndex = 0;
+	}
+#endif
+}
+
+/**
+ * @brief Instance counterpart of processFilters(), without the filter set cache. Called from the main loop like
+ * the other filter loading functions, they share the scratch partitions are prepared in
+ *
+ * @param upols Instance set up by upolsInit()
+ * @param irIndex Index of the HRIR pair, one per 3.6 degrees of azimuth
+ * @return Returns false if irIndex does not have a compiled-in HRIR
+ */
+_section_flash
+bool upolsSetFilter(upols_instance_t *upols, const uint16_t irIndex)
+{
+	if (!irAvailable(irIndex))
+	{
+		return false;
+	}
+
+	upols->pendingSet = NULL;
+	filters_t *idleFilters = idleSet(upols);
+	prepareSet(idleFilters, (partition_origin_t){.irSlot = (uint16_t)(irIndex + 1), .weight = 0});
+	upols->pendingSet = idleFilters;
+	return true;
+}
+
+/**
+ * @brief Instance counterpart of loadFilterSpectra()
+ *
+ * @param upols Instance set up by upolsInit()
+ * @param spectra 4 * ImpulseSamples floats, laid out like the precomputed bank
+ * @return Returns false if the engine's filters aren't laid out that way, the non-uniform tiers aren't
+ */
+_section_flash
+bool upolsSetSpectra(upols_instance_t *upols, const float32_t *spectra)
+{
+#ifdef UPOLS_NONUNIFORM
+	(void)upols;
+	(void)spectra;
+	return false;
+#else
+	upols->pendingSet = NULL;
+	filters_t *idleFilters = idleSet(upols);
+	copySpectra(idleFilters, spectra);
+	upols->pendingSet = idleFilters;
+	return true;
+#endif
+}
+
+/**
+ * @brief Point convolve() at a new target, shared by interpolateFilters() and updateFilters(). Targets on an
+ * HRIR pair of their own go through the filter set cache like processFilters(): a hit is copied into the idle
+ * set and, unless partitions go live one by one, queued straight away. A miss is cached once it's prepared.
+ *
+ */
+static bool startInterpolation(const uint16_t irIndex, const float32_t fraction, const bool progressive)
+{
+	uint32_t weight = (uint32_t)lrintf(fraction * 65536.0f);
+	uint16_t lower = irIndex;
+	if (weight >= 65536) // Rounded onto the upper neighbour
+	{
+		lower = (irIndex + 1) % AngleCount;
+		weight = 0;
+	}
+
+	// With only one neighbour compiled in, snap to it as the nearest pair there is
+	const uint16_t upper = (lower + 1) % AngleCount;
+	if (weight && !irAvailable(upper))
+	{
+		weight = 0;
+	}
+	else if (weight && !irAvailable(lower))
+	{
+		lower = upper;
+		weight = 0;
+	}
+
+	if (!irAvailable(lower))
+	{
+		return false;
+	}
+
+	interpolation.active = false;
+	engine.pendingSet = NULL;
+	filterCacheInterpolated();
+
+	const partition_origin_t target = {.irSlot = (uint16_t)(lower + 1), .weight = (uint16_t)weight};
+	if (!setCurrent(engine.activeSet, target))
+	{
+		const filters_t *cachedSet = weight ? NULL : filterCacheLookup(lower);
+		if (cachedSet)
+		{
+			// The progressive fade finds every head partition already prepared in the idle set
+			filters_t *idleFilters = idleSet(&engine);
+			if (!setCurrent(idleFilters, target))
+			{
+				memcpy(idleFilters, cachedSet, sizeof(filters_t));
+			}
+			if (!progressive)
+			{
+				engine.pendingSet = idleFilters;
+				return true;
+			}
+		}
+		else if (!weight)
+		{
+			filterCache.interpolatedSlot = target.irSlot;
+		}
+
+		interpolation.target = target;
+		interpolation.progressive = progressive;
+		interpolation.nextPartition = 0;
+		interpolation.fadeFirst = 0;
+		interpolation.fadeLast = 0;
+		interpolation.active = true;
+	}
+	return true;
+}
+
+/**
+ * @brief Move toward a fractional angle without blocking. The target is the frequency-domain blend
+ * (1 - fraction) H[irIndex] + fraction H[irIndex + 1] of the two neighbouring HRTFs. convolve() prepares it
+ * in the idle filter set UPOLS_INTERPOLATION_BUDGET partitions per block, skipping partitions that already
+ * hold it, then crossfades it in. A new call restarts the interpolation toward the new target. If only one
+ * neighbour has a compiled-in HRIR, the target is that pair on its own.
+ *
+ * @param irIndex Index of the lower neighbouring HRIR pair
+ * @param fraction Position between irIndex and the next pair, in [0, 1)
+ * @return Returns false if neither neighbour has a compiled-in HRIR
+ */
+_section_flash
+bool interpolateFilters(const uint16_t irIndex, const float32_t fraction)
+{
+	return startInterpolation(irIndex, fraction, false);
+}
+
+/**
+ * @brief Lazy counterpart of interpolateFilters(). Partitions go live as soon as convolve() has prepared
+ * them, head first, each one faded in over a single block. The direct sound follows within a block and
+ * the tail catches up over the next few, with no set crossfade and no block doing more than its budget.
+ *
+ * @param irIndex Index of the lower neighbouring HRIR pair
+ * @param fraction Position between irIndex and the next pair, in [0, 1), 0 for a plain switch to irIndex
+ * @return Returns false if neither neighbour has a compiled-in HRIR
+ */
+_section_flash
+bool updateFilters(const uint16_t irIndex, const float32_t fraction)
+{
+	return startInterpolation(irIndex, fraction, true);
+}
+
+/**
+ * @brief Whether the last filter change has gone fully live. Until then a new target restarts the preparation,
+ * so callers with a stream of targets can hold on to the newest one instead.
+ *
+ * @return Returns true if nothing is being prepared, crossfaded, or faded in
+ */
+bool filtersSettled(void)
+{
+	return !interpolation.active && engine.pendingSet == NULL;
+}
+
+/**
+ * @brief Copy a head partition between sets
+ *
+ */
+static void copyPartition(filters_t *dst, const filters_t *src, const size_t partition)
+{
+	memcpy(&dst->spectra[PARTITION_SPECTRA * partition], &src->spectra[PARTITION_SPECTRA * partition], PARTITION_SPECTRA * sizeof(dst->spectra[0]));
+#ifdef UPOLS_FIXED
+	dst->exponents[partition] = src->exponents[partition];
+#endif
+	dst->origins[partition] = src->origins[partition];
+	dst->audible[partition] = src->audible[partition];
+}
+
+/**
+ * @brief Whether convolve() has head partitions to fade in on this block, other instances never interpolate
+ *
+ */
+static bool partitionsFading(const upols_instance_t *upols)
+{
+	return upols == &engine && interpolation.active && interpolation.progressive && interpolation.fadeLast > interpolation.fadeFirst;
+}
+
+/**
+ * @brief Progressive step of advanceInterpolation(). Partitions that faded in on this block are copied
+ * into the active set, then the next head partitions are prepared in the idle set to fade in on the next
+ * block. Tail tier partitions are written straight into the active set, their output is spread across
+ * several blocks so there is no one block to fade them on.
+ *
+ */
+static void advanceProgressive(filters_t *idleFilters)
+{
+	for (size_t j = interpolation.fadeFirst; j < interpolation.fadeLast; j++)
+	{
+		copyPartition(engine.activeSet, idleFilters, j);
+	}
+	interpolation.fadeFirst = interpolation.nextPartition;
+	interpolation.fadeLast = interpolation.nextPartition;
+
+	size_t budget = UPOLS_INTERPOLATION_BUDGET;
+	while (budget && interpolation.nextPartition < FILTER_PARTITIONS)
+	{
+		const size_t partition = interpolation.nextPartition;
+		size_t cost = 0;
+		if (partitionCurrent(engine.activeSet, partition, interpolation.target))
+		{
+			if (interpolation.fadeLast == interpolation.fadeFirst)
+			{
+				interpolation.fadeFirst = (uint16_t)(partition + 1);
+				interpolation.fadeLast = (uint16_t)(partition + 1);
+			}
+		}
+		else if (partition < PartitionCount)
+		{
+			// The fading partitions have to stay contiguous, the rest waits for the next block
+			if (interpolation.fadeLast != partition)
+			{
+				break;
+			}
+			if (!partitionCurrent(idleFilters, partition, interpolation.target))
+			{
+				cost = preparePartition(idleFilters, partition, interpolation.target);
+			}
+			interpolation.fadeLast = (uint16_t)(partition + 1);
+		}
+		else
+		{
+			cost = preparePartition(engine.activeSet, partition, interpolation.target);
+		}
+
+		interpolation.nextPartition++;
+		budget = (cost < budget) ? budget - cost : 0;
+	}
+
+	if (interpolation.nextPartition == FILTER_PARTITIONS && interpolation.fadeLast == interpolation.fadeFirst)
+	{
+		interpolation.active = false;
+	}
+}
+
+/**
+ * @brief Prepare the next few partitions of an interpolation, called by convolve() once the block is done.
+ * The idle set is queued once every partition holds the target.
+ *
+ */
+static void advanceInterpolation(void)
+{
+	if (!interpolation.active)
+	{
+		return;
+	}
+
+	const uint32_t stageStart = perfStart();
+	filters_t *idleFilters = idleSet(&engine);
+
+	if (interpolation.progressive)
+	{
+		advanceProgressive(idleFilters);
+		perfStop(PerfInterpolate, stageStart);
+		return;
+	}
+
+	size_t budget = UPOLS_INTERPOLATION_BUDGET;
+	while (budget && interpolation.nextPartition < FILTER_PARTITIONS)
+	{
+		const size_t partition = interpolation.nextPartition++;
+		if (!partitionCurrent(idleFilters, partition, interpolation.target))
+		{
+			const size_t cost = preparePartition(idleFilters, partition, interpolation.target);
+			budget = (cost < budget) ? budget - cost : 0;
+		}
+	}
+
+	if (interpolation.nextPartition == FILTER_PARTITIONS)
+	{
+		interpolation.active = false;
+		engine.pendingSet = idleFilters;
+	}
+	perfStop(PerfInterpolate, stageStart);
+}
+
+/**
+ * @brief Split the spectrum of a packed stereo block x = l + j r into the half-spectra of each channel,
+ * U[k] = (X[k] + X*[-k]) / 2 = L[k] and V[k] = (X[k] - X*[-k]) / 2 = j R[k], for bins [0, N]
+ *
+ * @param spectrum Full spectrum of 2N interleaved complex values
+ * @param halfSpectra Output buffer of 4N floats in the layout expected by hmac()
+ * @param bins Number of unique bins, N
+ */
+_section_itcm
+void splitStereo(const float32_t *spectrum, float32_t *halfSpectra, const size_t bins)
+{
+	// U is real and V is imaginary at DC and Nyquist
+	halfSpectra[0] = spectrum[0];
+	halfSpectra[1] = spectrum[2 * bins];
+	halfSpectra[2] = spectrum[1];
+	halfSpectra[3] = spectrum[2 * bins + 1];
+
+	for (size_t k = 1; k < bins; k++)
+	{
+		const float32_t aRe = spectrum[2 * k];
+		const float32_t aIm = spectrum[2 * k + 1];
+		const float32_t bRe = spectrum[2 * (2 * bins - k)];
+		const float32_t bIm = spectrum[2 * (2 * bins - k) + 1];
+
+		halfSpectra[4 * k] = 0.5f * (aRe + bRe);
+		halfSpectra[4 * k + 1] = 0.5f * (aIm - bIm);
+		halfSpectra[4 * k + 2] = 0.5f * (aRe - bRe);
+		halfSpectra[4 * k + 3] = 0.5f * (aIm + bIm);
+	}
+}
+
+/**
+ * @brief Rebuild the full spectrum of the packed stereo output from the accumulated half-spectra. With
+ * P = sum(L H_L) and M = sum(j R H_R), the output yL + j yR has the spectrum Q[k] = P[k] + M[k] and
+ * Q[-k] = (P[k] - M[k])*, so one inverse FFT yields the left channel in its real part and the right in its imaginary.
+ *
+ * @param halfAccum Accumulated half-spectra, 4N floats
+ * @param spectrum Output buffer of 2N interleaved complex values
+ * @param bins Number of unique bins, N
+ */
+_section_itcm
+void mergeStereo(const float32_t *halfAccum, float32_t *spectrum, const size_t bins)
+{
+	spectrum[0] = halfAccum[0];
+	spectrum[1] = halfAccum[2];
+	spectrum[2 * bins] = halfAccum[1];
+	spectrum[2 * bins + 1] = halfAccum[3];
+
+	for (size_t k = 1; k < bins; k++)
+	{
+		const float32_t pRe = halfAccum[4 * k];
+		const float32_t pIm = halfAccum[4 * k + 1];
+		const float32_t mRe = halfAccum[4 * k + 2];
+		const float32_t mIm = halfAccum[4 * k + 3];
+
+		spectrum[2 * k] = pRe + mRe;
+		spectrum[2 * k + 1] = pIm + mIm;
+		spectrum[2 * (2 * bins - k)] = pRe - mRe;
+		spectrum[2 * (2 * bins - k) + 1] = mIm - pIm;
+	}
+}
+
+/**
+ * @brief splitStereo() of a head partition spectrum left in bit-reversed order by fftForward(), the FDL half-spectra
+ * come out in natural order
+ *
+ * @param spectrum Full spectrum of FFTLength interleaved complex values, bit-reversed
+ * @param halfSpectra Output buffer of SpectraLength floats in the layout expected by hmac()
+ */
+_section_itcm
+void splitStereoReversed(const float32_t *spectrum, float32_t *halfSpectra)
+{
+	// Nyquist lands next to DC
+	halfSpectra[0] = spectrum[0];
+	halfSpectra[1] = spectrum[2];
+	halfSpectra[2] = spectrum[1];
+	halfSpectra[3] = spectrum[3];
+
+	for (size_t k = 1; k < PartitionSize; k++)
+	{
+		const size_t a = 2 * fftBin(k);
+		const size_t b = 2 * fftBin(FFTLength - k);
+		const float32_t aRe = spectrum[a];
+		const float32_t aIm = spectrum[a + 1];
+		const float32_t bRe = spectrum[b];
+		const float32_t bIm = spectrum[b + 1];
+
+		halfSpectra[4 * k] = 0.5f * (aRe + bRe);
+		halfSpectra[4 * k + 1] = 0.5f * (aIm - bIm);
+		halfSpectra[4 * k + 2] = 0.5f * (aRe - bRe);
+		halfSpectra[4 * k + 3] = 0.5f * (aIm + bIm);
+	}
+}
+
+/**
+ * @brief mergeStereo() of head partition half-spectra into the bit-reversed order fftInverse() takes, scaled by
+ * 1 / FFTLength because fftInverse() isn't
+ *
+ * @param halfAccum Accumulated half-spectra, SpectraLength floats
+ * @param spectrum Output buffer of FFTLength interleaved complex values, bit-reversed
+ */
+_section_itcm
+void mergeStereoReversed(const float32_t *halfAccum, float32_t *spectrum)
+{
+	const float32_t scale = 1.0f / FFTLength;
+
+	spectrum[0] = scale * halfAccum[0];
+	spectrum[1] = scale * halfAccum[2];
+	spectrum[2] = scale * halfAccum[1];
+	spectrum[3] = scale * halfAccum[3];
+
+	for (size_t k = 1; k < PartitionSize; k++)
+	{
+		const float32_t pRe = scale * halfAccum[4 * k];
+		const float32_t pIm = scale * halfAccum[4 * k + 1];
+		const float32_t mRe = scale * halfAccum[4 * k + 2];
+		const float32_t mIm = scale * halfAccum[4 * k + 3];
+
+		const size_t a = 2 * fftBin(k);
+		const size_t b = 2 * fftBin(FFTLength - k);
+		spectrum[a] = pRe + mRe;
+		spectrum[a + 1] = pIm + mIm;
+		spectrum[b] = pRe - mRe;
+		spectrum[b + 1] = mIm - pIm;
+	}
+}
+
+#ifndef UPOLS_FIXED
+/**
+ * @brief Hermitian multiply-accumulate specialised for the configured partition size, the trip count of the
+ * inlined kernel is fixed at compile time
+ *
+ * @param halfSpectra Pointer to the split stereo half-spectra of a delay-line partition
+ * @param filter Pointer to the left and right filter half-spectra of a partition, then the crosstalk paths
+ * @param halfAccum Pointer to accumulator buffer
+ */
+_section_itcm
+static void hmacPartition(const float32_t *halfSpectra, const float32_t *filter, float32_t *halfAccum)
+{
+#ifndef UPOLS_FOUR_PATH
+	hmacN(halfSpectra, filter, halfAccum, PartitionSize);
+#else
+	hmacQuadN(halfSpectra, filter, halfAccum, PartitionSize);
+#endif
+}
+
+/**
+ * @brief Multiply-accumulate filter partitions [first, last) against the FDL partitions they line up with.
+ * Both filters are accumulated in a single pass over the FDL, over the unique half of the spectrum only.
+ *
+ * @param upols upols_t instance
+ * @param filterSet Filter set to take the partitions from
+ * @param first First partition
+ * @param last One past the last partition
+ * @param halfAccum Pointer to accumulator buffer
+ */
+_section_itcm
+static void accumulatePartitions(const upols_instance_t *upols, const filters_t *filterSet, const size_t first, const size_t last, float32_t *halfAccum)
+{
+	const upols_t *state = upols->state;
+	int16_t shiftIndex = (state->currentIndex + PartitionCount - first) % PartitionCount; // New starting point
+	const size_t end = (last < upols->keptPartitions) ? last : upols->keptPartitions;
+
+	for (size_t i = first; i < end; i++)
+	{
+		// Fused multiply-accumulate of one FDL partition against both filters
+		if (filterSet->audible[i])
+		{
+			uint32_t stageStart = perfStart();
+			hmacPartition(&state->delayLine[SpectraLength * shiftIndex], &filterSet->spectra[PARTITION_SPECTRA * i], halfAccum);
+			perfStop(PerfMAC, stageStart);
+		}
+
+		// Decrement with wraparound
+		shiftIndex = (shiftIndex + (PartitionCount - 1)) % PartitionCount;
+	}
+}
+
+/**
+ * @brief Stereo merge and inverse FFT of accumulated half-spectra. The output's real and imaginary parts are
+ * the left and right channels, interleaved left first.
+ *
+ * @param upols upols_instance_t instance
+ * @param halfAccum Pointer to accumulator buffer
+ * @return Pointer to the time-domain output, the last PartitionSize sample pairs are time-aliased
+ */
+_section_itcm
+static const float32_t *inverseFFT(const upols_instance_t *upols, const float32_t *halfAccum)
+{
+	float32_t *cmplxAccum = upols->spectrum;
+
+	uint32_t stageStart = perfStart();
+	mergeStereoReversed(halfAccum, cmplxAccum);
+	fftInverse(cmplxAccum);
+	perfStop(PerfInverseFFT, stageStart);
+
+	return cmplxAccum;
+}
+
+/**
+ * @brief Transform accumulated half-spectra back into a block of output, both channels come out of a
+ * single inverse FFT
+ *
+ * @param upols upols_instance_t instance
+ * @param halfAccum Pointer to accumulator buffer
+ * @param leftOutput Pointer to the left channel time-domain output buffer
+ * @param rightOutput Pointer to the right channel time-domain output buffer
  */
+_section_itcm
+static void inverseTransform(const upols_instance_t *upols, const float32_t *halfAccum, float32_t *leftOutput, float32_t *rightOutput)
+{
+	const float32_t *cmplxAccum = inverseFFT(upols, halfAccum);
 
-#include "upols.h"
-#include "./../../include/tablIR.h"
+#pragma GCC unroll 8
+	for (size_t i = 0; i < PartitionSize; i++)
+	{
+		// Time-aliased portion isn't copied
+		leftOutput[i] = cmplxAccum[2 * i + LeftFilter];
+		rightOutput[i] = cmplxAccum[2 * i + RightFilter];
+	}
+}
 
-// Filter impulse responses
-typedef struct filters_t
+/**
+ * @brief Perform frequency-domain convolution by point-wise multiplication of DFT spectra
+ *
+ * @param upols upols_instance_t instance
+ * @param filterSet Filter set to convolve with
+ * @param leftOutput Pointer to the left channel time-domain output buffer
+ * @param rightOutput Pointer to the right channel time-domain output buffer
+ */
+_section_itcm
+void _convolve(upols_instance_t *upols, const filters_t *filterSet, float32_t *leftOutput, float32_t *rightOutput)
 {
-	float32_t left[512 * PartitionCount];
-	float32_t right[512 * PartitionCount];
-} filters_t;
+	float32_t *halfAccum = upols->halfAccum;
+	clearN(halfAccum, SpectraLength);
+	accumulatePartitions(upols, filterSet, 0, PartitionCount, halfAccum);
+#ifdef UPOLS_REVERB
+	if (reverbBus(upols))
+	{
+		accumulateReverb(upols->state->delayLine, upols->state->currentIndex, halfAccum);
+	}
+#endif
+	inverseTransform(upols, halfAccum, leftOutput, rightOutput);
+}
 
-typedef struct upols_t
+/**
+ * @brief _convolve() with partitions [first, last) taken from either set, for fading them in. The other
+ * partitions are only accumulated once, so this costs one more MAC per fading partition and one more
+ * inverse FFT.
+ *
+ * @param upols upols_instance_t instance
+ * @param outgoing Filter set being convolved with
+ * @param incoming Filter set holding the partitions fading in
+ * @param first First fading partition
+ * @param last One past the last fading partition
+ * @param leftOutput Pointer to the left channel output with the outgoing partitions
+ * @param rightOutput Pointer to the right channel output with the outgoing partitions
+ * @param incomingLeft Pointer to the left channel output with the incoming partitions
+ * @param incomingRight Pointer to the right channel output with the incoming partitions
+ */
+_section_itcm
+void _convolveFading(upols_instance_t *upols, const filters_t *outgoing, const filters_t *incoming, const size_t first, const size_t last,
+					 float32_t *leftOutput, float32_t *rightOutput, float32_t *incomingLeft, float32_t *incomingRight)
 {
-	int16_t currentIndex;					   // Current partition index
-	float32_t slidingWindow[512];			   // Time-domain sliding window
-	float32_t delayLine[512 * PartitionCount]; // Frequency-domain delay line
-} upols_t;
+	float32_t *halfAccum = upols->halfAccum;
+	float32_t *incomingAccum = upols->fadeAccum;
+	clearN(halfAccum, SpectraLength);
+	accumulatePartitions(upols, outgoing, 0, first, halfAccum);
+	accumulatePartitions(upols, outgoing, last, PartitionCount, halfAccum);
+#ifdef UPOLS_REVERB
+	if (reverbBus(upols))
+	{
+		accumulateReverb(upols->state->delayLine, upols->state->currentIndex, halfAccum);
+	}
+#endif
+	cpN(halfAccum, incomingAccum, SpectraLength);
 
-filters_t filters;
+	accumulatePartitions(upols, outgoing, first, last, halfAccum);
+	accumulatePartitions(upols, incoming, first, last, incomingAccum);
 
-void processFilters(const uint16_t irIndex)
+	inverseTransform(upols, halfAccum, leftOutput, rightOutput);
+	inverseTransform(upols, incomingAccum, incomingLeft, incomingRight);
+}
+
+/**
+ * @brief Raised-cosine crossfade from the outgoing filter set's output to the incoming set's output
+ *
+ * @param channelOutput Output of the outgoing set, overwritten with the crossfaded block
+ * @param incomingOutput Output of the incoming set
+ */
+void crossfade(float32_t *channelOutput, const float32_t *incomingOutput)
 {
-	// Start by clearing any contents that may be in memory
-	memset(&filters, 0, sizeof(filters));
+	for (size_t i = 0; i < PartitionSize; i++)
+	{
+		float32_t fadeIn = 0.5f - 0.5f * cosf(PI * ((float32_t)i + 0.5f) / PartitionSize);
+		channelOutput[i] += fadeIn * (incomingOutput[i] - channelOutput[i]);
+	}
+}
 
-	// Loop twice, left channel when i == 0, right channel when i == 1
-	for (size_t i = 0; i < 2; i++)
+/**
+ * @brief Overlap and save input audio samples
+ * 
+ * @param upols upols_t instance
+ * @param leftAudioData Pointer to left channel audio
+ * @param rightAudioData Pointer to right channel audio
+ */
+_section_itcm
+void overlapSamples(upols_t *upols, const float32_t *leftAudioData, const float32_t *rightAudioData)
+{
+	for (size_t i = 0; i < PartitionSize; i++)
+	{
+		// Fill the first half with the previous sample
+		upols->slidingWindow[2 * i] = upols->previousAudioData[2 * i];		   // [0] [2] [4] ... [2N - 2]
+		upols->slidingWindow[2 * i + 1] = upols->previousAudioData[2 * i + 1]; // [1] [3] [5] ... [2N - 1]
+
+		// Fill the last half with the current sample
+		upols->slidingWindow[2 * (PartitionSize + i)] = leftAudioData[i];		// [2N] [2N + 2] ... [4N - 2]
+		upols->slidingWindow[2 * (PartitionSize + i) + 1] = rightAudioData[i]; // [2N + 1] [2N + 3] ... [4N - 1]
+
+		// Save a copy of current sample for the next audio block
+		upols->previousAudioData[2 * i] = leftAudioData[i];
+		upols->previousAudioData[2 * i + 1] = rightAudioData[i];
+	}
+}
+
+#if defined(UPOLS_NONUNIFORM) || defined(UPOLS_REVERB)
+/**
+ * @brief Advance a tail tier by one audio block. The first block of every group of partitionSize samples
+ * transforms the accumulated spectra back into the group's output and retires the completed input window
+ * into the FDL. The remaining blocks share the forward FFT of that window and the complex MAC of each
+ * partition as evenly as possible.
+ *
+ * @param tier tier_t instance
+ * @param spectra Left then right half-spectra of each of the tier's partitions
+ * @param audible Whether each of the tier's partitions is worth its MAC
+ * @param partitionLimit Partitions from this one on are left out of the MAC, the tier's input keeps running
+ * @param audioData Current input block with the left channel in the even indexes and right in the odd
+ * @param leftOutput Pointer to the left channel time-domain output buffer, accumulated into
+ * @param rightOutput Pointer to the right channel time-domain output buffer, accumulated into
+ */
+_section_itcm
+void convolveTier(tier_t *tier, const float32_t *spectra, const bool *audible, const size_t partitionLimit, const float32_t *audioData,
+				  float32_t *leftOutput, float32_t *rightOutput)
+{
+	const size_t partitionSize = tier->partitionSize;
+	const size_t partitionCount = tier->partitionCount;
+	const size_t spectraLength = 4 * partitionSize;
+	const size_t steps = partitionSize / PartitionSize; // Blocks per group
+
+	if (tier->step == 0)
 	{
-		float32_t subfilterSpectra[512]; // DFT spectra of an indiviual filter partition
-		float32_t *filter = i ? filters.right : filters.left;
+		// Everything for this group's output was accumulated over the previous group
+		mergeStereo(tier->halfAccum, tier->spectrum, partitionSize);
+		arm_cfft_f32(tier->fft, tier->spectrum, InverseFFT, 1);
 
-		for (size_t j = 0; j < PartitionCount; j++)
+		for (size_t i = 0; i < partitionSize; i++)
 		{
-			// Zero out impulsePartitionBuffer at the start of a new partition
-			clear512(subfilterSpectra);
+			// Time-aliased portion isn't copied
+			tier->output[i] = tier->spectrum[2 * i + LeftFilter];
+			tier->output[partitionSize + i] = tier->spectrum[2 * i + RightFilter];
+		}
+
+		memset(tier->halfAccum, 0, spectraLength * sizeof(float32_t));
+
+		// Hold on to the completed window, it is transformed into the FDL on the next block
+		memcpy(tier->spectrum, tier->slidingWindow, spectraLength * sizeof(float32_t));
+
+		// The group that just completed becomes the first half of the next window
+		memcpy(tier->slidingWindow, &tier->slidingWindow[2 * partitionSize], 2 * partitionSize * sizeof(float32_t));
+	}
+	else
+	{
+		// Work items are the forward FFT followed by one complex MAC per partition
+		const size_t itemCount = partitionCount + 1;
+		const size_t firstItem = ((tier->step - 1) * itemCount + steps - 2) / (steps - 1);
+		const size_t lastItem = (tier->step * itemCount + steps - 2) / (steps - 1);
 
-			for (size_t k = 0; k < PartitionSize; k++)
+		for (size_t item = firstItem; item < lastItem; item++)
+		{
+			if (item == 0)
 			{
-				// impulsePartitionBuffer[2 * k + 256] = irTable[2 * ImpulseSamples * irIndex + ImpulseSamples * i + 128 * j + k];
+				tier->currentIndex = (tier->currentIndex + 1) % partitionCount;
+				arm_cfft_f32(tier->fft, tier->spectrum, ForwardFFT, 1);
+				splitStereo(tier->spectrum, &tier->delayLine[spectraLength * tier->currentIndex], partitionSize);
+				continue;
+			}
 
-				// Zero-padded on the left side
-				subfilterSpectra[2 * k + 256] = irTable[ImpulseSamples * i + 128 * j + k];
+			const size_t partition = item - 1;
+			if (partition >= partitionLimit || !audible[partition])
+			{
+				continue;
 			}
+			const size_t shiftIndex = (tier->currentIndex + partitionCount - partition) % partitionCount;
+			const float32_t *delayLine = &tier->delayLine[spectraLength * shiftIndex];
+			const float32_t *filter = &spectra[spectraLength * partition];
 
-			// Compute the DFT of the partition and copy to hrtf
-			arm_cfft_f32(&arm_cfft_sR_f32_len256, subfilterSpectra, ForwardFFT, 1);
-			cp512(subfilterSpectra, &filter[512 * j]);
+			hmac(delayLine, filter, tier->halfAccum, partitionSize);
 		}
 	}
+
+	// Collect the current block into the second half of the window
+	const size_t blockOffset = PartitionSize * tier->step;
+	memcpy(&tier->slidingWindow[2 * (partitionSize + blockOffset)], audioData, 2 * PartitionSize * sizeof(float32_t));
+
+	for (size_t i = 0; i < PartitionSize; i++)
+	{
+		leftOutput[i] += tier->output[blockOffset + i];
+		rightOutput[i] += tier->output[partitionSize + blockOffset + i];
+	}
+
+	tier->step = (tier->step + 1) % steps;
 }
+#endif
 
 /**
- * @brief Perform frequency-domain convolution by point-wise multiplication of DFT spectra
+ * @brief Convert the input samples, slide them into the window, and transform the window into the FDL
+ *
+ * @param upols upols_t instance
+ * @param leftAudio Pointer to PartitionSize samples of left channel audio
+ * @param rightAudio Pointer to PartitionSize samples of right channel audio
+ * @param leftAudioData Pointer to PartitionSize floats, overwritten with the converted left channel
+ * @param rightAudioData Pointer to PartitionSize floats, overwritten with the converted right channel
+ */
+_section_itcm
+static void transformInput(upols_t *upols, const int16_t *leftAudio, const int16_t *rightAudio, float32_t *leftAudioData, float32_t *rightAudioData)
+{
+	uint32_t stageStart = perfStart();
+	arm_q15_to_float((q15_t *)leftAudio, leftAudioData, PartitionSize);
+	arm_q15_to_float((q15_t *)rightAudio, rightAudioData, PartitionSize);
+	perfStop(PerfQ15ToFloat, stageStart);
+
+	stageStart = perfStart();
+	overlapSamples(upols, leftAudioData, rightAudioData);
+	perfStop(PerfOverlap, stageStart);
+
+	// Take FFT of time-domain input buffer and split it into the FDL
+	stageStart = perfStart();
+	fftForward(upols->slidingWindow);
+	splitStereoReversed(upols->slidingWindow, &upols->delayLine[upols->currentIndex * SpectraLength]);
+	perfStop(PerfForwardFFT, stageStart);
+}
+
+/**
+ * @brief Everything convolve(), convolveQ23() and upolsProcess() share, from the input samples to the
+ * floating-point output
+ *
+ * @param upols upols_instance_t instance
+ * @param leftAudio Pointer to PartitionSize samples of left channel audio
+ * @param rightAudio Pointer to PartitionSize samples of right channel audio
+ * @param leftAudioData Pointer to the left channel output
+ * @param rightAudioData Pointer to the right channel output
+ */
+_section_itcm
+static void convolveBlock(upols_instance_t *upols, const int16_t *leftAudio, const int16_t *rightAudio, float32_t *leftAudioData, float32_t *rightAudioData)
+{
+	upols_t *state = upols->state;
+	transformInput(state, leftAudio, rightAudio, leftAudioData, rightAudioData);
+
+	// Both filter sets see the same FDL, so the incoming set's output is already fully settled
+	filters_t *incomingFilters = upols->pendingSet;
+	if (incomingFilters)
+	{
+		float32_t incomingLeft[PartitionSize];
+		float32_t incomingRight[PartitionSize];
+
+		_convolve(upols, upols->activeSet, leftAudioData, rightAudioData);
+		_convolve(upols, incomingFilters, incomingLeft, incomingRight);
+
+		uint32_t stageStart = perfStart();
+		crossfade(leftAudioData, incomingLeft);
+		crossfade(rightAudioData, incomingRight);
+		perfStop(PerfCrossfade, stageStart);
+
+		// Retire the outgoing set
+		upols->activeSet = incomingFilters;
+		upols->pendingSet = NULL;
+	}
+	else if (partitionsFading(upols))
+	{
+		float32_t incomingLeft[PartitionSize];
+		float32_t incomingRight[PartitionSize];
+
+		const filters_t *idleFilters = idleSet(upols);
+		_convolveFading(upols, upols->activeSet, idleFilters, interpolation.fadeFirst, interpolation.fadeLast, leftAudioData, rightAudioData, incomingLeft, incomingRight);
+
+		uint32_t stageStart = perfStart();
+		crossfade(leftAudioData, incomingLeft);
+		crossfade(rightAudioData, incomingRight);
+		perfStop(PerfCrossfade, stageStart);
+	}
+	else
+	{
+		_convolve(upols, upols->activeSet, leftAudioData, rightAudioData);
+	}
+
+#ifdef UPOLS_NONUNIFORM
+	uint32_t stageStart = perfStart();
+	const size_t keptPartitions = upols->keptPartitions;
+	for (size_t t = 0; t < TIER_COUNT; t++)
+	{
+		tier_t *tier = &upols->tiers[t];
+		const size_t partitionLimit = (keptPartitions > tier->firstPartition) ? keptPartitions - tier->firstPartition : 0;
+		convolveTier(tier, &upols->activeSet->spectra[tier->filterOffset], &upols->activeSet->audible[tier->firstPartition], partitionLimit,
+					 state->previousAudioData, leftAudioData, rightAudioData);
+	}
+	perfStop(PerfTiers, stageStart);
+#endif
+#ifdef UPOLS_REVERB
+	if (reverbBus(upols))
+	{
+		convolveReverb(state->previousAudioData, leftAudioData, rightAudioData);
+	}
+#endif
+
+	// Increment with wraparound
+	state->currentIndex = (state->currentIndex + 1) % PartitionCount;
+}
+
+/**
+ * @brief Convolve one block of stereo audio in place with an instance of the re-entrant API. Instances share
+ * the overload monitor's shed level with convolve(), they run against the same deadline
+ *
+ * @param upols Instance set up by upolsInit()
+ * @param leftAudio Pointer to PartitionSize samples of left channel audio
+ * @param rightAudio Pointer to PartitionSize samples of right channel audio
+ */
+_section_itcm
+void upolsProcess(upols_instance_t *upols, int16_t *leftAudio, int16_t *rightAudio)
+{
+	upols->keptPartitions = overloadKeep(FILTER_PARTITIONS);
+
+	float32_t leftAudioData[PartitionSize];
+	float32_t rightAudioData[PartitionSize];
+	convolveBlock(upols, leftAudio, rightAudio, leftAudioData, rightAudioData);
+
+	// Convert back to input type
+	uint32_t stageStart = perfStart();
+	arm_float_to_q15(leftAudioData, leftAudio, PartitionSize);
+	arm_float_to_q15(rightAudioData, rightAudio, PartitionSize);
+	perfStop(PerfFloatToQ15, stageStart);
+}
+
+/**
+ * @brief Convolve one block of stereo audio in place
+ *
+ * @param leftAudio Pointer to PartitionSize samples of left channel audio
+ * @param rightAudio Pointer to PartitionSize samples of right channel audio
+ */
+_section_itcm
+void convolve(int16_t *leftAudio, int16_t *rightAudio)
+{
+	const uint32_t convolveStart = perfCycles();
+	upolsProcess(&engine, leftAudio, rightAudio);
+	advanceInterpolation();
+
+	perfStop(PerfConvolve, convolveStart);
+	overloadRecord(perfCycles() - convolveStart);
+}
+
+/**
+ * @brief Round a floating-point sample to Q23, saturating at full scale
+ *
+ */
+static inline int32_t roundQ23(const float32_t sample)
+{
+	return (int32_t)lrintf(fminf(fmaxf(sample * 8388608.0f, -8388608.0f), 8388607.0f));
+}
+
+/**
+ * @brief Convolve one block of stereo audio into 24-bit samples, for outputs that carry more than 16 bits.
+ * The floating-point output is rounded once, straight into the 24-bit range.
+ *
+ * @param leftAudio Pointer to PartitionSize samples of left channel audio, left unchanged
+ * @param rightAudio Pointer to PartitionSize samples of right channel audio, left unchanged
+ * @param leftOutput Pointer to PartitionSize left channel Q23 samples, sign-extended to 32 bits
+ * @param rightOutput Pointer to PartitionSize right channel Q23 samples, sign-extended to 32 bits
+ */
+_section_itcm
+void convolveQ23(int16_t *leftAudio, int16_t *rightAudio, int32_t *leftOutput, int32_t *rightOutput)
+{
+	const uint32_t convolveStart = perfCycles();
+	engine.keptPartitions = overloadKeep(FILTER_PARTITIONS);
+
+	float32_t leftAudioData[PartitionSize];
+	float32_t rightAudioData[PartitionSize];
+	convolveBlock(&engine, leftAudio, rightAudio, leftAudioData, rightAudioData);
+
+	uint32_t stageStart = perfStart();
+	for (size_t i = 0; i < PartitionSize; i++)
+	{
+		leftOutput[i] = roundQ23(leftAudioData[i]);
+		rightOutput[i] = roundQ23(rightAudioData[i]);
+	}
+	perfStop(PerfFloatToQ15, stageStart);
+
+	advanceInterpolation();
+
+	perfStop(PerfConvolve, convolveStart);
+	overloadRecord(perfCycles() - convolveStart);
+}
+
+/**
+ * @brief convolveQ23() with the left and right samples interleaved, the layout of the S/PDIF transmit buffer. Unless
+ * a filter set is being crossfaded in, the samples are rounded straight out of the inverse FFT, which leaves
+ * the channels interleaved already.
+ *
+ * @param leftAudio Pointer to PartitionSize samples of left channel audio, left unchanged
+ * @param rightAudio Pointer to PartitionSize samples of right channel audio, left unchanged
+ * @param interleavedOutput Pointer to PartitionSize pairs of left and right Q23 samples, sign-extended to 32 bits
+ */
+_section_itcm
+void convolveInterleaved(int16_t *leftAudio, int16_t *rightAudio, int32_t *interleavedOutput)
+{
+	const uint32_t convolveStart = perfCycles();
+	engine.keptPartitions = overloadKeep(FILTER_PARTITIONS);
+
+	float32_t leftAudioData[PartitionSize];
+	float32_t rightAudioData[PartitionSize];
+
+#if !defined(UPOLS_NONUNIFORM) && !defined(UPOLS_REVERB)
+	const bool fused = !engine.pendingSet && !partitionsFading(&engine);
+#elif !defined(UPOLS_NONUNIFORM)
+	const bool fused = !engine.pendingSet && !partitionsFading(&engine) && !reverbEnabled(); // The reverb tail is summed per channel
+#else
+	const bool fused = false; // The tiers are summed into each channel separately
+#endif
+	if (fused)
+	{
+		upols_t *state = engine.state;
+		transformInput(state, leftAudio, rightAudio, leftAudioData, rightAudioData);
+
+		clearN(engine.halfAccum, SpectraLength);
+		accumulatePartitions(&engine, engine.activeSet, 0, PartitionCount, engine.halfAccum);
+		const float32_t *cmplxAccum = inverseFFT(&engine, engine.halfAccum);
+
+		uint32_t stageStart = perfStart();
+#pragma GCC unroll 8
+		for (size_t i = 0; i < 2 * PartitionSize; i++)
+		{
+			// Time-aliased portion isn't copied
+			interleavedOutput[i] = roundQ23(cmplxAccum[i]);
+		}
+		perfStop(PerfFloatToQ15, stageStart);
+
+		// Increment with wraparound
+		state->currentIndex = (state->currentIndex + 1) % PartitionCount;
+	}
+	else
+	{
+		convolveBlock(&engine, leftAudio, rightAudio, leftAudioData, rightAudioData);
+
+		uint32_t stageStart = perfStart();
+		for (size_t i = 0; i < PartitionSize; i++)
+		{
+			interleavedOutput[2 * i + LeftFilter] = roundQ23(leftAudioData[i]);
+			interleavedOutput[2 * i + RightFilter] = roundQ23(rightAudioData[i]);
+		}
+		perfStop(PerfFloatToQ15, stageStart);
+	}
+
+	advanceInterpolation();
+
+	perfStop(PerfConvolve, convolveStart);
+	overloadRecord(perfCycles() - convolveStart);
+}
+#else
+/**
+ * @brief Fixed-point counterpart of accumulatePartitions(). Every FDL partition carries its own exponent, so
+ * each partition pair is aligned to the accumulators by a single power of two.
  *
- * @param channelOutput Pointer to the time-domain output buffer
- * @param filterID ID of the channel being operated on [left -> 0] [right -> 1]
+ * @param upols upols_instance_t instance
+ * @param filterSet Filter set to take the partitions from
+ * @param first First partition
+ * @param last One past the last partition
+ * @param halfAccum Pointer to accumulator buffer
  */
-void _convolve(upols_t *upols, float32_t *channelOutput, const uint8_t filterID)
+_section_itcm
+static void accumulatePartitions(const upols_instance_t *upols, const filters_t *filterSet, const size_t first, const size_t last, int64_t *halfAccum)
 {
-	// Frequency-domain accumulation buffer
-	float32_t cmplxAccum[512] = {0};
-	float32_t *filter = filterID ? filters.right : filters.left;
+	const upols_t *state = upols->state;
+	int16_t shiftIndex = (state->currentIndex + PartitionCount - first) % PartitionCount; // New starting point
+	const size_t end = (last < upols->keptPartitions) ? last : upols->keptPartitions;
 
-	int16_t shiftIndex = upols->currentIndex; // New starting point
-	
-	for (size_t i = 0; i < PartitionCount; i++)
+	for (size_t i = first; i < end; i++)
 	{
-		// Fast multiply-accumulate for complex numbers
-		cmac512(&upols->delayLine[512 * shiftIndex], &filter[512 * i], cmplxAccum);
+		const int32_t shift = ACCUM_EXPONENT - state->exponents[shiftIndex] - filterSet->exponents[i];
+		if (shift >= 0 && filterSet->audible[i])
+		{
+			uint32_t stageStart = perfStart();
+			hmacQ15(&state->delayLine[SpectraLength * shiftIndex], &filterSet->spectra[SpectraLength * i], halfAccum, (int32_t)1 << ((shift < 30) ? shift : 30), PartitionSize);
+			perfStop(PerfMAC, stageStart);
+		}
 
 		// Decrement with wraparound
 		shiftIndex = (shiftIndex + (PartitionCount - 1)) % PartitionCount;
 	}
+}
+
+/**
+ * @brief Fixed-point counterpart of inverseTransform(), with a bit of headroom in case the channels sum coherently
+ *
+ * @param upols upols_instance_t instance
+ * @param halfAccum Pointer to accumulator buffer
+ * @param leftOutput Pointer to the left channel output buffer
+ * @param rightOutput Pointer to the right channel output buffer
+ */
+_section_itcm
+static void inverseTransform(const upols_instance_t *upols, const int64_t *halfAccum, int16_t *leftOutput, int16_t *rightOutput)
+{
+	int32_t *cmplxAccum = upols->spectrum;
 
-	arm_cfft_f32(&arm_cfft_sR_f32_len256, cmplxAccum, InverseFFT, 1);
+	uint32_t stageStart = perfStart();
+	mergeStereoQ31(halfAccum, cmplxAccum, PartitionSize, ACCUM_EXPONENT - 1);
+	arm_cfft_q31(CFFT_Q31(FFTLength), cmplxAccum, InverseFFT, 1);
 
-#pragma GCC unroll 8
 	for (size_t i = 0; i < PartitionSize; i++)
 	{
-		channelOutput[i] = cmplxAccum[2 * i + filterID]; // Time-aliased portion isn't copied
+		// Time-aliased portion isn't copied
+		leftOutput[i] = (int16_t)__SSAT((cmplxAccum[2 * i + LeftFilter] + (1 << (OUTPUT_SHIFT - 1))) >> OUTPUT_SHIFT, 16);
+		rightOutput[i] = (int16_t)__SSAT((cmplxAccum[2 * i + RightFilter] + (1 << (OUTPUT_SHIFT - 1))) >> OUTPUT_SHIFT, 16);
 	}
+	perfStop(PerfInverseFFT, stageStart);
 }
 
 /**
- * @brief Overlap and save input audio samples
- * 
- * @param upols upols_t instance
- * @param leftAudioData Pointer to left channel audio
- * @param rightAudioData Pointer to right channel audio
+ * @brief Fixed-point counterpart of the floating-point _convolve()
+ *
+ * @param upols upols_instance_t instance
+ * @param filterSet Filter set to convolve with
+ * @param leftOutput Pointer to the left channel output buffer
+ * @param rightOutput Pointer to the right channel output buffer
  */
-void overlapSamples(upols_t *upols, const float32_t *leftAudioData, const float32_t *rightAudioData)
+_section_itcm
+void _convolve(upols_instance_t *upols, const filters_t *filterSet, int16_t *leftOutput, int16_t *rightOutput)
+{
+	int64_t *halfAccum = upols->halfAccum;
+	memset(halfAccum, 0, SpectraLength * sizeof(int64_t));
+	accumulatePartitions(upols, filterSet, 0, PartitionCount, halfAccum);
+	inverseTransform(upols, halfAccum, leftOutput, rightOutput);
+}
+
+/**
+ * @brief Fixed-point counterpart of the floating-point _convolveFading()
+ *
+ */
+_section_itcm
+void _convolveFading(upols_instance_t *upols, const filters_t *outgoing, const filters_t *incoming, const size_t first, const size_t last,
+					 int16_t *leftOutput, int16_t *rightOutput, int16_t *incomingLeft, int16_t *incomingRight)
+{
+	int64_t *halfAccum = upols->halfAccum;
+	int64_t *incomingAccum = upols->fadeAccum;
+	memset(halfAccum, 0, SpectraLength * sizeof(int64_t));
+	accumulatePartitions(upols, outgoing, 0, first, halfAccum);
+	accumulatePartitions(upols, outgoing, last, PartitionCount, halfAccum);
+	memcpy(incomingAccum, halfAccum, SpectraLength * sizeof(int64_t));
+
+	accumulatePartitions(upols, outgoing, first, last, halfAccum);
+	accumulatePartitions(upols, incoming, first, last, incomingAccum);
+
+	inverseTransform(upols, halfAccum, leftOutput, rightOutput);
+	inverseTransform(upols, incomingAccum, incomingLeft, incomingRight);
+}
+
+/**
+ * @brief Fixed-point counterpart of crossfade(), only runs on the block a new filter set is swapped in
+ *
+ * @param channelOutput Output of the outgoing filter set, faded out in place
+ * @param incomingOutput Output of the incoming filter set
+ */
+void crossfade(int16_t *channelOutput, const int16_t *incomingOutput)
 {
 	for (size_t i = 0; i < PartitionSize; i++)
 	{
-		// Previous left channel samples in the even indexes, right channel samples in the odd indexes
-		static float32_t previousAudioData[256];
+		float32_t fadeIn = 0.5f - 0.5f * cosf(PI * ((float32_t)i + 0.5f) / PartitionSize);
+		channelOutput[i] = (int16_t)lrintf((1.0f - fadeIn) * channelOutput[i] + fadeIn * incomingOutput[i]);
+	}
+}
 
+/**
+ * @brief Fixed-point counterpart of overlapSamples(), samples are halved on the way into Q31 so the packed
+ * stereo FFT can't overflow
+ *
+ * @param upols upols_t instance
+ * @param leftAudio Pointer to the left channel audio samples
+ * @param rightAudio Pointer to the right channel audio samples
+ */
+_section_itcm
+void overlapSamples(upols_t *upols, const int16_t *leftAudio, const int16_t *rightAudio)
+{
+	for (size_t i = 0; i < PartitionSize; i++)
+	{
 		// Fill the first half with the previous sample
-		upols->slidingWindow[2 * i] = previousAudioData[2 * i];			// [0] [2] [4] ... [254]
-		upols->slidingWindow[2 * i + 1] = previousAudioData[2 * i + 1]; // [1] [3] [5] ... [255]
+		upols->slidingWindow[2 * i] = (int32_t)upols->previousAudioData[2 * i] << 15;
+		upols->slidingWindow[2 * i + 1] = (int32_t)upols->previousAudioData[2 * i + 1] << 15;
 
 		// Fill the last half with the current sample
-		upols->slidingWindow[2 * i + 256] = leftAudioData[i];  // [256] [258] [260] ... [510]
-		upols->slidingWindow[2 * i + 257] = rightAudioData[i]; // [257] [259] [261] ... [511]
+		upols->slidingWindow[2 * (PartitionSize + i)] = (int32_t)leftAudio[i] << 15;
+		upols->slidingWindow[2 * (PartitionSize + i) + 1] = (int32_t)rightAudio[i] << 15;
 
 		// Save a copy of current sample for the next audio block
-		previousAudioData[2 * i] = leftAudioData[i];
-		previousAudioData[2 * i + 1] = rightAudioData[i];
+		upols->previousAudioData[2 * i] = leftAudio[i];
+		upols->previousAudioData[2 * i + 1] = rightAudio[i];
 	}
 }
 
 /**
- * @brief 
+ * @brief Fixed-point counterpart of the floating-point upolsProcess()
  *
- * @param leftAudioData
- * @param rightAudioData
+ * @param upols Instance set up by upolsInit()
+ * @param leftAudio Pointer to PartitionSize samples of left channel audio
+ * @param rightAudio Pointer to PartitionSize samples of right channel audio
  */
-void convolve(int16_t *leftAudio, int16_t *rightAudio)
+_section_itcm
+void upolsProcess(upols_instance_t *upols, int16_t *leftAudio, int16_t *rightAudio)
 {
-	static upols_t upols;
+	upols_t *state = upols->state;
+	upols->keptPartitions = overloadKeep(FILTER_PARTITIONS);
+
+	uint32_t stageStart = perfStart();
+	overlapSamples(state, leftAudio, rightAudio);
+	perfStop(PerfOverlap, stageStart);
+
+	// Take FFT of time-domain input buffer and split it into the FDL
+	stageStart = perfStart();
+	arm_cfft_q31(CFFT_Q31(FFTLength), state->slidingWindow, ForwardFFT, 1);
+	state->exponents[state->currentIndex] = splitStereoQ15(state->slidingWindow, &state->delayLine[state->currentIndex * SpectraLength], PartitionSize);
+	perfStop(PerfForwardFFT, stageStart);
 
-	float32_t leftAudioData[128];
-	float32_t rightAudioData[128];
+	// The input has been consumed by the window, so the output can go straight back into the blocks
+	filters_t *incomingFilters = upols->pendingSet;
+	if (incomingFilters)
+	{
+		int16_t incomingLeft[PartitionSize];
+		int16_t incomingRight[PartitionSize];
+
+		_convolve(upols, upols->activeSet, leftAudio, rightAudio);
+		_convolve(upols, incomingFilters, incomingLeft, incomingRight);
 
-	arm_q15_to_float(leftAudio, leftAudioData, 128);
-	arm_q15_to_float(rightAudio, rightAudioData, 128);
+		stageStart = perfStart();
+		crossfade(leftAudio, incomingLeft);
+		crossfade(rightAudio, incomingRight);
+		perfStop(PerfCrossfade, stageStart);
 
-	overlapSamples(&upols, leftAudioData, rightAudioData);
+		// Retire the outgoing set
+		upols->activeSet = incomingFilters;
+		upols->pendingSet = NULL;
+	}
+	else if (partitionsFading(upols))
+	{
+		int16_t incomingLeft[PartitionSize];
+		int16_t incomingRight[PartitionSize];
 
-	// Take FFT of time-domain input buffer and copy to the FDL
-	arm_cfft_f32(&arm_cfft_sR_f32_len256, upols.slidingWindow, ForwardFFT, 1);
-	cp512(upols.slidingWindow, &upols.delayLine[upols.currentIndex * 512]);
+		const filters_t *idleFilters = idleSet(upols);
+		_convolveFading(upols, upols->activeSet, idleFilters, interpolation.fadeFirst, interpolation.fadeLast, leftAudio, rightAudio, incomingLeft, incomingRight);
 
-	_convolve(&upols, leftAudioData, LeftFilter);
-	_convolve(&upols, rightAudioData, RightFilter);
+		stageStart = perfStart();
+		crossfade(leftAudio, incomingLeft);
+		crossfade(rightAudio, incomingRight);
+		perfStop(PerfCrossfade, stageStart);
+	}
+	else
+	{
+		_convolve(upols, upols->activeSet, leftAudio, rightAudio);
+	}
 
 	// Increment with wraparound
-	upols.currentIndex = (upols.currentIndex + 1) % PartitionCount;
+	state->currentIndex = (state->currentIndex + 1) % PartitionCount;
+}
 
-	// Convert back to input type
-	arm_float_to_q15(leftAudioData, leftAudio, 128);
-	arm_float_to_q15(rightAudioData, rightAudio, 128);
+/**
+ * @brief Convolve one block of stereo audio in place
+ *
+ * @param leftAudio Pointer to PartitionSize samples of left channel audio
+ * @param rightAudio Pointer to PartitionSize samples of right channel audio
+ */
+_section_itcm
+void convolve(int16_t *leftAudio, int16_t *rightAudio)
+{
+	const uint32_t convolveStart = perfCycles();
+	upolsProcess(&engine, leftAudio, rightAudio);
+	advanceInterpolation();
+
+	perfStop(PerfConvolve, convolveStart);
+	overloadRecord(perfCycles() - convolveStart);
+}
+
+/**
+ * @brief Fixed-point counterpart of the floating-point convolveQ23(). The output is rounded to Q15 once the
+ * inverse FFT is done, so the 24-bit samples carry no more resolution than convolve() gives.
+ *
+ * @param leftAudio Pointer to PartitionSize samples of left channel audio, overwritten with the Q15 output
+ * @param rightAudio Pointer to PartitionSize samples of right channel audio, overwritten with the Q15 output
+ * @param leftOutput Pointer to PartitionSize left channel Q23 samples, sign-extended to 32 bits
+ * @param rightOutput Pointer to PartitionSize right channel Q23 samples, sign-extended to 32 bits
+ */
+_section_itcm
+void convolveQ23(int16_t *leftAudio, int16_t *rightAudio, int32_t *leftOutput, int32_t *rightOutput)
+{
+	convolve(leftAudio, rightAudio);
+	for (size_t i = 0; i < PartitionSize; i++)
+	{
+		leftOutput[i] = (int32_t)leftAudio[i] * 256;
+		rightOutput[i] = (int32_t)rightAudio[i] * 256;
+	}
+}
+
+/**
+ * @brief Fixed-point counterpart of the floating-point convolveInterleaved(), with the same Q15 resolution as
+ * convolveQ23()
+ *
+ * @param leftAudio Pointer to PartitionSize samples of left channel audio, overwritten with the Q15 output
+ * @param rightAudio Pointer to PartitionSize samples of right channel audio, overwritten with the Q15 output
+ * @param interleavedOutput Pointer to PartitionSize pairs of left and right Q23 samples, sign-extended to 32 bits
+ */
+_section_itcm
+void convolveInterleaved(int16_t *leftAudio, int16_t *rightAudio, int32_t *interleavedOutput)
+{
+	convolve(leftAudio, rightAudio);
+	for (size_t i = 0; i < PartitionSize; i++)
+	{
+		interleavedOutput[2 * i + LeftFilter] = (int32_t)leftAudio[i] * 256;
+		interleavedOutput[2 * i + RightFilter] = (int32_t)rightAudio[i] * 256;
+	}
+}
+#endif
+
+// Code has no size here, entries with a size of 0 are functions
+static const memmap_entry_t memoryMap[] = {
+	{"instance", &instance, sizeof(instance)},
+	{"filters", &filters, sizeof(filters)},
+	{"altFilters", &altFilters, sizeof(altFilters)},
+	{"convolveAccum", convolveAccum, sizeof(convolveAccum)},
+	{"convolveSpectrum", convolveSpectrum, sizeof(convolveSpectrum)},
+	{"fadeAccum", fadeAccum, sizeof(fadeAccum)},
+#ifdef UPOLS_NONUNIFORM
+	{"tier1DelayLine", tier1DelayLine, sizeof(tier1DelayLine)},
+	{"tier1Buffers", tier1Window, sizeof(tier1Window) + sizeof(tier1Accum) + sizeof(tier1Spectrum) + sizeof(tier1Output)},
+	{"tier2DelayLine", tier2DelayLine, sizeof(tier2DelayLine)},
+	{"tier2Buffers", tier2Window, sizeof(tier2Window) + sizeof(tier2Accum) + sizeof(tier2Spectrum) + sizeof(tier2Output)},
+#endif
+#ifdef BANK_IR_COUNT
+	{"bankIR", bankIR, sizeof(bankIR)},
+#endif
+	{"interpolatedTaps", interpolatedTaps, sizeof(interpolatedTaps)},
+	{"cachedFilters", cachedFilters, sizeof(cachedFilters)},
+#ifndef UPOLS_PACKED_IR
+	{"irTable", irTable, sizeof(irTable)},
+#else
+	{"packedIR", packedIR, PACK_IR_COUNT * 2 * TableImpulseSamples * (2 * PACK_IR_BLOCK_SIZE + 1) / PACK_IR_BLOCK_SIZE},
+#endif
+	{"convolve", (const void *)convolve, 0},
+	{"convolveQ23", (const void *)convolveQ23, 0},
+	{"convolveInterleaved", (const void *)convolveInterleaved, 0},
+	{"_convolve", (const void *)_convolve, 0},
+#ifndef UPOLS_FIXED
+	{"hmacPartition", (const void *)hmacPartition, 0},
+#else
+	{"hmacQ15", (const void *)hmacQ15, 0},
+#endif
+	{"fftTwiddles", fftTwiddles, sizeof(fftTwiddles)},
+	{"fftForward", (const void *)fftForward, 0},
+	{"fftInverse", (const void *)fftInverse, 0},
+	{"processFilters", (const void *)processFilters, 0},
+};
+
+/**
+ * @brief Table of the engine's buffers and hot kernels, for reporting where the linker put them
+ *
+ * @param entryCount Number of entries in the table
+ * @return Pointer to the first entry
+ */
+const memmap_entry_t *upolsMemoryMap(size_t *entryCount)
+{
+	*entryCount = sizeof(memoryMap) / sizeof(memoryMap[0]);
+	return memoryMap;
 }
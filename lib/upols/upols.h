@@ -13,20 +13,78 @@
 
 #include <stdlib.h>
 #include <string.h>
-#include <usb_serial.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <arm_math.h>
 #include <arm_const_structs.h>
-#include <imxrt.h>
 #include "math512.h"
+#include "perf.h"
 
+// Partition geometry, override from build_flags to trade latency against filter length for a given build.
+// The partition size must divide AUDIO_BLOCK_SAMPLES and its FFT (twice the size) must exist in arm_const_structs.h.
+// Latency only drops along with AUDIO_BLOCK_SAMPLES, see env:auricle_lowlatency in platformio.ini
+#ifndef UPOLS_PARTITION_SIZE
+#define UPOLS_PARTITION_SIZE 128
+#endif
+#ifndef UPOLS_PARTITION_COUNT
+#define UPOLS_PARTITION_COUNT 64
+#endif
+
+// Define UPOLS_PACKED_IR to compile the HRIRs in from the block-floating-point asset tools/packIR.py generates
+// instead of tablIR.h. Half the flash and flash reads per angle, decoded as each partition is prepared.
+
+// Define UPOLS_FOUR_PATH to virtualise a pair of speakers: each input channel reaches both ears, left-in to left-ear,
+// left-in to right-ear, right-in to left-ear and right-in to right-ear, all off the one forward FFT and FDL. An HRIR
+// pair places the left speaker and the right one is its mirror image. Filter sets take twice the memory, see
+// env:auricle_speakers in platformio.ini
+
+// Partitions whose impulse response energy is below this many dB relative to a full-scale unit impulse are
+// left out of the MAC. At -110 dB a partition adds well under 0.1 LSB RMS to a full-scale input
+#ifndef UPOLS_PARTITION_FLOOR_DB
+#define UPOLS_PARTITION_FLOOR_DB -110
+#endif
+
+#ifndef UPOLS_NONUNIFORM
 enum Lengths
 {
-	PartitionSize = 128, // Number of audio samples per partition
-	PartitionCount = 64, // Number of partitions making up the filter
+	PartitionSize = UPOLS_PARTITION_SIZE,	// Number of audio samples per partition
+	PartitionCount = UPOLS_PARTITION_COUNT, // Number of partitions making up the filter
 	ImpulseSamples = PartitionSize * PartitionCount,
+	FFTLength = 2 * PartitionSize,		   // Number of complex points per partition transform
+	SpectraLength = 4 * PartitionSize,	   // Number of floats per transformed partition
+	TableImpulseSamples = 8192,			   // Number of samples per HRIR in tablIR.h, longer filters are truncated
+	AngleCount = 100, // Number of HRIR pairs making up a full rotation (3.6 degree resolution)
 };
+#else
+// Non-uniform partitioning: the head is convolved every block, each tail tier is spread across the blocks
+// making up one of its partitions. A tier must start exactly twice its partition size into the filter.
+enum Lengths
+{
+	PartitionSize = UPOLS_PARTITION_SIZE,		// Number of audio samples per head partition
+	PartitionCount = 8,							// Number of head partitions, covering taps [0, 8N)
+	Tier1PartitionSize = 4 * PartitionSize,		// Number of audio samples per first tier partition
+	Tier1PartitionCount = 6,					// Number of first tier partitions, covering taps [8N, 32N)
+	Tier2PartitionSize = 16 * PartitionSize,	// Number of audio samples per second tier partition
+	Tier2PartitionCount = 2,					// Number of second tier partitions, covering taps [32N, 64N)
+	ImpulseSamples = PartitionSize * PartitionCount + Tier1PartitionSize * Tier1PartitionCount + Tier2PartitionSize * Tier2PartitionCount,
+	FFTLength = 2 * PartitionSize,				// Number of complex points per head partition transform
+	SpectraLength = 4 * PartitionSize,			// Number of floats per transformed head partition
+	TableImpulseSamples = 8192,					// Number of samples per HRIR in tablIR.h, longer filters are truncated
+	AngleCount = 100, // Number of HRIR pairs making up a full rotation (3.6 degree resolution)
+};
+#endif
+
+/**
+ * @brief Pick the arm_cfft_f32 instance for a compile-time FFT length. Folds to a single address constant, so it
+ * can be used in static initializers, and to NULL for lengths arm_const_structs.h doesn't provide
+ *
+ */
+#define CFFT_F32(length) \
+	((length) == 16 ? &arm_cfft_sR_f32_len16 : (length) == 32 ? &arm_cfft_sR_f32_len32 : (length) == 64 ? &arm_cfft_sR_f32_len64 : \
+	(length) == 128 ? &arm_cfft_sR_f32_len128 : (length) == 256 ? &arm_cfft_sR_f32_len256 : (length) == 512 ? &arm_cfft_sR_f32_len512 : \
+	(length) == 1024 ? &arm_cfft_sR_f32_len1024 : (length) == 2048 ? &arm_cfft_sR_f32_len2048 : (length) == 4096 ? &arm_cfft_sR_f32_len4096 : NULL)
+
+#define IS_CFFT_LENGTH(length) ((length) >= 16 && (length) <= 4096 && ((length) & ((length) - 1)) == 0)
 
 enum FFT_Flags
 {
@@ -40,12 +98,104 @@ enum FilterID
 	RightFilter
 };
 
+// A buffer or kernel of the engine and where it landed, size is 0 for code
+typedef struct memmap_entry_t
+{
+	const char *name;
+	const void *address;
+	size_t size;
+} memmap_entry_t;
+
+// Hit and miss counts of the filter set cache behind processFilters() and whole-pair interpolations
+typedef struct filter_cache_stats_t
+{
+	uint32_t hits;
+	uint32_t misses;
+	uint16_t sets;	   // Sets currently cached
+	uint16_t capacity; // Sets that fit in the populated PSRAM, at most UPOLS_FILTER_CACHE_SETS
+} filter_cache_stats_t;
+
+// Tail tier of a non-uniform partitioning, a part of the filter with partitions of its own size that is
+// convolved a little every block from its own window and FDL
+typedef struct tier_t
+{
+	const uint16_t partitionSize;	// Number of audio samples per partition
+	const uint16_t partitionCount;	// Number of partitions in the tier
+	const uint32_t filterOffset;	// Offset of the tier's first partition spectra in its filter set
+	const uint16_t firstPartition;	// Index of the tier's first partition in its filter set's per-partition state
+	const arm_cfft_instance_f32 *fft;
+	uint16_t step;					// Audio block within the current group of partitionSize samples
+	uint16_t currentIndex;			// Current partition index
+	float32_t *slidingWindow;		// Time-domain sliding window, 4 * partitionSize
+	float32_t *delayLine;			// Frequency-domain delay line, 4 * partitionSize * partitionCount
+	float32_t *halfAccum;			// Frequency-domain accumulation buffer, 4 * partitionSize
+	float32_t *spectrum;			// Full spectrum scratch for both transform directions, 4 * partitionSize
+	float32_t *output;				// Output for the current group, left then right, 2 * partitionSize
+} tier_t;
+
+// Accumulator and inverse FFT element types of the engine the build flags select
+#ifndef UPOLS_FIXED
+typedef float32_t upols_accum_t;
+typedef float32_t upols_spectrum_t;
+#else
+typedef int64_t upols_accum_t;
+typedef int32_t upols_spectrum_t;
+#endif
+
+// Convolver of the instance API. upolsInit() carves every buffer it touches out of a single arena supplied by the
+// caller, so instances can run side by side and their placement is wherever the arena is. The geometry and the
+// engine are the ones the build flags select. convolve() and the filter loading functions drive an instance of
+// their own over buffers placed in DTCM, which alone interpolates and feeds the room reverb.
+typedef struct upols_instance_t
+{
+	struct upols_t *state;					// Sliding window and FDL
+	struct filters_t *sets[2];				// One set is convolved with while the other is prepared
+	struct filters_t *volatile activeSet;	// Set being convolved with, only changed by upolsProcess()
+	struct filters_t *volatile pendingSet;	// Fully prepared set waiting to be crossfaded in
+	upols_accum_t *halfAccum;				// Frequency-domain accumulator, SpectraLength values
+	upols_accum_t *fadeAccum;				// Incoming accumulator while partitions fade in
+	upols_spectrum_t *spectrum;				// Inverse FFT scratch, SpectraLength values
+	tier_t *tiers;							// Tail tiers of a non-uniform build, NULL otherwise
+	size_t keptPartitions;					// Leading partitions in the MAC, fewer while overloadRecord() sheds
+} upols_instance_t;
+
+#define UPOLS_ARENA_ALIGNMENT 32 // Arenas and every buffer carved out of them start on a cache line
+
 #ifdef __cplusplus
 extern "C"
 {
 #endif
-	void processFilters(const uint16_t irIndex);
+	bool processFilters(const uint16_t irIndex);
+	bool interpolateFilters(const uint16_t irIndex, const float32_t fraction);
+	bool updateFilters(const uint16_t irIndex, const float32_t fraction);
+	bool filtersSettled(void);
+	bool loadFilterSpectra(const float32_t *spectra);
+	bool loadFourPathSpectra(const float32_t *spectra);
+	bool loadHrirTable(const float32_t *table, const uint16_t count);
 	void convolve(int16_t *leftAudio, int16_t *rightAudio);
+	void convolveQ23(int16_t *leftAudio, int16_t *rightAudio, int32_t *leftOutput, int32_t *rightOutput);
+	void convolveInterleaved(int16_t *leftAudio, int16_t *rightAudio, int32_t *interleavedOutput);
+	const memmap_entry_t *upolsMemoryMap(size_t *entryCount);
+	void filterCacheStats(filter_cache_stats_t *stats);
+	size_t audiblePartitions(size_t *partitionCount);
+
+	// Re-entrant instance API, an instance is only touched by the calls it's passed to
+	size_t upolsArenaSize(void);
+	bool upolsInit(upols_instance_t *upols, void *arena, const size_t arenaSize);
+	void upolsReset(upols_instance_t *upols);
+	bool upolsSetFilter(upols_instance_t *upols, const uint16_t irIndex);
+	bool upolsSetSpectra(upols_instance_t *upols, const float32_t *spectra);
+	void upolsProcess(upols_instance_t *upols, int16_t *leftAudio, int16_t *rightAudio);
+
+	// Building blocks shared with the multi-source engine in binaural.c and the room reverb in reverb.c
+	uint16_t hrirCount(void);
+	bool hrirTaps(const uint16_t irIndex, const size_t offset, const size_t count, float32_t *leftTaps, float32_t *rightTaps);
+	uint32_t hrirGeneration(void);
+	void transformPartition(const float32_t *leftTaps, const float32_t *rightTaps, const size_t partitionSize, const arm_cfft_instance_f32 *fft, float32_t *subfilterSpectra);
+	void mergeStereo(const float32_t *halfAccum, float32_t *spectrum, const size_t bins);
+	void mergeStereoReversed(const float32_t *halfAccum, float32_t *spectrum);
+	void convolveTier(tier_t *tier, const float32_t *spectra, const bool *audible, const size_t partitionLimit, const float32_t *audioData,
+					  float32_t *leftOutput, float32_t *rightOutput);
 #ifdef __cplusplus
 }
 #endif
@@ -48,11 +48,19 @@ void Ash::init(void)
 
 	newCmd("pttoggle", "Toggle audio passthrough", audioPassthrough);
 	newCmd("status", "Get status of the D3", currentStatus);
-	newCmd("sangle", "Set HRIR angle", setAngle);
+	newCmd("sangle", "Set HRIR angle in degrees, fractional angles are interpolated", setAngle);
+	newCmd("hrtf", "SD card HRTF dataset: 'hrtf load <file>', 'hrtf select <azimuth> <elevation>', or progress", hrtf);
 	newCmd("audiomemory", "View current and maximum audio memory", audioMemory);
 	newCmd("reboot", "Reboot Auricle", reboot);
 	newCmd("clear", "Clear screen", clear);
 	newCmd("memuse", "View amount of RAM free", memoryUse);
+	newCmd("memmap", "View where the convolution buffers and kernels are placed", memoryMap);
+	newCmd("perf", "View convolution stage cycle counts, 'perf reset' to clear them", perf);
+	newCmd("overload", "View the overload monitor's shed level and counters, 'overload reset' to clear them", overload);
+	newCmd("spdif", "View S/PDIF queue and clock drift, 'spdif reset' to clear counters, 'spdif clock <fixed|pll|resample>'", spdif);
+#ifdef UPOLS_REVERB
+	newCmd("reverb", "Room reverb: 'reverb load <file> [gain dB]' of raw interleaved float32 stereo, 'reverb off', or status", reverb);
+#endif
 	newCmd("lscmd", "List all commands", lscmds);
 
 	motd();
@@ -61,17 +69,35 @@ void Ash::init(void)
 void Ash::execLoop(void)
 {
 	run();
+	reportOverload();
+}
+
+/**
+ * @brief Print the levels the overload monitor has shed or restored since the last call
+ * 
+ */
+void Ash::reportOverload(void)
+{
+	static uint16_t reportedLevel;
+
+	overload_event_t event;
+	while (overloadEvent(&event))
+	{
+		printf("Overload: %s level %u of %u at %u%% load, convolving %u/%u of each filter\n", (event.level > reportedLevel) ? "shed to" : "restored to",
+			   event.level, OverloadMaxLevel, event.load, OverloadSteps - event.level, OverloadSteps);
+		reportedLevel = event.level;
+	}
 }
 
 void Ash::toggle(void *)
 {
-	char *options[3] = {(char *)"power", (char *)"input", (char *)"passthrough"};
+	char *options[6] = {(char *)"power", (char *)"input", (char *)"passthrough", (char *)"lazy", (char *)"24bit", (char *)"shedding"};
 
 	char *cmdArg = NULL;
 	if (getArg(&cmdArg))
 	{
 		bool invalidCmd = true;
-		for (size_t i = 0; i < 3; i++)
+		for (size_t i = 0; i < 6; i++)
 		{
 			if (strncmp(cmdArg, options[i], 16) == 0)
 			{
@@ -85,6 +111,15 @@ void Ash::toggle(void *)
 					break;
 				case 2:
 					printf("Audio Passthough %s\n", convolvIR.togglePassthrough() ? "Enabled" : "Disabled");
+					break;
+				case 3:
+					printf("Lazy filter updates %s\n", convolvIR.toggleLazyUpdates() ? "Enabled" : "Disabled");
+					break;
+				case 4:
+					printf("24-bit S/PDIF output %s\n", convolvIR.toggleQ23Output() ? "Enabled" : "Disabled");
+					break;
+				case 5:
+					printf("Overload shedding %s\n", convolvIR.toggleShedding() ? "Enabled" : "Disabled");
 				}
 				invalidCmd = false;
 				break;
@@ -102,10 +137,17 @@ void Ash::setAngle(void *)
 	char *cmdArg = NULL;
 	if (getArg(&cmdArg))
 	{
-		uint16_t angle = (uint16_t)(atoi(cmdArg));
-		printf("Setting angle: %d degrees\n", angle);
-		convolvIR.convertIR((uint16_t)__builtin_round((float32_t)(angle) / 3.6));
-		printf("Done\n");
+		float32_t angle = (float32_t)atof(cmdArg);
+		int32_t tenths = (int32_t)lrintf(10.0f * angle);
+		printf("Setting angle: %s%ld.%ld degrees\n", (tenths < 0) ? "-" : "", (long)abs(tenths) / 10, (long)abs(tenths) % 10);
+		if (convolvIR.setAngle(angle))
+		{
+			printf("Done\n");
+		}
+		else
+		{
+			printf("Error: no HRIR compiled in next to %s\n", cmdArg);
+		}
 	}
 	else
 	{
@@ -113,10 +155,218 @@ void Ash::setAngle(void *)
 	}
 }
 
+void Ash::hrtf(void *)
+{
+	char *cmdArg = NULL;
+	if (!getArg(&cmdArg))
+	{
+		printf("Dataset %s, %u of %u measurements loaded", hrtfLoader.stateName(), hrtfLoader.loaded(), hrtfLoader.capacity());
+		if (hrtfLoader.capacity() < hrtfLoader.measurements())
+		{
+			printf(", %u more don't fit in PSRAM", hrtfLoader.measurements() - hrtfLoader.capacity());
+		}
+		printf("%s\n", hrtfLoader.fromCache() ? " from cached spectra" : "");
+		return;
+	}
+
+	if (strncmp(cmdArg, "load", 16) == 0)
+	{
+		char *path = NULL;
+		if (!getArg(&path))
+		{
+			printf("Error: incorrect syntax\n");
+		}
+		else if (hrtfLoader.begin(path))
+		{
+			printf("Loading %u measurements in the background\n", hrtfLoader.capacity());
+		}
+	}
+	else if (strncmp(cmdArg, "select", 16) == 0)
+	{
+		char *azimuth = NULL;
+		char *elevation = NULL;
+		if (!getArg(&azimuth))
+		{
+			printf("Error: incorrect syntax\n");
+			return;
+		}
+
+		uint16_t measurement;
+		const float32_t *spectra = hrtfLoader.nearest((float32_t)atof(azimuth), getArg(&elevation) ? (float32_t)atof(elevation) : 0.0f, &measurement);
+		if (spectra && convolvIR.loadSpectra(spectra))
+		{
+			printf("Selected measurement %u\n", measurement);
+		}
+		else
+		{
+			printf("Error: no measurement loaded yet\n");
+		}
+	}
+	else
+	{
+		printf("Unknown option: %s\n", cmdArg);
+	}
+}
+
 void Ash::currentStatus(void *)
 {
 	d3currentStatus();
+
+	filter_cache_stats_t cache;
+	filterCacheStats(&cache);
+	printf("Filter cache: %u of %u sets, %lu hits, %lu misses\n", cache.sets, cache.capacity, (unsigned long)cache.hits, (unsigned long)cache.misses);
+
+	size_t partitionCount;
+	const size_t audible = audiblePartitions(&partitionCount);
+	printf("Convolving %u of %u partitions, the rest are below %d dB\n", (unsigned)audible, (unsigned)partitionCount, UPOLS_PARTITION_FLOOR_DB);
+	printf("Head tracker: %lu orientations received, %lu applied\n", (unsigned long)headTracker.received(), (unsigned long)headTracker.applied());
+}
+
+void Ash::spdif(void *)
+{
+	char *cmdArg = NULL;
+	if (getArg(&cmdArg))
+	{
+		if (strncmp(cmdArg, "reset", 16) == 0)
+		{
+			spdifOut.resetQueueStats();
+			printf("S/PDIF counters cleared\n");
+		}
+		else if (strncmp(cmdArg, "clock", 16) == 0)
+		{
+			const char *modes[] = {"fixed", "pll", "resample"};
+			char *mode = NULL;
+			if (getArg(&mode))
+			{
+				for (size_t i = 0; i < 3; i++)
+				{
+					if (strncmp(mode, modes[i], 16) == 0)
+					{
+						spdifOut.setDriftMode((SpdifTx::DriftMode)i);
+						printf("Following the source clock with: %s\n", modes[i]);
+						return;
+					}
+				}
+				printf("Unknown clock mode: %s\n", mode);
+			}
+			else
+			{
+				printf("Error: expected 'spdif clock <fixed|pll|resample>'\n");
+			}
+		}
+		else
+		{
+			printf("Unknown option: %s\n", cmdArg);
+		}
+		return;
+	}
+
+	const char *modes[] = {"fixed", "pll", "resample"};
+	spdif_queue_stats_t stats;
+	spdifOut.queueStats(&stats);
+
+	// Latency the peak fill added on top of the DMA buffer
+	const uint32_t peakMicroseconds = (uint32_t)(1e6f * stats.peakFill * AUDIO_BLOCK_SAMPLES / AUDIO_SAMPLE_RATE_EXACT);
+	printf("Queue: %lu of %lu blocks, peak %lu (%lu us), prefill %u\n", (unsigned long)stats.fill, (unsigned long)stats.depth,
+		   (unsigned long)stats.peakFill, (unsigned long)peakMicroseconds, SPDIF_QUEUE_PREFILL);
+	printf("Underruns: %lu, overruns: %lu, late direct writes: %lu\n", (unsigned long)stats.underruns,
+		   (unsigned long)stats.overruns, (unsigned long)stats.lateWrites);
+	printf("Clock: %s, source drift %ld ppm, %ld ppm trimmed into the PLL, %ld ppm resampled\n", modes[spdifOut.driftMode()],
+		   (long)lrintf(stats.driftPpm), (long)lrintf(stats.pllTrimPpm), (long)lrintf(stats.resamplePpm));
+}
+
+#ifdef UPOLS_REVERB
+void Ash::reverb(void *)
+{
+	char *cmdArg = NULL;
+	if (!getArg(&cmdArg))
+	{
+		if (reverbEnabled())
+		{
+			const uint32_t milliseconds = (uint32_t)(1000.0f * reverbTaps() / AUDIO_SAMPLE_RATE_EXACT);
+			printf("Room reverb: %u of %u taps (%lu ms)\n", (unsigned)reverbTaps(), ReverbImpulseSamples, (unsigned long)milliseconds);
+		}
+		else
+		{
+			printf("Room reverb: off\n");
+		}
+		return;
+	}
+
+	if (strncmp(cmdArg, "off", 16) == 0)
+	{
+		disableReverb();
+		printf("Room reverb off\n");
+		return;
+	}
+	if (strncmp(cmdArg, "load", 16) != 0)
+	{
+		printf("Unknown option: %s\n", cmdArg);
+		return;
+	}
+
+	char *path = NULL;
+	char *gain = NULL;
+	if (!getArg(&path))
+	{
+		printf("Error: incorrect syntax\n");
+		return;
+	}
+	const float32_t gainDb = getArg(&gain) ? (float32_t)atof(gain) : 0.0f;
+
+	if (!SD.begin(BUILTIN_SDCARD))
+	{
+		printf("Error: no SD card\n");
+		return;
+	}
+	File response = SD.open(path, FILE_READ);
+	if (!response)
+	{
+		printf("Error: can't open %s\n", path);
+		return;
+	}
+
+	// Loaded in the foreground, the convolution keeps running without the reverb until it's complete
+	enum
+	{
+		ChunkFrames = 256
+	};
+	static float32_t frames[2 * ChunkFrames];
+	static float32_t leftTaps[ChunkFrames];
+	static float32_t rightTaps[ChunkFrames];
+
+	beginReverb(powf(10.0f, gainDb / 20.0f));
+	size_t loaded = 0;
+	int bytes;
+	while ((bytes = response.read(frames, sizeof(frames))) > 0)
+	{
+		const size_t frameCount = (size_t)bytes / (2 * sizeof(float32_t));
+		for (size_t i = 0; i < frameCount; i++)
+		{
+			leftTaps[i] = frames[2 * i];
+			rightTaps[i] = frames[2 * i + 1];
+		}
+
+		const size_t taken = addReverbTaps(leftTaps, rightTaps, frameCount);
+		loaded += taken;
+		if (taken < frameCount)
+		{
+			printf("Truncated to %u taps\n", ReverbImpulseSamples);
+			break;
+		}
+	}
+	response.close();
+
+	if (finishReverb())
+	{
+		printf("Room reverb: %u taps loaded\n", (unsigned)loaded);
+	}
+	else
+	{
+		printf("Error: %s holds no taps\n", path);
+	}
 }
+#endif
 
 void Ash::lscmds(void *)
 {
@@ -146,6 +396,165 @@ void Ash::memoryUse(void *)
 	printf("Memory free: %8d\n", (char *)(&_heap_end) - __brkval);
 }
 
+void Ash::memoryMap(void *)
+{
+	// i.MX RT1062 memory map
+	static const struct
+	{
+		const char *name;
+		uintptr_t base;
+		uintptr_t end;
+	} regions[] = {
+		{"ITCM", 0x00000000, 0x00080000},
+		{"DTCM", 0x20000000, 0x20080000},
+		{"OCRAM2", 0x20200000, 0x20280000},
+		{"FLASH", 0x60000000, 0x70000000},
+		{"EXTMEM", 0x70000000, 0x80000000},
+	};
+
+	// The reverb bus keeps a map of its own
+	const memmap_entry_t *(*const maps[])(size_t *) = {
+		upolsMemoryMap,
+#ifdef UPOLS_REVERB
+		reverbMemoryMap,
+#endif
+	};
+
+	printf("%-18s %-10s %-8s %8s %s\n", "buffer", "address", "region", "bytes", "aligned");
+	for (size_t m = 0; m < sizeof(maps) / sizeof(maps[0]); m++)
+	{
+		size_t entryCount;
+		const memmap_entry_t *entries = maps[m](&entryCount);
+		for (size_t i = 0; i < entryCount; i++)
+		{
+			// Thumb function pointers carry bit 0
+			const uintptr_t address = (uintptr_t)entries[i].address & ~(uintptr_t)1;
+
+			const char *region = "?";
+			for (size_t j = 0; j < sizeof(regions) / sizeof(regions[0]); j++)
+			{
+				if (address >= regions[j].base && address < regions[j].end)
+				{
+					region = regions[j].name;
+				}
+			}
+
+			if (entries[i].size)
+			{
+				printf("%-18s 0x%08lx %-8s %8lu %s\n", entries[i].name, (unsigned long)address, region,
+					   (unsigned long)entries[i].size, (address % 32) ? "no" : "yes");
+			}
+			else
+			{
+				printf("%-18s 0x%08lx %-8s %8s\n", entries[i].name, (unsigned long)address, region, "code");
+			}
+		}
+	}
+}
+
+void Ash::perf(void *)
+{
+	char *cmdArg = NULL;
+	if (getArg(&cmdArg))
+	{
+		if (strncmp(cmdArg, "reset", 16) == 0)
+		{
+			__disable_irq();
+			perfReset();
+			__enable_irq();
+			printf("Stage counters cleared\n");
+		}
+		else
+		{
+			printf("Unknown option: %s\n", cmdArg);
+		}
+		return;
+	}
+
+	perf_stat_t stats[PerfStageCount];
+	__disable_irq();
+	perfSnapshot(stats);
+	__enable_irq();
+
+	printf("%-12s %10s %10s %10s %10s\n", "stage", "count", "min", "avg", "max");
+	for (size_t i = 0; i < PerfStageCount; i++)
+	{
+		const perf_stat_t *stat = &stats[i];
+		if (stat->count == 0)
+		{
+			continue;
+		}
+
+		printf("%-12s %10lu %10lu %10lu %10lu\n", perfStageName((PerfStage)i), (unsigned long)stat->count,
+			   (unsigned long)stat->min, (unsigned long)(stat->total / stat->count), (unsigned long)stat->max);
+
+		// Power-of-two buckets, labelled by their lower bound in cycles
+		printf("%-12s", "");
+		for (size_t bin = 0; bin < PERF_HISTOGRAM_BINS; bin++)
+		{
+			if (stat->histogram[bin])
+			{
+				const unsigned long lowerBound = bin ? (1ul << (bin + PERF_HISTOGRAM_SHIFT - 1)) : 0;
+				printf(" %lu+:%lu", lowerBound, (unsigned long)stat->histogram[bin]);
+			}
+		}
+		printf("\n");
+	}
+
+	// Whichever engine is running
+	const perf_stat_t *total = stats[PerfConvolve].count ? &stats[PerfConvolve] : &stats[PerfMix];
+	if (total->count)
+	{
+		// Each call covers one partition, a fraction of an audio library block with sub-block partitions
+		const float32_t blockCycles = (float32_t)F_CPU_ACTUAL * PartitionSize / AUDIO_SAMPLE_RATE_EXACT;
+		const uint32_t averageLoad = (uint32_t)(100.0f * (float32_t)(total->total / total->count) / blockCycles);
+		const uint32_t peakLoad = (uint32_t)(100.0f * (float32_t)total->max / blockCycles);
+		printf("Block budget: %lu cycles, average load %lu%%, peak load %lu%%\n", (unsigned long)blockCycles,
+			   (unsigned long)averageLoad, (unsigned long)peakLoad);
+	}
+}
+
+void Ash::overload(void *)
+{
+	char *cmdArg = NULL;
+	if (getArg(&cmdArg))
+	{
+		if (strncmp(cmdArg, "reset", 16) == 0)
+		{
+			__disable_irq();
+			overloadReset();
+			__enable_irq();
+			printf("Overload counters cleared\n");
+		}
+		else
+		{
+			printf("Unknown option: %s\n", cmdArg);
+		}
+		return;
+	}
+
+	overload_stats_t stats;
+	__disable_irq();
+	overloadStats(&stats);
+	__enable_irq();
+
+	if (stats.budget == 0)
+	{
+		printf("Overload shedding is off, 'toggle shedding' to turn it on\n");
+	}
+	else
+	{
+		printf("Budget: %lu cycles per block, shedding at %u%%, restoring under %u%% for %u blocks\n", (unsigned long)stats.budget,
+			   UPOLS_OVERLOAD_SHED_PERCENT, UPOLS_OVERLOAD_RESTORE_PERCENT, UPOLS_OVERLOAD_HOLD_BLOCKS);
+		printf("Level: %u of %u, convolving %u/%u of each filter, peak level %u\n", stats.level, OverloadMaxLevel,
+			   OverloadSteps - stats.level, OverloadSteps, stats.peakLevel);
+		printf("Blocks: %lu, over budget: %lu, peak %lu cycles\n", (unsigned long)stats.blocks, (unsigned long)stats.overruns,
+			   (unsigned long)stats.peakCycles);
+		printf("Levels shed: %lu, restored: %lu\n", (unsigned long)stats.sheds, (unsigned long)stats.restores);
+	}
+	printf("Input blocks dropped: %lu\n", (unsigned long)convolvIR.droppedBlocks());
+}
+
 void Ash::reboot(void *)
 {
 	printf("Auricle Rebooting\n");
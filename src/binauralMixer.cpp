@@ -0,0 +1,162 @@
+/**
+ * @file binauralMixer.cpp
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Multi-source binaural mixer for the Teensy Audio Library
+ * @version 0.1
+ * @date 2021-12-10
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ */
+
+#include "binauralMixer.h"
+
+static_assert(AUDIO_BLOCK_SAMPLES % PartitionSize == 0, "UPOLS_PARTITION_SIZE must divide AUDIO_BLOCK_SAMPLES");
+
+audio_block_t *BinauralMixer::pendingSources[];
+audio_block_t *BinauralMixer::pendingOutput[];
+audio_block_t *BinauralMixer::processedOutput[];
+
+/**
+ * @brief Construct a new BinauralMixer object with one mono input per source and a binaural stereo output.
+ * Sources stay silent until they're given an angle.
+ *
+ */
+BinauralMixer::BinauralMixer(void) : AudioStream(SourceCount, inputQueueArray)
+{
+	attachInterruptVector((IRQ_NUMBER_t)MixIRQ, mixISR);
+	NVIC_SET_PRIORITY(MixIRQ, MixPriority);
+	NVIC_ENABLE_IRQ(MixIRQ);
+}
+
+/**
+ * @brief Move a source to the HRIR pair at irIndex, crossfading to it on the following block
+ *
+ * @param source Index of the source, the input it's connected to
+ * @param irIndex Index of the HRIR pair, one per 3.6 degrees of azimuth
+ * @return Returns false if the HRIR pair isn't available or another source is still switching, leaving the
+ * current filters in place
+ */
+bool BinauralMixer::setAngle(uint8_t source, uint16_t irIndex)
+{
+	return setSourceAngle(source, irIndex);
+}
+
+/**
+ * @brief Updates every AUDIO_BLOCK_SAMPLES samples, 2.9 ms by default. Like ConvolvIR, blocks are only handed
+ * off here and the mix runs in mixISR(), so the mixed audio is transmitted one update later.
+ *
+ */
+void BinauralMixer::update(void)
+{
+	audio_block_t *sourceAudio[SourceCount];
+	for (size_t s = 0; s < SourceCount; s++)
+	{
+		sourceAudio[s] = receiveReadOnly(s);
+	}
+
+	// mixISR() can't preempt this, so the hand-off buffers are stable for the rest of the update
+	audio_block_t *leftProcessed = processedOutput[LeftChannel];
+	audio_block_t *rightProcessed = processedOutput[RightChannel];
+	processedOutput[LeftChannel] = nullptr;
+	processedOutput[RightChannel] = nullptr;
+
+	audio_block_t *leftOutput = nullptr;
+	audio_block_t *rightOutput = nullptr;
+	if (pendingOutput[LeftChannel] == nullptr) // Previous block has been mixed
+	{
+		leftOutput = allocate();
+		rightOutput = allocate();
+	}
+
+	if (leftOutput && rightOutput)
+	{
+		for (size_t s = 0; s < SourceCount; s++)
+		{
+			pendingSources[s] = sourceAudio[s];
+		}
+		pendingOutput[LeftChannel] = leftOutput;
+		pendingOutput[RightChannel] = rightOutput;
+		NVIC_SET_PENDING(MixIRQ);
+	}
+	else // Mix overran the block period or the audio memory ran out, drop the new blocks
+	{
+		for (size_t s = 0; s < SourceCount; s++)
+		{
+			if (sourceAudio[s])
+			{
+				release(sourceAudio[s]);
+			}
+		}
+		if (leftOutput)
+		{
+			release(leftOutput);
+		}
+		if (rightOutput)
+		{
+			release(rightOutput);
+		}
+	}
+
+	if (leftProcessed && rightProcessed)
+	{
+		transmit(leftProcessed, LeftChannel);
+		transmit(rightProcessed, RightChannel);
+		release(leftProcessed);
+		release(rightProcessed);
+	}
+}
+
+/**
+ * @brief Mix the blocks handed off by update(). Runs below the priority of every audio, USB and DMA
+ * interrupt, so only the hand-off itself is done with interrupts disabled.
+ *
+ */
+void BinauralMixer::mixISR(void)
+{
+	// update() won't touch the pending blocks until they're cleared below
+	audio_block_t *leftOutput = pendingOutput[LeftChannel];
+	audio_block_t *rightOutput = pendingOutput[RightChannel];
+
+	if (!leftOutput || !rightOutput)
+	{
+		return;
+	}
+
+	// Blocks hold a whole number of partitions, mixed one after the other
+	for (size_t offset = 0; offset < AUDIO_BLOCK_SAMPLES; offset += PartitionSize)
+	{
+		const int16_t *sourceAudio[SourceCount];
+		for (size_t s = 0; s < SourceCount; s++)
+		{
+			sourceAudio[s] = pendingSources[s] ? &pendingSources[s]->data[offset] : nullptr;
+		}
+
+		mixSources(sourceAudio, &leftOutput->data[offset], &rightOutput->data[offset]);
+	}
+
+	for (size_t s = 0; s < SourceCount; s++)
+	{
+		if (pendingSources[s])
+		{
+			release(pendingSources[s]);
+			pendingSources[s] = nullptr;
+		}
+	}
+
+	__disable_irq();
+	audio_block_t *leftStale = processedOutput[LeftChannel];
+	audio_block_t *rightStale = processedOutput[RightChannel];
+	processedOutput[LeftChannel] = leftOutput;
+	processedOutput[RightChannel] = rightOutput;
+	pendingOutput[LeftChannel] = nullptr;
+	pendingOutput[RightChannel] = nullptr;
+	__enable_irq();
+
+	// Only happens if update() skipped a period, the older block is dropped
+	if (leftStale && rightStale)
+	{
+		release(leftStale);
+		release(rightStale);
+	}
+}
@@ -11,6 +11,14 @@
 
 #include "convolvIR.h"
 
+static_assert(AUDIO_BLOCK_SAMPLES % PartitionSize == 0, "UPOLS_PARTITION_SIZE must divide AUDIO_BLOCK_SAMPLES");
+
+audio_block_t *ConvolvIR::pendingAudio[];
+audio_block_t *ConvolvIR::processedAudio[];
+bool ConvolvIR::processedDirect;
+uint32_t ConvolvIR::dropped;
+SpdifTx *ConvolvIR::q23Sink;
+
 // #pragma GCC optimize ("O1")
 
 /**
@@ -22,17 +30,55 @@ ConvolvIR::ConvolvIR(void) : AudioStream(2, inputQueueArray)
 	_section_dma static audio_block_t allocatedAudioMemory[16];
 	initialize_memory(allocatedAudioMemory, 16);
 	audioPassthrough = true;
+	lazyUpdates = false;
+	q23Output = nullptr;
+	shedding = false;
+	toggleShedding();
 	pinMode(33, 1);
+
+	attachInterruptVector((IRQ_NUMBER_t)ConvolveIRQ, convolveISR);
+	NVIC_SET_PRIORITY(ConvolveIRQ, ConvolvePriority);
+	NVIC_ENABLE_IRQ(ConvolveIRQ);
 }
 
-void ConvolvIR::convertIR(uint16_t irIndex)
+/**
+ * @brief Steer the convolution to any azimuth, rendered with the blend of the two neighbouring HRIR pairs.
+ * Returns straight away, the blend is prepared a few partitions per block and crossfaded in once complete.
+ * Next to a gap in the compiled-in table the one neighbouring pair there is gets used on its own.
+ * 
+ * @param degrees Azimuth in degrees, wrapped into [0, 360)
+ * @return Returns false if neither neighbouring HRIR pair is available, leaving the current filters in place
+ */
+bool ConvolvIR::setAngle(float32_t degrees)
 {
-	audioMute = true;
-	digitalWriteFast(33, 1);
-	processFilters(irIndex);
-	digitalWriteFast(33, 0);
-	audioMute = false;
-	audioPassthrough = false;
+	const float32_t wrapped = fmodf(fmodf(degrees, 360.0f) + 360.0f, 360.0f);
+	const float32_t position = wrapped * AngleCount / 360.0f;
+	const uint16_t irIndex = (uint16_t)position % AngleCount;
+
+	const float32_t fraction = position - floorf(position);
+	bool irLoaded = lazyUpdates ? updateFilters(irIndex, fraction) : interpolateFilters(irIndex, fraction);
+	if (irLoaded)
+	{
+		audioPassthrough = false;
+	}
+	return irLoaded;
+}
+
+/**
+ * @brief Switch the convolution over to a filter set transformed elsewhere, such as a measurement loaded by
+ * HrtfLoader, crossfading to it on the following block
+ * 
+ * @param spectra Half-spectra of every partition, laid out like the precomputed bank
+ * @return Returns false if the engine can't take precomputed spectra, leaving the current filters in place
+ */
+bool ConvolvIR::loadSpectra(const float32_t *spectra)
+{
+	bool irLoaded = loadFilterSpectra(spectra);
+	if (irLoaded)
+	{
+		audioPassthrough = false;
+	}
+	return irLoaded;
 }
 
 bool ConvolvIR::togglePassthrough(void)
@@ -42,19 +88,98 @@ bool ConvolvIR::togglePassthrough(void)
 }
 
 /**
- * @brief Updates every 128 samples / 2.9 ms
+ * @brief Switch between preparing whole filter sets and crossfading them in, and updating the running set a
+ * few partitions per block. Lazy updates never spike the convolution's CPU load, at the cost of the tail
+ * lagging the direct sound by a few blocks.
  * 
+ * @return Returns true if lazy updates are now enabled
  */
-void ConvolvIR::update(void)
+bool ConvolvIR::toggleLazyUpdates(void)
 {
-	if (audioMute)
-	{
-		return;
-	}
+	lazyUpdates = !lazyUpdates;
+	return lazyUpdates;
+}
+
+/**
+ * @brief Whether a new angle would go live without abandoning the last one. Lazy updates start on the head
+ * partitions every time, so they always do. Otherwise a new angle restarts the preparation of the whole set.
+ * 
+ * @return Returns true if setAngle() can be called now
+ */
+bool ConvolvIR::acceptsAngle(void)
+{
+	return lazyUpdates || filtersSettled();
+}
+
+/**
+ * @brief Send the convolution's output to a transmitter at 24 bits, written straight into its DMA buffer
+ * instead of being rounded to 16 bits and queued as audio library blocks. This also takes a block out of the
+ * output latency. Anything else connected to the outputs stops receiving audio while it's enabled.
+ * 
+ * @param output Transmitter to write into
+ */
+void ConvolvIR::attachQ23Output(SpdifTx *output)
+{
+	q23Output = output;
+	q23Sink = output;
+}
+
+/**
+ * @brief Switch between the attached 24-bit output and the 16-bit output connections
+ * 
+ * @return Returns true if the output is now 24-bit
+ */
+bool ConvolvIR::toggleQ23Output(void)
+{
+	q23Sink = q23Sink ? nullptr : q23Output;
+	return q23Sink != nullptr;
+}
+
+/**
+ * @brief Switch the overload monitor on or off. While it's on, every convolve() call has the CPU cycles of one
+ * partition's worth of samples, and filter tails are shed from the MAC as the convolution gets close to that.
+ * 
+ * @return Returns true if the monitor is now shedding
+ */
+bool ConvolvIR::toggleShedding(void)
+{
+	shedding = !shedding;
+	const uint32_t budget = shedding ? (uint32_t)((float32_t)F_CPU_ACTUAL * PartitionSize / AUDIO_SAMPLE_RATE_EXACT) : 0;
+
+	__disable_irq();
+	setCycleBudget(budget);
+	__enable_irq();
+	return shedding;
+}
+
+/**
+ * @brief Number of input blocks update() has dropped because the previous one was still being convolved
+ * 
+ */
+uint32_t ConvolvIR::droppedBlocks(void)
+{
+	return dropped;
+}
 
+/**
+ * @brief Updates every AUDIO_BLOCK_SAMPLES samples, 2.9 ms by default. Blocks are only handed off here, the
+ * convolution itself runs in convolveISR() so USB and S/PDIF DMA interrupts are never held off by it. Convolved
+ * audio is transmitted one update later, adding a block of latency, unless it was written straight into the
+ * S/PDIF buffer.
+ * 
+ */
+void ConvolvIR::update(void)
+{
 	audio_block_t *leftAudio = receiveWritable(LeftChannel);
 	audio_block_t *rightAudio = receiveWritable(RightChannel);
 
+	// convolveISR() can't preempt this, so the hand-off buffers are stable for the rest of the update
+	audio_block_t *leftProcessed = processedAudio[LeftChannel];
+	audio_block_t *rightProcessed = processedAudio[RightChannel];
+	const bool transmitted = processedDirect;
+	processedAudio[LeftChannel] = nullptr;
+	processedAudio[RightChannel] = nullptr;
+
 	if (leftAudio && rightAudio) // Data available on both the left and right channels
 	{
 		if (audioPassthrough) // Not messing with the data, just sending it through the pipe
@@ -63,25 +188,89 @@ void ConvolvIR::update(void)
 			transmit(rightAudio, RightChannel);
 			release(leftAudio);
 			release(rightAudio);
-			return;
 		}
-		else
+		else if (pendingAudio[LeftChannel] == nullptr) // Previous block has been convolved
 		{
-			__disable_irq();
-
-			digitalWriteFast(33, 1);
-			convolve(leftAudio->data, rightAudio->data);
-			digitalWriteFast(33, 0);
+			pendingAudio[LeftChannel] = leftAudio;
+			pendingAudio[RightChannel] = rightAudio;
+			NVIC_SET_PENDING(ConvolveIRQ);
+		}
+		else // Convolution overran the block period, drop the new block
+		{
+			dropped++;
+			release(leftAudio);
+			release(rightAudio);
+		}
+	}
 
+	if (leftProcessed && rightProcessed)
+	{
+		// Only the input is left in the blocks if the output went straight to the transmitter
+		if (!audioPassthrough && !transmitted)
+		{
 			// Transmit left and right audio to the output
-			transmit(leftAudio, LeftChannel);
-			transmit(rightAudio, RightChannel);
+			transmit(leftProcessed, LeftChannel);
+			transmit(rightProcessed, RightChannel);
+		}
+		release(leftProcessed);
+		release(rightProcessed);
+	}
+}
 
-			release(leftAudio);
-			release(rightAudio);
+/**
+ * @brief Convolve the blocks handed off by update(). Runs below the priority of every audio, USB and DMA
+ * interrupt, so only the hand-off itself is done with interrupts disabled.
+ * 
+ */
+void ConvolvIR::convolveISR(void)
+{
+	// update() won't touch the pending blocks until they're cleared below
+	audio_block_t *leftAudio = pendingAudio[LeftChannel];
+	audio_block_t *rightAudio = pendingAudio[RightChannel];
 
-			// Re-enable interrupts
-			__enable_irq();
+	if (!leftAudio || !rightAudio)
+	{
+		return;
+	}
+
+	// Falls back to the 16-bit blocks until the transmitter's first DMA interrupt
+	SpdifTx *sink = q23Sink;
+	uint32_t period = 0;
+	int32_t *txHalf = sink ? sink->claimTxHalf(&period) : nullptr;
+
+	// Blocks hold a whole number of partitions, convolved one after the other
+	digitalWriteFast(33, 1);
+	for (size_t offset = 0; offset < AUDIO_BLOCK_SAMPLES; offset += PartitionSize)
+	{
+		if (txHalf)
+		{
+			convolveInterleaved(&leftAudio->data[offset], &rightAudio->data[offset], &txHalf[2 * offset]);
+		}
+		else
+		{
+			convolve(&leftAudio->data[offset], &rightAudio->data[offset]);
 		}
 	}
+	if (txHalf)
+	{
+		sink->releaseTxHalf(txHalf, period);
+	}
+	digitalWriteFast(33, 0);
+
+	__disable_irq();
+	audio_block_t *leftStale = processedAudio[LeftChannel];
+	audio_block_t *rightStale = processedAudio[RightChannel];
+	processedAudio[LeftChannel] = leftAudio;
+	processedAudio[RightChannel] = rightAudio;
+	processedDirect = (txHalf != nullptr);
+	pendingAudio[LeftChannel] = nullptr;
+	pendingAudio[RightChannel] = nullptr;
+	__enable_irq();
+
+	// Only happens if update() skipped a period, the older block is dropped
+	if (leftStale && rightStale)
+	{
+		release(leftStale);
+		release(rightStale);
+	}
 }
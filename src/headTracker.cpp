@@ -0,0 +1,67 @@
+/**
+ * @file headTracker.cpp
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief USB MIDI head-tracker input, steering the convolution without going through the shell
+ * @version 0.1
+ * @date 2021-12-18
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ */
+
+#include "headTracker.h"
+
+HeadTracker::HeadTracker(void)
+{
+	azimuth = 0.0f;
+	elevation = 0.0f;
+	pending = false;
+	messageCount = 0;
+	appliedCount = 0;
+}
+
+/**
+ * @brief Drain the USB MIDI receive queue and apply the newest orientation, call from the main loop. The
+ * USB interrupt only queues packets, so decoding here never competes with the audio interrupts.
+ *
+ */
+void HeadTracker::poll(void)
+{
+	for (size_t i = 0; i < MessagesPerPoll && usbMIDI.read(); i++)
+	{
+		if (usbMIDI.getType() != usbMIDI.PitchBend)
+		{
+			continue;
+		}
+
+		const int32_t bend = (int32_t)(usbMIDI.getData1() | (usbMIDI.getData2() << 7)) - BendCenter;
+		if (usbMIDI.getChannel() == AzimuthChannel)
+		{
+			azimuth = 180.0f * bend / BendCenter;
+		}
+		else if (usbMIDI.getChannel() == ElevationChannel)
+		{
+			elevation = 90.0f * bend / (BendCenter - 1);
+		}
+		else
+		{
+			continue;
+		}
+		messageCount++;
+		pending = true;
+	}
+
+	if (!pending || !convolvIR.acceptsAngle())
+	{
+		return;
+	}
+
+	// A loaded dataset covers elevation too, the compiled-in HRIRs are azimuth only
+	uint16_t measurement;
+	const float32_t *spectra = hrtfLoader.loaded() ? hrtfLoader.nearest(azimuth, elevation, &measurement) : nullptr;
+	if (spectra ? convolvIR.loadSpectra(spectra) : convolvIR.setAngle(azimuth))
+	{
+		appliedCount++;
+	}
+	pending = false;
+}
@@ -0,0 +1,305 @@
+/**
+ * @file hrtfLoader.cpp
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Background loader for HRTF datasets on the SD card, cached as spectra in PSRAM
+ * @version 0.1
+ * @date 2021-12-12
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ */
+
+#include "hrtfLoader.h"
+
+// Transformed measurements, PSRAM isn't initialized at startup and is only read once a measurement is loaded
+_section_extmem static float32_t spectrumCache[HRTF_CACHE_BYTES / (4 * ImpulseSamples * sizeof(float32_t))][4 * ImpulseSamples];
+
+HrtfLoader::HrtfLoader(void)
+{
+	state = Idle;
+	measurementCount = 0;
+	cachedCount = 0;
+	loadedCount = 0;
+}
+
+/**
+ * @brief Open a dataset and start loading it in the background, replacing whatever was loaded before.
+ * Measurements become selectable one by one as poll() gets through them.
+ *
+ * @param path Path of the .hrir file on the SD card
+ * @return Returns false if the card or the dataset can't be read
+ */
+bool HrtfLoader::begin(const char *path)
+{
+	if (dataset)
+	{
+		dataset.close();
+	}
+	if (cache)
+	{
+		cache.close();
+	}
+	measurementCount = 0;
+	cachedCount = 0;
+	loadedCount = 0;
+	nextPartition = 0;
+
+	if (!SD.begin(BUILTIN_SDCARD))
+	{
+		fail("no SD card");
+		return false;
+	}
+
+	dataset = SD.open(path, FILE_READ);
+	if (!dataset)
+	{
+		fail("can't open dataset");
+		return false;
+	}
+
+	hrir_header_t header;
+	if (dataset.read(&header, sizeof(header)) != sizeof(header) || memcmp(header.magic, "HRIR", 4) || header.version != HrirVersion)
+	{
+		fail("not an .hrir dataset");
+		return false;
+	}
+	if (header.partitionSize != PartitionSize)
+	{
+		fail("partition size doesn't match UPOLS_PARTITION_SIZE, rerun tools/sofaHRIR.py");
+		return false;
+	}
+	if (header.sampleRate != (uint32_t)lrintf(AUDIO_SAMPLE_RATE_EXACT) && header.sampleRate != 44100)
+	{
+		fail("sample rate doesn't match the audio library");
+		return false;
+	}
+
+	// Only as many measurements as there is populated PSRAM for
+	const uint32_t psramSets = (uint32_t)external_psram_size * 1024 * 1024 / (SetFloats * sizeof(float32_t));
+	measurementCount = header.measurementCount;
+	cachedCount = (uint16_t)min(min((uint32_t)measurementCount, (uint32_t)CacheSets), psramSets);
+	if (cachedCount == 0)
+	{
+		fail("no PSRAM");
+		return false;
+	}
+
+	for (size_t m = 0; m < measurementCount; m++)
+	{
+		float32_t direction[2];
+		if (dataset.read(direction, sizeof(direction)) != sizeof(direction))
+		{
+			fail("truncated dataset");
+			return false;
+		}
+		if (m < cachedCount)
+		{
+			directions[m][0] = direction[0];
+			directions[m][1] = direction[1];
+		}
+	}
+	taps = header.taps;
+	tapsOffset = dataset.position();
+
+	// Spectra live next to the dataset, same name with the extension swapped
+	strncpy(cachePath, path, PathLength - 5);
+	cachePath[PathLength - 5] = '\0';
+	char *extension = strrchr(cachePath, '.');
+	strcpy(extension ? extension : cachePath + strlen(cachePath), ".spc");
+
+	cacheHit = openCache(dataset.size());
+	state = cacheHit ? StreamingSpectra : TransformingTaps;
+	return true;
+}
+
+/**
+ * @brief Open the .spc next to the dataset if it holds spectra for exactly this dataset and geometry,
+ * otherwise start writing a new one
+ *
+ * @param sourceBytes Size of the .hrir file
+ * @return Returns true if the spectra can be streamed straight from the cache
+ */
+bool HrtfLoader::openCache(uint32_t sourceBytes)
+{
+	const spc_header_t expected = {{'H', 'S', 'P', 'C'}, HrirVersion, measurementCount, PartitionSize, PartitionCount, sourceBytes};
+
+	cache = SD.open(cachePath, FILE_READ);
+	if (cache)
+	{
+		spc_header_t header;
+		if (cache.read(&header, sizeof(header)) == sizeof(header) && memcmp(&header, &expected, sizeof(header)) == 0 &&
+			cache.size() >= sizeof(header) + (uint64_t)cachedCount * SetFloats * sizeof(float32_t))
+		{
+			return true;
+		}
+		cache.close();
+	}
+
+	// A cache that can't be written only means the next boot transforms the dataset again
+	SD.remove(cachePath);
+	cache = SD.open(cachePath, FILE_WRITE);
+	cacheWritable = cache && cache.write((const uint8_t *)&expected, sizeof(expected)) == sizeof(expected);
+	return false;
+}
+
+/**
+ * @brief Load the next few partitions, call from the main loop. The audio interrupts keep running
+ * throughout, this only ever competes with the shell.
+ *
+ */
+void HrtfLoader::poll(void)
+{
+	if (state == TransformingTaps)
+	{
+		transformStep();
+	}
+	else if (state == StreamingSpectra)
+	{
+		streamStep();
+	}
+
+	if (state == Complete)
+	{
+		dataset.close();
+		if (cache)
+		{
+			cache.close();
+		}
+	}
+}
+
+/**
+ * @brief Read, transform, and cache PartitionsPerPoll partitions of taps. Taps past the end of a
+ * measurement are zero, taps past the filter length are skipped.
+ *
+ */
+void HrtfLoader::transformStep(void)
+{
+	const uint32_t storedPartitions = (taps + PartitionSize - 1) / PartitionSize;
+	float32_t partitionTaps[2 * PartitionSize];
+
+	for (size_t i = 0; i < PartitionsPerPoll && loadedCount < cachedCount; i++)
+	{
+		if (nextPartition == 0)
+		{
+			const uint64_t offset = tapsOffset + (uint64_t)loadedCount * storedPartitions * sizeof(partitionTaps);
+			if (!dataset.seek(offset))
+			{
+				fail("truncated dataset");
+				return;
+			}
+		}
+
+		if (nextPartition < storedPartitions)
+		{
+			if (dataset.read(partitionTaps, sizeof(partitionTaps)) != sizeof(partitionTaps))
+			{
+				fail("truncated dataset");
+				return;
+			}
+		}
+		else
+		{
+			memset(partitionTaps, 0, sizeof(partitionTaps));
+		}
+
+		float32_t *spectra = &spectrumCache[loadedCount][SpectraLength * nextPartition];
+		transformPartition(&partitionTaps[0], &partitionTaps[PartitionSize], PartitionSize, CFFT_F32(FFTLength), spectra);
+
+		if (cacheWritable)
+		{
+			cacheWritable = cache.write((const uint8_t *)spectra, SpectraLength * sizeof(float32_t)) == SpectraLength * sizeof(float32_t);
+		}
+
+		if (++nextPartition == PartitionCount)
+		{
+			nextPartition = 0;
+			loadedCount++;
+		}
+	}
+
+	if (loadedCount == cachedCount)
+	{
+		state = Complete;
+	}
+}
+
+/**
+ * @brief Copy PartitionsPerPoll partitions of spectra from the .spc into PSRAM
+ *
+ */
+void HrtfLoader::streamStep(void)
+{
+	for (size_t i = 0; i < PartitionsPerPoll && loadedCount < cachedCount; i++)
+	{
+		float32_t *spectra = &spectrumCache[loadedCount][SpectraLength * nextPartition];
+		if (cache.read(spectra, SpectraLength * sizeof(float32_t)) != SpectraLength * sizeof(float32_t))
+		{
+			fail("truncated spectrum cache");
+			SD.remove(cachePath);
+			return;
+		}
+
+		if (++nextPartition == PartitionCount)
+		{
+			nextPartition = 0;
+			loadedCount++;
+		}
+	}
+
+	if (loadedCount == cachedCount)
+	{
+		state = Complete;
+	}
+}
+
+/**
+ * @brief Find the loaded measurement closest to a direction, by great-circle distance
+ *
+ * @param azimuth Azimuth in degrees
+ * @param elevation Elevation in degrees
+ * @param measurement Index of the measurement found
+ * @return Pointer to its spectra, ready for loadFilterSpectra(), or nullptr if nothing is loaded yet
+ */
+const float32_t *HrtfLoader::nearest(float32_t azimuth, float32_t elevation, uint16_t *measurement)
+{
+	const float32_t radians = PI / 180.0f;
+	const float32_t x = cosf(elevation * radians) * cosf(azimuth * radians);
+	const float32_t y = cosf(elevation * radians) * sinf(azimuth * radians);
+	const float32_t z = sinf(elevation * radians);
+
+	const float32_t *closest = nullptr;
+	float32_t closestCosine = -2.0f;
+	for (size_t m = 0; m < loadedCount; m++)
+	{
+		const float32_t cosine = cosf(directions[m][1] * radians) * (x * cosf(directions[m][0] * radians) + y * sinf(directions[m][0] * radians)) +
+								 z * sinf(directions[m][1] * radians);
+		if (cosine > closestCosine)
+		{
+			closestCosine = cosine;
+			closest = spectrumCache[m];
+			*measurement = (uint16_t)m;
+		}
+	}
+	return closest;
+}
+
+void HrtfLoader::fail(const char *reason)
+{
+	state = Failed;
+	printf("HRTF loader: %s\n", reason);
+	if (dataset)
+	{
+		dataset.close();
+	}
+	if (cache)
+	{
+		cache.close();
+	}
+}
+
+const char *HrtfLoader::stateName(void)
+{
+	const char *names[] = {"idle", "transforming", "streaming spectra", "complete", "failed"};
+	return names[state];
+}
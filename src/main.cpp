@@ -13,6 +13,8 @@
 #include "auricle.h"
 #include "spdifTx.h"
 #include "ash.h"
+#include "hrtfLoader.h"
+#include "headTracker.h"
 
 AudioInputUSB usbAudioIn;
 SpdifTx spdifOut;
@@ -23,12 +25,15 @@ AudioConnection rightInConv(usbAudioIn, rightChannel, convolvIR, rightChannel);
 AudioConnection leftOutConv(convolvIR, leftChannel, spdifOut, leftChannel);
 AudioConnection rightOutConv(convolvIR, rightChannel, spdifOut, rightChannel);
 
+HrtfLoader hrtfLoader;
+HeadTracker headTracker;
 Ash ash;
 
 usb_serial_class *stdStream = &SerialUSB;
 
 int main(void)
 {
+	convolvIR.attachQ23Output(&spdifOut);
 	stdStream->begin(115200);
 	
 	while (!(stdStream))
@@ -41,6 +46,8 @@ int main(void)
 	while (1)
 	{
 		ash.execLoop();
+		hrtfLoader.poll();
+		headTracker.poll();
 	}
 	
 	return EXIT_SUCCESS;
@@ -11,12 +11,39 @@
 
 #include "spdifTx.h"
 
-// S/PDIF transmit buffer
-_section_dma_aligned static int32_t fifoTx[512];
+static_assert(AUDIO_BLOCK_SAMPLES % 4 == 0, "spdifInterleave() is unrolled by 4 samples");
+
+// S/PDIF transmit buffer, sized by AUDIO_BLOCK_SAMPLES so the DMA interrupts once per audio library update
+_section_dma_aligned static int32_t fifoTx[4 * AUDIO_BLOCK_SAMPLES];
 _section_dma_aligned static audio_block_t silentAudio;
 
-audio_block_t *SpdifTx::leftAudioBuffer[];
-audio_block_t *SpdifTx::rightAudioBuffer[];
+static_assert((SPDIF_QUEUE_DEPTH & (SPDIF_QUEUE_DEPTH - 1)) == 0, "SPDIF_QUEUE_DEPTH must be a power of two");
+static_assert(SPDIF_QUEUE_PREFILL >= 1 && SPDIF_QUEUE_PREFILL <= SPDIF_QUEUE_DEPTH, "SPDIF_QUEUE_PREFILL must be within the queue");
+
+audio_block_t *SpdifTx::queuedAudio[][2];
+volatile uint32_t SpdifTx::queueHead;
+volatile uint32_t SpdifTx::queueTail;
+bool SpdifTx::queuePlaying;
+volatile uint32_t SpdifTx::peakFill;
+volatile uint32_t SpdifTx::underruns;
+volatile uint32_t SpdifTx::overruns;
+
+volatile SpdifTx::DriftMode SpdifTx::drift;
+float SpdifTx::smoothedFill;
+float SpdifTx::driftIntegral;
+volatile float SpdifTx::driftPpm;
+volatile float SpdifTx::pllTrimPpm;
+volatile float SpdifTx::resamplePpm;
+uint32_t SpdifTx::pllNum;
+
+volatile bool SpdifTx::resampling;
+float SpdifTx::resampleHistory[][3];
+float SpdifTx::resamplePhase;
+audio_block_t *SpdifTx::resampledAudio[];
+size_t SpdifTx::resampledCount;
+int32_t *volatile SpdifTx::txHalf;
+volatile uint32_t SpdifTx::txPeriods;
+uint32_t SpdifTx::lateHalves;
 
 DMAChannel SpdifTx::eDMA(false);
 
@@ -54,11 +81,16 @@ void SpdifTx::init(void)
 	memset(&silentAudio, 0, sizeof(silentAudio));
 	memset(inputQueueArray, 0, sizeof(inputQueueArray));
 
-	for (size_t i = 0; i < 2; i++)
-	{
-		leftAudioBuffer[i] = nullptr;
-		rightAudioBuffer[i] = nullptr;
-	}
+	memset(queuedAudio, 0, sizeof(queuedAudio));
+	queueHead = 0;
+	queueTail = 0;
+	queuePlaying = false;
+	resetQueueStats();
+	resampledAudio[0] = nullptr;
+	resampledAudio[1] = nullptr;
+	resetDrift(DriftTrimPll);
+	txHalf = nullptr;
+	txPeriods = 0;
 }
 
 /**
@@ -68,35 +100,49 @@ void SpdifTx::init(void)
  */
 void SpdifTx::dmaISR(void)
 {
-	int32_t txOffset = getTxOffset((uint32_t)&fifoTx[0], 1024);
+	int32_t txOffset = getTxOffset((uint32_t)&fifoTx[0], TxHalfBytes);
 
 	// Clear Interrupt Request Register (pg 138)
 	DMA_CINT = eDMA.channel; // Disable interrupt request for this DMA channel
 
 	int32_t *txBaseAddress = &fifoTx[0] + txOffset;
 
-	audio_block_t *leftAudio = (leftAudioBuffer[0]) ?: &silentAudio;
-	audio_block_t *rightAudio = (rightAudioBuffer[0]) ?: &silentAudio;
+	const uint32_t tail = queueTail;
+	const uint32_t fill = queueHead - tail;
+	if (!queuePlaying && fill >= SPDIF_QUEUE_PREFILL)
+	{
+		queuePlaying = true;
+	}
+	else if (queuePlaying && fill == 0)
+	{
+		queuePlaying = false;
+		underruns++;
+	}
+	trackDrift(fill);
+
+	audio_block_t *leftAudio = queuePlaying ? queuedAudio[tail % SPDIF_QUEUE_DEPTH][leftChannel] : &silentAudio;
+	audio_block_t *rightAudio = queuePlaying ? queuedAudio[tail % SPDIF_QUEUE_DEPTH][rightChannel] : &silentAudio;
 
+	// Silence unless a block is queued, a direct writer overwrites it before the half is played
 	spdifInterleave(txBaseAddress, (const int16_t *)(leftAudio->data), (const int16_t *)(rightAudio->data));
-	arm_dcache_flush_delete(txBaseAddress, 1024);
+	arm_dcache_flush_delete(txBaseAddress, TxHalfBytes);
+
+	txHalf = txBaseAddress;
+	txPeriods++;
 
-	if (leftAudio != &silentAudio && rightAudio != &silentAudio)
+	if (queuePlaying)
 	{
 		release(leftAudio);
 		release(rightAudio);
-
-		leftAudioBuffer[0] = leftAudioBuffer[1];
-		leftAudioBuffer[1] = nullptr;
-		rightAudioBuffer[0] = rightAudioBuffer[1];
-		rightAudioBuffer[1] = nullptr;
+		queueTail = tail + 1;
 	}
 
 	update_all();
 }
 
 /**
- * @brief
+ * @brief Queue the incoming blocks for dmaISR(). Nothing is locked, dmaISR() can preempt this at any point
+ * but only ever frees slots.
  *
  */
 void SpdifTx::update(void)
@@ -104,57 +150,280 @@ void SpdifTx::update(void)
 	audio_block_t *leftAudio = receiveReadOnly(leftChannel);
 	audio_block_t *rightAudio = receiveReadOnly(rightChannel);
 
-	__disable_irq()
-
 	if (leftAudio && rightAudio)
 	{
-		// Doing buffer packing in a loop is too slow, has to be done like this
-		// Left channel switcheroo
-		if (leftAudioBuffer[0] == nullptr)
+		if (resampling)
 		{
-			leftAudioBuffer[0] = leftAudio;
-			leftAudio = nullptr;
+			// Only read, the resampled blocks are queued as they fill
+			resample(leftAudio, rightAudio);
 		}
-		else if (leftAudioBuffer[1] == nullptr)
+		else if (queueBlock(leftAudio, rightAudio))
+		{
+			return;
+		}
+	}
+
+	if (leftAudio)
+	{
+		release(leftAudio);
+	}
+	if (rightAudio)
+	{
+		release(rightAudio);
+	}
+}
+
+/**
+ * @brief Queue a pair of blocks for dmaISR(), only called from update()
+ *
+ * @return Returns false if the queue is full, the blocks are left to the caller
+ */
+bool SpdifTx::queueBlock(audio_block_t *leftAudio, audio_block_t *rightAudio)
+{
+	const uint32_t head = queueHead;
+	const uint32_t fill = head - queueTail;
+	if (fill == SPDIF_QUEUE_DEPTH)
+	{
+		// Dropping the newest block keeps the tail dmaISR()'s alone
+		overruns++;
+		return false;
+	}
+
+	queuedAudio[head % SPDIF_QUEUE_DEPTH][leftChannel] = leftAudio;
+	queuedAudio[head % SPDIF_QUEUE_DEPTH][rightChannel] = rightAudio;
+	queueHead = head + 1; // Published only once the slot is filled
+
+	if (fill + 1 > peakFill)
+	{
+		peakFill = fill + 1;
+	}
+	return true;
+}
+
+/**
+ * @brief Follow the source's clock by holding the queue at SPDIF_QUEUE_PREFILL blocks, called by every dmaISR().
+ * A source running fast fills the queue, so the loop speeds the S/PDIF clock up by trimming the audio PLL's
+ * numerator, and resamples whatever is beyond the trim range.
+ *
+ * @param fill Blocks queued when the DMA interrupt fired
+ */
+void SpdifTx::trackDrift(uint32_t fill)
+{
+	// Nothing to follow while the queue isn't playing, such as when the output is written directly
+	if (drift == DriftFixed || !queuePlaying)
+	{
+		return;
+	}
+
+	// Proportional gain in ppm per 128 samples of error, integral gain in ppm per 128 samples of error every
+	// 128 samples. Settles in around a minute with a damping of 0.7, slow enough that the fill's steps don't
+	// wobble the pitch. Scaled so smaller blocks, and their more frequent interrupts, keep the same response.
+	const float blockScale = AUDIO_BLOCK_SAMPLES / 128.0f;
+	const float proportionalGain = 700.0f * blockScale;
+	const float integralGain = 0.25f * blockScale * blockScale;
+	const float range = SPDIF_DRIFT_RANGE_PPM;
+
+	// One step of the numerator, 24 MHz / SPDIF_PLL_DENOM against the 677 MHz the PLL runs at
+	const float pllPpmPerStep = 1e6f / ((float)SPDIF_LOOP_DIV * SPDIF_PLL_DENOM + SPDIF_PLL_NUM);
+
+	smoothedFill += ((float)fill - smoothedFill) / (1 << DriftSmoothingShift);
+	const float error = smoothedFill - SPDIF_QUEUE_PREFILL;
+	driftIntegral = fminf(fmaxf(driftIntegral + integralGain * error, -range), range);
+	const float ppm = fminf(fmaxf(proportionalGain * error + driftIntegral, -range), range);
+
+	float trimPpm = 0.0f;
+	if (drift == DriftTrimPll)
+	{
+		// The integral term dithers between neighbouring numerators, so the quantization isn't resampled
+		const int32_t steps = (int32_t)lrintf(fminf(fmaxf(ppm, -SPDIF_PLL_TRIM_PPM), SPDIF_PLL_TRIM_PPM) / pllPpmPerStep);
+		if (pllNum != (uint32_t)(SPDIF_PLL_NUM + steps))
+		{
+			pllNum = SPDIF_PLL_NUM + steps;
+			CCM_ANALOG_PLL_AUDIO_NUM = CCM_ANALOG_PLL_AUDIO_NUM_MASK & pllNum;
+		}
+		trimPpm = steps * pllPpmPerStep;
+	}
+
+	driftPpm = ppm;
+	pllTrimPpm = trimPpm;
+	resamplePpm = (drift == DriftTrimPll) ? ppm - fminf(fmaxf(ppm, -SPDIF_PLL_TRIM_PPM), SPDIF_PLL_TRIM_PPM) : ppm;
+	if (resamplePpm != 0.0f)
+	{
+		resampling = true;
+	}
+}
+
+/**
+ * @brief Resample a pair of input blocks by resamplePpm with 4-point cubic Hermite interpolation, queueing
+ * output blocks as they fill. Output samples are dropped while there's no audio memory for them.
+ *
+ */
+void SpdifTx::resample(const audio_block_t *leftAudio, const audio_block_t *rightAudio)
+{
+	const audio_block_t *input[2] = {leftAudio, rightAudio};
+	const float step = 1.0f + resamplePpm * 1e-6f; // Input samples per output sample
+
+	float phase = resamplePhase;
+	while (phase < AUDIO_BLOCK_SAMPLES)
+	{
+		if (resampledCount == 0)
 		{
-			leftAudioBuffer[1] = leftAudio;
-			leftAudio = nullptr;
+			resampledAudio[leftChannel] = allocate();
+			resampledAudio[rightChannel] = allocate();
 		}
-		else
+
+		// Input index k is the previous block's last three samples for k < 3, then the current block
+		const size_t i = (size_t)phase;
+		const float t = phase - i;
+		for (size_t channel = 0; channel < 2; channel++)
 		{
-			audio_block_t *shiftTemp = leftAudioBuffer[0];
-			leftAudioBuffer[0] = leftAudioBuffer[1];
-			leftAudioBuffer[1] = leftAudio;
-			leftAudio = shiftTemp;
+			float x[4];
+			for (size_t k = 0; k < 4; k++)
+			{
+				x[k] = (i + k < 3) ? resampleHistory[channel][i + k] : input[channel]->data[i + k - 3];
+			}
+
+			const float c1 = 0.5f * (x[2] - x[0]);
+			const float c2 = x[0] - 2.5f * x[1] + 2.0f * x[2] - 0.5f * x[3];
+			const float c3 = 0.5f * (x[3] - x[0]) + 1.5f * (x[1] - x[2]);
+			const float y = ((c3 * t + c2) * t + c1) * t + x[1];
+
+			if (resampledAudio[channel])
+			{
+				resampledAudio[channel]->data[resampledCount] = (int16_t)lrintf(fminf(fmaxf(y, -32768.0f), 32767.0f));
+			}
 		}
+		phase += step;
 
-		// Right channel switcheroo
-		if (rightAudioBuffer[0] == nullptr)
+		if (++resampledCount == AUDIO_BLOCK_SAMPLES)
 		{
-			rightAudioBuffer[0] = rightAudio;
-			rightAudio = nullptr;
+			if (!resampledAudio[leftChannel] || !resampledAudio[rightChannel] || !queueBlock(resampledAudio[leftChannel], resampledAudio[rightChannel]))
+			{
+				if (resampledAudio[leftChannel])
+				{
+					release(resampledAudio[leftChannel]);
+				}
+				if (resampledAudio[rightChannel])
+				{
+					release(resampledAudio[rightChannel]);
+				}
+			}
+			resampledAudio[leftChannel] = nullptr;
+			resampledAudio[rightChannel] = nullptr;
+			resampledCount = 0;
 		}
-		else if (rightAudioBuffer[1] == nullptr)
+	}
+	resamplePhase = phase - AUDIO_BLOCK_SAMPLES;
+
+	for (size_t channel = 0; channel < 2; channel++)
+	{
+		for (size_t k = 0; k < 3; k++)
 		{
-			rightAudioBuffer[1] = rightAudio;
-			rightAudio = nullptr;
+			resampleHistory[channel][k] = input[channel]->data[AUDIO_BLOCK_SAMPLES - 3 + k];
 		}
-		else
+	}
+}
+
+/**
+ * @brief Choose how the output follows the source's clock. The loop starts over from the nominal clock, and
+ * any samples waiting in the resampler are dropped.
+ *
+ * @param mode How drift is followed
+ */
+void SpdifTx::setDriftMode(DriftMode mode)
+{
+	__disable_irq()
+	resetDrift(mode);
+	__enable_irq()
+}
+
+void SpdifTx::resetDrift(DriftMode mode)
+{
+	drift = mode;
+	smoothedFill = SPDIF_QUEUE_PREFILL;
+	driftIntegral = 0.0f;
+	driftPpm = 0.0f;
+	pllTrimPpm = 0.0f;
+	resamplePpm = 0.0f;
+	pllNum = SPDIF_PLL_NUM;
+	CCM_ANALOG_PLL_AUDIO_NUM = CCM_ANALOG_PLL_AUDIO_NUM_MASK & pllNum;
+
+	resampling = false;
+	resamplePhase = 0.0f;
+	memset(resampleHistory, 0, sizeof(resampleHistory));
+	for (size_t channel = 0; channel < 2; channel++)
+	{
+		if (resampledAudio[channel])
 		{
-			audio_block_t *shiftTemp = rightAudioBuffer[0];
-			rightAudioBuffer[0] = rightAudioBuffer[1];
-			rightAudioBuffer[1] = rightAudio;
-			rightAudio = shiftTemp;
+			release(resampledAudio[channel]);
+			resampledAudio[channel] = nullptr;
 		}
 	}
+	resampledCount = 0;
+}
 
+/**
+ * @brief Snapshot of the queue between update() and dmaISR()
+ *
+ * @param stats Filled with the queue's depth, fill, and counters
+ */
+void SpdifTx::queueStats(spdif_queue_stats_t *stats)
+{
+	stats->depth = SPDIF_QUEUE_DEPTH;
+	stats->fill = queueHead - queueTail;
+	stats->peakFill = peakFill;
+	stats->underruns = underruns;
+	stats->overruns = overruns;
+	stats->lateWrites = lateHalves;
+	stats->driftPpm = driftPpm;
+	stats->pllTrimPpm = pllTrimPpm;
+	stats->resamplePpm = resamplePpm;
+}
+
+void SpdifTx::resetQueueStats(void)
+{
+	__disable_irq()
+	peakFill = queueHead - queueTail;
+	underruns = 0;
+	overruns = 0;
+	lateHalves = 0;
 	__enable_irq()
+}
 
-	if (leftAudio && rightAudio)
+/**
+ * @brief Claim the half of the transmit buffer that was just refilled, for writing interleaved 24-bit samples
+ * straight into it. It's played from the next DMA interrupt, so the write has one block period to finish.
+ *
+ * @param period Set to the DMA interrupt the half was claimed in, pass it back to releaseTxHalf()
+ * @return Pointer to 2 * AUDIO_BLOCK_SAMPLES words, left channel first, or nullptr before the first interrupt
+ */
+int32_t *SpdifTx::claimTxHalf(uint32_t *period)
+{
+	__disable_irq()
+	int32_t *claimed = txHalf;
+	*period = txPeriods;
+	__enable_irq()
+
+	return claimed;
+}
+
+/**
+ * @brief Hand a claimed half back to the DMA once it's been written
+ *
+ * @param claimed Half returned by claimTxHalf()
+ * @param period Period returned by claimTxHalf()
+ * @return Returns false if the half had already started playing, the block went out partly written
+ */
+bool SpdifTx::releaseTxHalf(int32_t *claimed, uint32_t period)
+{
+	arm_dcache_flush_delete(claimed, TxHalfBytes);
+
+	if (txPeriods != period)
 	{
-		release(leftAudio);
-		release(rightAudio);
+		lateHalves++;
+		return false;
 	}
+	return true;
 }
 
 /**
@@ -166,7 +435,7 @@ void SpdifTx::update(void)
  */
 inline int32_t SpdifTx::getTxOffset(uint32_t txSourceAddress, uint32_t sourceBufferSize)
 {
-	return ((uint32_t)(eDMA.TCD->SADDR) < txSourceAddress + sourceBufferSize) ? 0x0100 : 0x0000;
+	return ((uint32_t)(eDMA.TCD->SADDR) < txSourceAddress + sourceBufferSize) ? TxHalfWords : 0x0000;
 }
 
 /**
@@ -184,7 +453,7 @@ inline void SpdifTx::spdifInterleave(int32_t *pTx, const int16_t *leftAudioData,
 	// Ideally:
 	//		pTx[2*i + 0] = 0x00LLLL00 with LLLL being leftAudioData[i]
 	//		pTx[2*i + 1] = 0x00RRRR00 with RRRR being rightAudioData[i]
-	for (size_t i = 0; i < 128; i += 4)
+	for (size_t i = 0; i < AUDIO_BLOCK_SAMPLES; i += 4)
 	{
 		pTx[2 * i] = leftAudioData[i] << 8;
 		pTx[2 * i + 1] = rightAudioData[i] << 8;
@@ -226,7 +495,7 @@ uint8_t SpdifTx::configureDMA(void)
 		DMA_TCD_NBYTES_MLOFFYES_NBYTES(8);	// Transfer 8 bytes for each service request
 
 	// TCD Last Source Address Adjustment (pg 163)
-	eDMA.TCD->SLAST = -2048; // 2048 bytes to move SADDR back to &fifoTx[0]
+	eDMA.TCD->SLAST = -2 * TxHalfBytes; // Both halves to move SADDR back to &fifoTx[0]
 
 	// TCD Destination Address (pg 164)
 	eDMA.TCD->DADDR = &SPDIF_STL; // DMA channel destination address is audio data transmission register for the left SPDIF channel
@@ -235,13 +504,13 @@ uint8_t SpdifTx::configureDMA(void)
 	eDMA.TCD->DOFF = 4; // int32_t => 4 bytes
 
 	// TCD Current Minor Loop Link, Major Loop Count (pg 165)
-	eDMA.TCD->CITER_ELINKNO = 256; // Must be equal to BITER
+	eDMA.TCD->CITER_ELINKNO = TxHalfWords; // Must be equal to BITER
 
 	// TCD Last Destination Address Adjustment/Scatter Gather Address (pg 168)
 	eDMA.TCD->DLASTSGA = -8; // 8 bytes to move DADDR back to &SPDIF_STL
 
 	// TCD Beginning Minor Loop Link, Major Loop Count (pg 171)
-	eDMA.TCD->BITER_ELINKNO = 256; //
+	eDMA.TCD->BITER_ELINKNO = TxHalfWords; // One left and right pair per minor loop, both halves per major loop
 
 	// TCD Control and Status (pg 169)
 	eDMA.TCD->CSR =
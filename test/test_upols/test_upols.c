@@ -0,0 +1,1143 @@
+/**
+ * @file test_upols.c
+ * @author Jason Conway (jpc@jasonconway.dev)
+ * @brief Host-side golden-reference tests and kernel benchmarks for upols and math512, run with pio test -e native
+ * @version 0.1
+ * @date 2021-12-06
+ *
+ * @copyright Copyright (c) 2021 Jason Conway. All rights reserved.
+ *
+ */
+
+#include <unity.h>
+#include "upols.h"
+#include "mathq15.h"
+#include "binaural.h"
+#include "overload.h"
+#include "fft.h"
+#ifdef UPOLS_REVERB
+#include "reverb.h"
+#endif
+
+
+enum Bench
+{
+	BenchBlocks = 2000,		// Blocks convolved by the throughput benchmark
+	KernelIterations = 100000, // Calls made to each math512 kernel
+	FFTIterations = 20000,	   // Transforms made by each FFT benchmark
+};
+
+// Allowed deviation from the double-precision reference, Q15 spectra trade a little accuracy for memory
+#ifndef UPOLS_FIXED
+#define MAX_ERROR_LSB 2.0
+#define MAX_Q23_ERROR_LSB 0.25
+#else
+#define MAX_ERROR_LSB 4.0
+#define MAX_Q23_ERROR_LSB MAX_ERROR_LSB
+#endif
+
+// A filter length of input is enough for every tier to be running on the new filter
+#define SETTLE_BLOCKS (ImpulseSamples / PartitionSize)
+#define COMPARE_BLOCKS (2 * ImpulseSamples / PartitionSize)
+#define STREAM_SAMPLES ((SETTLE_BLOCKS + COMPARE_BLOCKS) * PartitionSize)
+
+// The shipped table only has the one live pair, tests of angle changes load HRIR pairs of their own
+#define SYNTHETIC_PAIRS (SourceSetCount + 1) // One more than the mixer's pool can hold at once
+
+static int16_t leftInput[STREAM_SAMPLES];
+static int16_t rightInput[STREAM_SAMPLES];
+static float32_t syntheticTable[SYNTHETIC_PAIRS][2 * TableImpulseSamples];
+static bool syntheticLoaded;
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+	// Back to the compiled-in table, even if the test failed part way
+	if (syntheticLoaded)
+	{
+		TEST_ASSERT_TRUE(loadHrirTable(NULL, 0));
+		syntheticLoaded = false;
+	}
+}
+
+static uint64_t nanoseconds(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * @brief Fill both input channels with uncorrelated noise. The level leaves enough headroom that the
+ * reference never needs to saturate
+ *
+ */
+static void generateInput(void)
+{
+	srand(1);
+	for (size_t i = 0; i < STREAM_SAMPLES; i++)
+	{
+		leftInput[i] = (int16_t)((rand() % 20000) - 10000);
+		rightInput[i] = (int16_t)((rand() % 20000) - 10000);
+	}
+}
+
+/**
+ * @brief Taps of an HRIR pair as the engine sees them, left then right, decoded once if the table is packed
+ *
+ */
+static const float32_t *referencePair(const uint16_t irIndex)
+{
+	static float32_t *pairs[AngleCount];
+	if (!pairs[irIndex])
+	{
+		pairs[irIndex] = malloc(2 * TableImpulseSamples * sizeof(float32_t));
+		TEST_ASSERT_TRUE(hrirTaps(irIndex, 0, TableImpulseSamples, pairs[irIndex], pairs[irIndex] + TableImpulseSamples));
+	}
+	return pairs[irIndex];
+}
+
+/**
+ * @brief Serve SYNTHETIC_PAIRS HRIR pairs that really differ in place of the compiled-in table until the test
+ * ends. Every channel is decaying noise of its own behind an onset delay of its own, over the whole filter
+ * length so every partition is audible, and quiet enough for the outputs not to clip.
+ *
+ */
+static void loadSyntheticPairs(void)
+{
+	srand(2);
+	for (size_t pair = 0; pair < SYNTHETIC_PAIRS; pair++)
+	{
+		for (size_t channel = 0; channel < 2; channel++)
+		{
+			float32_t *taps = &syntheticTable[pair][TableImpulseSamples * channel];
+			const size_t onset = 4 * pair + 2 * channel;
+			for (size_t k = 0; k < TableImpulseSamples; k++)
+			{
+				const float32_t noise = (float32_t)rand() / (float32_t)RAND_MAX - 0.5f;
+				taps[k] = (k < onset) ? 0.0f : 0.05f * noise * expf(-(float32_t)(k - onset) / (ImpulseSamples / 4));
+			}
+		}
+	}
+	TEST_ASSERT_TRUE(loadHrirTable(syntheticTable[0], SYNTHETIC_PAIRS));
+	syntheticLoaded = true;
+}
+
+/**
+ * @brief Direct time-domain convolution of one output sample, in double precision
+ *
+ */
+static double directConvolution(const float32_t *impulse, const int16_t *input, const size_t t)
+{
+	double y = 0.0;
+	for (size_t k = 0; k < ImpulseSamples && k <= t; k++)
+	{
+		y += (double)impulse[k] * (double)input[t - k];
+	}
+	return y;
+}
+
+/**
+ * @brief Direct convolution of one output sample of each ear with an HRIR pair. Four-path builds place the left
+ * speaker with the pair, the mirrored right speaker reaches each ear through the other ear's filter
+ *
+ */
+static void pairConvolution(const float32_t *leftImpulse, const float32_t *rightImpulse, const int16_t *leftStream, const int16_t *rightStream,
+							const size_t t, double *left, double *right)
+{
+#ifndef UPOLS_FOUR_PATH
+	*left = directConvolution(leftImpulse, leftStream, t);
+	*right = directConvolution(rightImpulse, rightStream, t);
+#else
+	*left = directConvolution(leftImpulse, leftStream, t) + directConvolution(rightImpulse, rightStream, t);
+	*right = directConvolution(rightImpulse, leftStream, t) + directConvolution(leftImpulse, rightStream, t);
+#endif
+}
+
+/**
+ * @brief Stream the test input through convolve() and compare every block after SETTLE_BLOCKS with
+ * the direct convolution
+ *
+ * @return Largest error on either channel in LSB
+ */
+static double convolveError(const float32_t *leftImpulse, const float32_t *rightImpulse)
+{
+	double maxError = 0.0;
+	for (size_t block = 0; block < SETTLE_BLOCKS + COMPARE_BLOCKS; block++)
+	{
+		int16_t leftAudio[PartitionSize];
+		int16_t rightAudio[PartitionSize];
+		memcpy(leftAudio, &leftInput[PartitionSize * block], sizeof(leftAudio));
+		memcpy(rightAudio, &rightInput[PartitionSize * block], sizeof(rightAudio));
+
+		convolve(leftAudio, rightAudio);
+
+		if (block < SETTLE_BLOCKS)
+		{
+			continue;
+		}
+
+		for (size_t i = 0; i < PartitionSize; i++)
+		{
+			double left;
+			double right;
+			pairConvolution(leftImpulse, rightImpulse, leftInput, rightInput, PartitionSize * block + i, &left, &right);
+			maxError = fmax(maxError, fmax(fabs(left - leftAudio[i]), fabs(right - rightAudio[i])));
+		}
+	}
+	return maxError;
+}
+
+/**
+ * @brief convolve() must match the direct convolution of every compiled-in HRIR pair once the crossfade to it
+ * has finished and the whole filter is running on the new set
+ *
+ */
+static void test_convolve_matches_direct_convolution(void)
+{
+	generateInput();
+
+	uint16_t irIndex = 0;
+	for (; processFilters(irIndex); irIndex++)
+	{
+		const float32_t *leftImpulse = referencePair(irIndex);
+		const float32_t *rightImpulse = leftImpulse + TableImpulseSamples;
+
+		const double maxError = convolveError(leftImpulse, rightImpulse);
+		printf("HRIR %u: max error %.2f LSB\n", irIndex, maxError);
+		TEST_ASSERT_TRUE(maxError <= MAX_ERROR_LSB);
+	}
+
+	TEST_ASSERT_TRUE_MESSAGE(irIndex > 0, "No HRIR pairs compiled in");
+	TEST_ASSERT_FALSE(processFilters(irIndex));
+}
+
+/**
+ * @brief Angles revisited after test_convolve_matches_direct_convolution() must come out of the filter
+ * set cache, and the cached sets must still convolve correctly
+ *
+ */
+static void test_filter_cache_serves_revisited_angles(void)
+{
+	generateInput();
+
+	filter_cache_stats_t before;
+	filterCacheStats(&before);
+	const uint16_t revisits = (before.sets < 2) ? before.sets : 2;
+	TEST_ASSERT_TRUE_MESSAGE(revisits > 0, "Nothing cached by the earlier tests");
+
+	// The most recently transformed pairs are the ones still cached
+	const uint16_t irCount = hrirCount();
+
+	for (uint16_t irIndex = irCount - revisits; irIndex < irCount; irIndex++)
+	{
+		TEST_ASSERT_TRUE(processFilters(irIndex));
+		const float32_t *leftImpulse = referencePair(irIndex);
+		const double maxError = convolveError(leftImpulse, leftImpulse + TableImpulseSamples);
+		printf("Cached HRIR %u: max error %.2f LSB\n", irIndex, maxError);
+		TEST_ASSERT_TRUE(maxError <= MAX_ERROR_LSB);
+	}
+
+	filter_cache_stats_t after;
+	filterCacheStats(&after);
+	TEST_ASSERT_EQUAL_UINT32(before.hits + revisits, after.hits);
+	TEST_ASSERT_EQUAL_UINT32(before.misses, after.misses);
+}
+
+/**
+ * @brief Stream the test input through convolve() until the last filter change has gone fully live
+ *
+ */
+static void settleFilters(void)
+{
+	for (size_t block = 0; !filtersSettled(); block++)
+	{
+		TEST_ASSERT_TRUE(block < SETTLE_BLOCKS);
+		int16_t leftAudio[PartitionSize];
+		int16_t rightAudio[PartitionSize];
+		memcpy(leftAudio, &leftInput[PartitionSize * block], sizeof(leftAudio));
+		memcpy(rightAudio, &rightInput[PartitionSize * block], sizeof(rightAudio));
+		convolve(leftAudio, rightAudio);
+	}
+}
+
+/**
+ * @brief Turning between grid angles the way ConvolvIR::setAngle() does must fill the filter set cache and
+ * be served from it on the way back, whether the set is crossfaded in or goes live partition by partition
+ *
+ */
+static void test_filter_cache_serves_interpolated_angles(void)
+{
+	generateInput();
+	loadSyntheticPairs();
+
+	filter_cache_stats_t before;
+	filterCacheStats(&before);
+	for (uint16_t irIndex = 0; irIndex < 3; irIndex++)
+	{
+		TEST_ASSERT_TRUE(interpolateFilters(irIndex, 0.0f));
+		settleFilters();
+	}
+
+	// Sets are cached on the change after they finish, the last one goes in on the way back
+	TEST_ASSERT_TRUE(interpolateFilters(0, 0.0f));
+	filter_cache_stats_t after;
+	filterCacheStats(&after);
+	TEST_ASSERT_EQUAL_UINT32(before.hits + 1, after.hits);
+	TEST_ASSERT_EQUAL_UINT32(before.misses + 3, after.misses);
+	TEST_ASSERT_EQUAL_UINT32(3, after.sets);
+
+	double maxError = convolveError(syntheticTable[0], syntheticTable[0] + TableImpulseSamples);
+	TEST_ASSERT_TRUE(updateFilters(1, 0.0f));
+	maxError = fmax(maxError, convolveError(syntheticTable[1], syntheticTable[1] + TableImpulseSamples));
+	filterCacheStats(&after);
+	TEST_ASSERT_EQUAL_UINT32(before.hits + 2, after.hits);
+	TEST_ASSERT_EQUAL_UINT32(before.misses + 3, after.misses);
+
+	printf("Cached grid angles: max error %.2f LSB\n", maxError);
+	TEST_ASSERT_TRUE(maxError <= MAX_ERROR_LSB);
+}
+
+/**
+ * @brief The 24-bit outputs must track the direct convolution to well below a 16-bit LSB, they're only rounded
+ * once. The fixed-point engine's output is still rounded to Q15 first.
+ *
+ */
+static void test_q23_output_matches_direct_convolution(void)
+{
+	generateInput();
+	TEST_ASSERT_TRUE(processFilters(0));
+
+	double maxError = 0.0;
+	for (size_t block = 0; block < SETTLE_BLOCKS + COMPARE_BLOCKS; block++)
+	{
+		int16_t leftAudio[PartitionSize];
+		int16_t rightAudio[PartitionSize];
+		int32_t leftOutput[PartitionSize];
+		int32_t rightOutput[PartitionSize];
+		memcpy(leftAudio, &leftInput[PartitionSize * block], sizeof(leftAudio));
+		memcpy(rightAudio, &rightInput[PartitionSize * block], sizeof(rightAudio));
+
+		if (block % 2)
+		{
+			// Alternate blocks go through the interleaved output, rounded straight out of the inverse FFT
+			int32_t interleavedOutput[2 * PartitionSize];
+			convolveInterleaved(leftAudio, rightAudio, interleavedOutput);
+			for (size_t i = 0; i < PartitionSize; i++)
+			{
+				leftOutput[i] = interleavedOutput[2 * i];
+				rightOutput[i] = interleavedOutput[2 * i + 1];
+			}
+		}
+		else
+		{
+			convolveQ23(leftAudio, rightAudio, leftOutput, rightOutput);
+		}
+
+		if (block < SETTLE_BLOCKS)
+		{
+			continue;
+		}
+
+		for (size_t i = 0; i < PartitionSize; i++)
+		{
+			double left;
+			double right;
+			pairConvolution(referencePair(0), referencePair(0) + TableImpulseSamples, leftInput, rightInput, PartitionSize * block + i, &left, &right);
+			maxError = fmax(maxError, fmax(fabs(left - leftOutput[i] / 256.0), fabs(right - rightOutput[i] / 256.0)));
+		}
+	}
+
+	printf("Q23 output: max error %.3f LSB\n", maxError);
+	TEST_ASSERT_TRUE(maxError <= MAX_Q23_ERROR_LSB);
+}
+
+/**
+ * @brief An interpolated angle must converge on the direct convolution with the blend of the two
+ * neighbouring HRIR pairs, without any call to processFilters()
+ *
+ */
+static void test_interpolation_matches_blended_convolution(void)
+{
+	generateInput();
+	loadSyntheticPairs();
+
+	const float32_t fraction = 0.25f;
+	TEST_ASSERT_TRUE(interpolateFilters(0, fraction));
+
+	static float32_t leftImpulse[ImpulseSamples];
+	static float32_t rightImpulse[ImpulseSamples];
+	const float32_t *lowerPair = syntheticTable[0];
+	const float32_t *upperPair = syntheticTable[1];
+	for (size_t k = 0; k < ImpulseSamples; k++)
+	{
+		leftImpulse[k] = (1.0f - fraction) * lowerPair[k] + fraction * upperPair[k];
+		rightImpulse[k] = (1.0f - fraction) * lowerPair[TableImpulseSamples + k] + fraction * upperPair[TableImpulseSamples + k];
+	}
+
+	TEST_ASSERT_FALSE(filtersSettled());
+	const double maxError = convolveError(leftImpulse, rightImpulse);
+	printf("Interpolated angle: max error %.2f LSB\n", maxError);
+	TEST_ASSERT_TRUE(maxError <= MAX_ERROR_LSB);
+	TEST_ASSERT_TRUE(filtersSettled());
+}
+
+/**
+ * @brief Fractional angles next to a gap in the compiled-in table must land on the one neighbour there is,
+ * from either side, and only fail when both neighbours are missing
+ *
+ */
+static void test_missing_neighbour_snaps_to_available_pair(void)
+{
+	const uint16_t irCount = hrirCount();
+	if (irCount + 2 > AngleCount)
+	{
+		TEST_IGNORE_MESSAGE("Needs a gap of two HRIR pairs in the compiled-in table");
+	}
+
+	generateInput();
+
+	const uint16_t last = irCount - 1;
+	TEST_ASSERT_FALSE(interpolateFilters(irCount, 0.5f));
+	TEST_ASSERT_TRUE(interpolateFilters(AngleCount - 1, 0.75f)); // Lands on pair 0, past the wrap
+	TEST_ASSERT_TRUE(interpolateFilters(last, 0.25f));
+
+	const float32_t *leftImpulse = referencePair(last);
+	const double maxError = convolveError(leftImpulse, leftImpulse + TableImpulseSamples);
+	printf("Missing neighbour: max error %.2f LSB\n", maxError);
+	TEST_ASSERT_TRUE(maxError <= MAX_ERROR_LSB);
+	TEST_ASSERT_TRUE(filtersSettled());
+}
+
+/**
+ * @brief Largest error of a convolved block against the direct convolution, in LSB
+ *
+ */
+static double blockError(const float32_t *leftImpulse, const float32_t *rightImpulse, const size_t block, const int16_t *leftAudio, const int16_t *rightAudio)
+{
+	double maxError = 0.0;
+	for (size_t i = 0; i < PartitionSize; i++)
+	{
+		double left;
+		double right;
+		pairConvolution(leftImpulse, rightImpulse, leftInput, rightInput, PartitionSize * block + i, &left, &right);
+		maxError = fmax(maxError, fmax(fabs(left - leftAudio[i]), fabs(right - rightAudio[i])));
+	}
+	return maxError;
+}
+
+/**
+ * @brief A lazy update must switch the head partitions over within a couple of blocks while the tail is still
+ * on the old pair, then end up on exactly the direct convolution with the new pair once every partition has
+ * gone live
+ *
+ */
+static void test_progressive_update_matches_direct_convolution(void)
+{
+	generateInput();
+	loadSyntheticPairs();
+
+	// The new pair is the old one with a tap added to the first partition and another to the last, so what the
+	// update has switched so far shows up on its own. Nothing has been prepared from the pair yet.
+	const float32_t *oldPair = syntheticTable[0];
+	float32_t *newPair = syntheticTable[1];
+	static float32_t headPair[2 * TableImpulseSamples];
+	memcpy(newPair, oldPair, sizeof(syntheticTable[0]));
+	for (size_t channel = 0; channel < 2; channel++)
+	{
+		newPair[TableImpulseSamples * channel + 3] += 0.25f;
+	}
+	memcpy(headPair, newPair, sizeof(headPair));
+	for (size_t channel = 0; channel < 2; channel++)
+	{
+		newPair[TableImpulseSamples * channel + ImpulseSamples - PartitionSize / 2] += 0.25f;
+	}
+
+	TEST_ASSERT_TRUE(processFilters(0));
+
+	const size_t updateBlock = SETTLE_BLOCKS;
+	const size_t headBlock = updateBlock + 2; // Prepared after the update block, faded in on the next
+	double headError = 0.0;
+	double tailError = 0.0;
+	double maxError = 0.0;
+	for (size_t block = 0; block < SETTLE_BLOCKS + COMPARE_BLOCKS; block++)
+	{
+		int16_t leftAudio[PartitionSize];
+		int16_t rightAudio[PartitionSize];
+		memcpy(leftAudio, &leftInput[PartitionSize * block], sizeof(leftAudio));
+		memcpy(rightAudio, &rightInput[PartitionSize * block], sizeof(rightAudio));
+
+		if (block == updateBlock)
+		{
+			TEST_ASSERT_TRUE(updateFilters(1, 0.0f));
+		}
+
+		convolve(leftAudio, rightAudio);
+
+		if (block == headBlock)
+		{
+			TEST_ASSERT_FALSE(filtersSettled());
+			headError = blockError(headPair, headPair + TableImpulseSamples, block, leftAudio, rightAudio);
+			tailError = blockError(newPair, newPair + TableImpulseSamples, block, leftAudio, rightAudio);
+		}
+		else if (block >= updateBlock + SETTLE_BLOCKS)
+		{
+			maxError = fmax(maxError, blockError(newPair, newPair + TableImpulseSamples, block, leftAudio, rightAudio));
+		}
+	}
+
+	printf("Progressive update: head block %.2f LSB off the new head, %.0f LSB off the new pair, max error %.2f LSB\n", headError, tailError, maxError);
+	TEST_ASSERT_TRUE(headError <= MAX_ERROR_LSB);
+	TEST_ASSERT_TRUE(tailError > 100.0 * MAX_ERROR_LSB);
+	TEST_ASSERT_TRUE(maxError <= MAX_ERROR_LSB);
+	TEST_ASSERT_TRUE(filtersSettled());
+}
+
+#ifdef UPOLS_PACKED_IR
+#include "../../include/tablIR.h"
+
+/**
+ * @brief Every decoded tap must be within a mantissa step of the float32_t it was packed from. A step is 2^-15
+ * of the largest tap of its block, and blocks never straddle partitions, so the partition's peak bounds it
+ *
+ */
+static void test_packed_taps_match_table(void)
+{
+	TEST_ASSERT_EQUAL_UINT32(sizeof(irTable) / (2 * TableImpulseSamples * sizeof(float32_t)), hrirCount());
+
+	for (uint16_t irIndex = 0; irIndex < hrirCount(); irIndex++)
+	{
+		const float32_t *decoded = referencePair(irIndex);
+		const float32_t *table = &irTable[2 * TableImpulseSamples * irIndex];
+		for (size_t partition = 0; partition < 2 * TableImpulseSamples; partition += PartitionSize)
+		{
+			float32_t peak = 0.0f;
+			for (size_t i = partition; i < partition + PartitionSize; i++)
+			{
+				peak = fmaxf(peak, fabsf(table[i]));
+			}
+			for (size_t i = partition; i < partition + PartitionSize; i++)
+			{
+				TEST_ASSERT_TRUE(fabsf(decoded[i] - table[i]) <= peak / 32768.0f);
+			}
+		}
+	}
+}
+#endif
+
+#ifdef UPOLS_REVERB
+/**
+ * @brief With a room response loaded, the output must be the direct convolution with the HRIR pair plus the
+ * room response once its whole length of input has gone through. The response stops short of the bus in the
+ * middle of a partition and is streamed in chunks that straddle partitions, so the staging is covered too.
+ *
+ */
+static void test_reverb_matches_direct_convolution(void)
+{
+	const size_t roomTaps = ReverbImpulseSamples - 3000;
+	const size_t settleBlocks = ReverbImpulseSamples / PartitionSize;
+	const size_t compareBlocks = 2 * ReverbTier2PartitionSize / PartitionSize; // Two groups of the longest tier
+	const size_t streamSamples = (settleBlocks + compareBlocks) * PartitionSize;
+
+	int16_t *input = malloc(2 * streamSamples * sizeof(int16_t));
+	float32_t *room = malloc(2 * roomTaps * sizeof(float32_t));
+	TEST_ASSERT_TRUE(input && room);
+
+	srand(2);
+	for (size_t i = 0; i < 2 * streamSamples; i++)
+	{
+		input[i] = (int16_t)((rand() % 20000) - 10000);
+	}
+	// Decaying noise, 60 dB down after around 2 s
+	for (size_t k = 0; k < 2 * roomTaps; k++)
+	{
+		const float32_t decay = expf(-(float32_t)(k % roomTaps) / 13000.0f);
+		room[k] = 0.005f * decay * (2.0f * (float32_t)rand() / (float32_t)RAND_MAX - 1.0f);
+	}
+	const int16_t *leftStream = input;
+	const int16_t *rightStream = input + streamSamples;
+	const float32_t *leftRoom = room;
+	const float32_t *rightRoom = room + roomTaps;
+
+	TEST_ASSERT_TRUE(processFilters(0));
+	beginReverb(1.0f);
+	for (size_t offset = 0; offset < roomTaps;)
+	{
+		const size_t chunk = (roomTaps - offset < 1000) ? roomTaps - offset : 1000;
+		TEST_ASSERT_EQUAL_UINT32(chunk, addReverbTaps(&leftRoom[offset], &rightRoom[offset], chunk));
+		offset += chunk;
+	}
+	TEST_ASSERT_FALSE(reverbEnabled());
+	TEST_ASSERT_TRUE(finishReverb());
+	TEST_ASSERT_EQUAL_UINT32(roomTaps, reverbTaps());
+
+	const float32_t *pair = referencePair(0);
+	double maxError = 0.0;
+	for (size_t block = 0; block < settleBlocks + compareBlocks; block++)
+	{
+		int16_t leftAudio[PartitionSize];
+		int16_t rightAudio[PartitionSize];
+		memcpy(leftAudio, &leftStream[PartitionSize * block], sizeof(leftAudio));
+		memcpy(rightAudio, &rightStream[PartitionSize * block], sizeof(rightAudio));
+		convolve(leftAudio, rightAudio);
+
+		if (block < settleBlocks)
+		{
+			continue;
+		}
+
+		for (size_t i = 0; i < PartitionSize; i++)
+		{
+			const size_t t = PartitionSize * block + i;
+			double left;
+			double right;
+			pairConvolution(pair, pair + TableImpulseSamples, leftStream, rightStream, t, &left, &right);
+			for (size_t k = 0; k < roomTaps; k++)
+			{
+				left += (double)leftRoom[k] * leftStream[t - k];
+				right += (double)rightRoom[k] * rightStream[t - k];
+			}
+			maxError = fmax(maxError, fmax(fabs(left - leftAudio[i]), fabs(right - rightAudio[i])));
+		}
+	}
+
+	disableReverb();
+	free(input);
+	free(room);
+
+	printf("Room reverb: max error %.2f LSB\n", maxError);
+	TEST_ASSERT_TRUE(maxError <= MAX_ERROR_LSB);
+}
+#endif
+
+/**
+ * @brief A filter whose tail is silent must only convolve its head partition, and still pass a unit impulse
+ * through untouched
+ *
+ */
+static void test_silent_partitions_are_skipped(void)
+{
+	float32_t taps[2 * PartitionSize] = {0};
+	taps[0] = 1.0f;
+	taps[PartitionSize] = 1.0f;
+#ifndef UPOLS_FOUR_PATH
+	static float32_t spectra[4 * ImpulseSamples];
+	transformPartition(&taps[0], &taps[PartitionSize], PartitionSize, CFFT_F32(FFTLength), spectra);
+	const bool loaded = loadFilterSpectra(spectra);
+#else
+	static float32_t spectra[8 * ImpulseSamples]; // Crosstalk paths left silent
+	transformPartition(&taps[0], &taps[PartitionSize], PartitionSize, CFFT_F32(FFTLength), spectra);
+	const bool loaded = loadFourPathSpectra(spectra);
+#endif
+
+	if (!loaded)
+	{
+		TEST_IGNORE_MESSAGE("Needs the uniform partitioning");
+	}
+
+	generateInput();
+	int16_t leftAudio[PartitionSize];
+	int16_t rightAudio[PartitionSize];
+	for (size_t block = 0; block < 2; block++)
+	{
+		memcpy(leftAudio, &leftInput[PartitionSize * block], sizeof(leftAudio));
+		memcpy(rightAudio, &rightInput[PartitionSize * block], sizeof(rightAudio));
+		convolve(leftAudio, rightAudio);
+	}
+
+	size_t partitionCount;
+	TEST_ASSERT_EQUAL_UINT32(1, audiblePartitions(&partitionCount));
+	for (size_t i = 0; i < PartitionSize; i++)
+	{
+		TEST_ASSERT_TRUE(abs(leftAudio[i] - leftInput[PartitionSize + i]) <= 1);
+		TEST_ASSERT_TRUE(abs(rightAudio[i] - rightInput[PartitionSize + i]) <= 1);
+	}
+}
+
+/**
+ * @brief A budget no block can meet must shed down to the first eighth of the filter, one level per block, and
+ * leave exactly the convolution with that eighth. Once the load drops the levels must come back one hold
+ * period apart, ending on the whole filter again
+ *
+ */
+static void test_overload_sheds_and_restores_tail(void)
+{
+#ifdef UPOLS_NONUNIFORM
+	TEST_IGNORE_MESSAGE("Needs the uniform partitioning");
+#endif
+	overload_event_t event;
+	while (overloadEvent(&event))
+	{
+	}
+
+	overload_stats_t stats;
+	overloadStats(&stats);
+	const uint32_t firstBlock = stats.blocks;
+
+	generateInput();
+	TEST_ASSERT_TRUE(processFilters(0));
+	setCycleBudget(1);
+
+	static float32_t leftImpulse[ImpulseSamples];
+	static float32_t rightImpulse[ImpulseSamples];
+	const float32_t *pair = referencePair(0);
+	const size_t keptTaps = ImpulseSamples * (OverloadSteps - OverloadMaxLevel) / OverloadSteps;
+	for (size_t k = 0; k < ImpulseSamples; k++)
+	{
+		leftImpulse[k] = (k < keptTaps) ? pair[k] : 0.0f;
+		rightImpulse[k] = (k < keptTaps) ? pair[TableImpulseSamples + k] : 0.0f;
+	}
+	const double shedError = convolveError(leftImpulse, rightImpulse);
+	printf("Shed to %u taps: max error %.2f LSB\n", (unsigned)keptTaps, shedError);
+	TEST_ASSERT_TRUE(shedError <= MAX_ERROR_LSB);
+
+	for (uint16_t level = 1; level <= OverloadMaxLevel; level++)
+	{
+		TEST_ASSERT_TRUE(overloadEvent(&event));
+		TEST_ASSERT_EQUAL_UINT32(level, event.level);
+		TEST_ASSERT_EQUAL_UINT32(firstBlock + level - 1, event.block);
+	}
+	TEST_ASSERT_FALSE(overloadEvent(&event));
+
+	// Nothing takes any time against this budget
+	setCycleBudget(UINT32_MAX);
+	for (size_t block = 0; block < OverloadMaxLevel * UPOLS_OVERLOAD_HOLD_BLOCKS; block++)
+	{
+		int16_t leftAudio[PartitionSize] = {0};
+		int16_t rightAudio[PartitionSize] = {0};
+		convolve(leftAudio, rightAudio);
+	}
+
+	overloadStats(&stats);
+	TEST_ASSERT_EQUAL_UINT32(0, stats.level);
+	TEST_ASSERT_EQUAL_UINT32(OverloadMaxLevel, stats.peakLevel);
+	TEST_ASSERT_EQUAL_UINT32(OverloadMaxLevel, stats.restores);
+	for (uint16_t level = OverloadMaxLevel; level-- > 0;)
+	{
+		TEST_ASSERT_TRUE(overloadEvent(&event));
+		TEST_ASSERT_EQUAL_UINT32(level, event.level);
+	}
+
+	setCycleBudget(0);
+	const double restoredError = convolveError(pair, pair + TableImpulseSamples);
+	printf("Restored: max error %.2f LSB\n", restoredError);
+	TEST_ASSERT_TRUE(restoredError <= MAX_ERROR_LSB);
+}
+
+/**
+ * @brief Two instances of the instance API run side by side on different HRIR pairs and inputs, each must match
+ * the direct convolution on its own, and a misaligned or short arena must be refused
+ *
+ */
+static void test_instances_match_direct_convolution(void)
+{
+	generateInput();
+
+	const size_t arenaSize = upolsArenaSize();
+	uint8_t *arenas[2] = {aligned_alloc(UPOLS_ARENA_ALIGNMENT, 2 * arenaSize), NULL};
+	TEST_ASSERT_TRUE(arenas[0] != NULL);
+	arenas[1] = arenas[0] + arenaSize;
+
+	upols_instance_t instances[2];
+	TEST_ASSERT_FALSE(upolsInit(&instances[0], arenas[0] + 1, arenaSize));
+	TEST_ASSERT_FALSE(upolsInit(&instances[0], arenas[0], arenaSize - UPOLS_ARENA_ALIGNMENT));
+
+	const uint16_t irIndices[2] = {0, (uint16_t)(hrirCount() - 1)};
+	for (size_t n = 0; n < 2; n++)
+	{
+		TEST_ASSERT_TRUE(upolsInit(&instances[n], arenas[n], arenaSize));
+		TEST_ASSERT_TRUE(upolsSetFilter(&instances[n], irIndices[n]));
+	}
+	TEST_ASSERT_FALSE(upolsSetFilter(&instances[0], hrirCount()));
+
+	// The second instance hears the channels swapped
+	const int16_t *streams[2][2] = {{leftInput, rightInput}, {rightInput, leftInput}};
+	double maxError[2] = {0.0, 0.0};
+	for (size_t block = 0; block < SETTLE_BLOCKS + COMPARE_BLOCKS; block++)
+	{
+		for (size_t n = 0; n < 2; n++)
+		{
+			int16_t leftAudio[PartitionSize];
+			int16_t rightAudio[PartitionSize];
+			memcpy(leftAudio, &streams[n][0][PartitionSize * block], sizeof(leftAudio));
+			memcpy(rightAudio, &streams[n][1][PartitionSize * block], sizeof(rightAudio));
+
+			upolsProcess(&instances[n], leftAudio, rightAudio);
+
+			if (block < SETTLE_BLOCKS)
+			{
+				continue;
+			}
+
+			const float32_t *leftImpulse = referencePair(irIndices[n]);
+			for (size_t i = 0; i < PartitionSize; i++)
+			{
+				double left;
+				double right;
+				pairConvolution(leftImpulse, leftImpulse + TableImpulseSamples, streams[n][0], streams[n][1], PartitionSize * block + i, &left, &right);
+				maxError[n] = fmax(maxError[n], fmax(fabs(left - leftAudio[i]), fabs(right - rightAudio[i])));
+			}
+		}
+	}
+
+	printf("Instances: max error %.2f and %.2f LSB\n", maxError[0], maxError[1]);
+	TEST_ASSERT_TRUE(maxError[0] <= MAX_ERROR_LSB);
+	TEST_ASSERT_TRUE(maxError[1] <= MAX_ERROR_LSB);
+	free(arenas[0]);
+}
+
+/**
+ * @brief With four independent filters loaded, each ear must hear the direct convolution of both inputs with
+ * its own two paths. The crosstalk paths are delayed and scaled copies of the pair so that no two are alike
+ *
+ */
+static void test_four_paths_match_direct_convolution(void)
+{
+	static float32_t paths[4][ImpulseSamples]; // Left-in to left-ear, right-in to right-ear, left-in to right-ear, right-in to left-ear
+	static float32_t spectra[8 * ImpulseSamples];
+	const float32_t *pair = referencePair(0);
+	for (size_t k = 0; k < ImpulseSamples; k++)
+	{
+		paths[0][k] = pair[k];
+		paths[1][k] = pair[TableImpulseSamples + k];
+		paths[2][k] = (k >= 7) ? 0.5f * pair[TableImpulseSamples + k - 7] : 0.0f;
+		paths[3][k] = (k >= 13) ? -0.25f * pair[k - 13] : 0.0f;
+	}
+	for (size_t j = 0; j < ImpulseSamples / PartitionSize; j++)
+	{
+		const size_t offset = PartitionSize * j;
+		transformPartition(&paths[0][offset], &paths[1][offset], PartitionSize, CFFT_F32(FFTLength), &spectra[8 * offset]);
+		transformPartition(&paths[2][offset], &paths[3][offset], PartitionSize, CFFT_F32(FFTLength), &spectra[8 * offset + SpectraLength]);
+	}
+
+	if (!loadFourPathSpectra(spectra))
+	{
+		TEST_IGNORE_MESSAGE("Needs UPOLS_FOUR_PATH");
+	}
+
+	generateInput();
+	double maxError = 0.0;
+	for (size_t block = 0; block < SETTLE_BLOCKS + COMPARE_BLOCKS; block++)
+	{
+		int16_t leftAudio[PartitionSize];
+		int16_t rightAudio[PartitionSize];
+		memcpy(leftAudio, &leftInput[PartitionSize * block], sizeof(leftAudio));
+		memcpy(rightAudio, &rightInput[PartitionSize * block], sizeof(rightAudio));
+		convolve(leftAudio, rightAudio);
+
+		if (block < SETTLE_BLOCKS)
+		{
+			continue;
+		}
+
+		for (size_t i = 0; i < PartitionSize; i++)
+		{
+			const size_t t = PartitionSize * block + i;
+			const double left = directConvolution(paths[0], leftInput, t) + directConvolution(paths[3], rightInput, t);
+			const double right = directConvolution(paths[2], leftInput, t) + directConvolution(paths[1], rightInput, t);
+			maxError = fmax(maxError, fmax(fabs(left - leftAudio[i]), fabs(right - rightAudio[i])));
+		}
+	}
+
+	printf("Four paths: max error %.2f LSB\n", maxError);
+	TEST_ASSERT_TRUE(maxError <= MAX_ERROR_LSB);
+}
+
+/**
+ * @brief mixSources() must match the sum of every source directly convolved with the truncated HRIR pair of
+ * its own angle, including across angle changes once their crossfades have finished. One source moves onto the
+ * set of another and one onto the spare set, which leaves no set for a third until the crossfades are done.
+ *
+ */
+static void test_mix_matches_direct_convolution(void)
+{
+	generateInput();
+	loadSyntheticPairs();
+
+	// Sources are taken from both input channels at staggered offsets, quiet enough for the mix not to clip
+	uint16_t angles[SourceCount];
+	for (size_t s = 0; s < SourceCount; s++)
+	{
+		angles[s] = (uint16_t)s;
+		TEST_ASSERT_TRUE(setSourceAngle((uint8_t)s, angles[s]));
+	}
+
+	static int16_t sourceInput[SourceCount][STREAM_SAMPLES];
+	for (size_t s = 0; s < SourceCount; s++)
+	{
+		const int16_t *channel = (s & 1) ? rightInput : leftInput;
+		for (size_t t = 0; t < STREAM_SAMPLES; t++)
+		{
+			sourceInput[s][t] = (int16_t)(channel[(t + 977 * s) % STREAM_SAMPLES] / SourceCount);
+		}
+	}
+
+	const size_t changeBlock = SETTLE_BLOCKS + COMPARE_BLOCKS / 2;
+	double maxError = 0.0;
+	for (size_t block = 0; block < SETTLE_BLOCKS + COMPARE_BLOCKS; block++)
+	{
+		if (block == changeBlock)
+		{
+			angles[0] = angles[SourceCount - 1]; // Shares the set of another source
+			angles[1] = SourceCount;			 // Takes the spare set
+			TEST_ASSERT_TRUE(setSourceAngle(0, angles[0]));
+			TEST_ASSERT_TRUE(setSourceAngle(1, angles[1]));
+
+			// Every set is held until the crossfades are done
+			TEST_ASSERT_FALSE(setSourceAngle(2, SourceCount + 1));
+		}
+		else if (block == changeBlock + 1)
+		{
+			angles[2] = SourceCount + 1;
+			TEST_ASSERT_TRUE(setSourceAngle(2, angles[2]));
+		}
+
+		const int16_t *sourceAudio[SourceCount];
+		for (size_t s = 0; s < SourceCount; s++)
+		{
+			sourceAudio[s] = &sourceInput[s][PartitionSize * block];
+		}
+
+		int16_t leftAudio[PartitionSize];
+		int16_t rightAudio[PartitionSize];
+		mixSources(sourceAudio, leftAudio, rightAudio);
+
+		if (block < SETTLE_BLOCKS || block == changeBlock || block == changeBlock + 1)
+		{
+			continue;
+		}
+
+		for (size_t i = 0; i < PartitionSize; i++)
+		{
+			const size_t t = PartitionSize * block + i;
+			double left = 0.0;
+			double right = 0.0;
+			for (size_t s = 0; s < SourceCount; s++)
+			{
+				const float32_t *leftImpulse = syntheticTable[angles[s]];
+				const float32_t *rightImpulse = leftImpulse + TableImpulseSamples;
+				for (size_t k = 0; k < SourceImpulseSamples && k <= t; k++)
+				{
+					left += (double)leftImpulse[k] * sourceInput[s][t - k];
+					right += (double)rightImpulse[k] * sourceInput[s][t - k];
+				}
+			}
+			maxError = fmax(maxError, fmax(fabs(left - leftAudio[i]), fabs(right - rightAudio[i])));
+		}
+	}
+
+	printf("mix of %u sources: max error %.2f LSB\n", (unsigned)SourceCount, maxError);
+	TEST_ASSERT_TRUE(maxError <= 2.0);
+}
+
+/**
+ * @brief The specialised kernel against arm_cfft_f32 in both directions, and the bit-reversed order fftBin() reports
+ *
+ */
+static void test_fft_matches_cmsis(void)
+{
+	static float32_t data[2 * FFTLength];
+	static float32_t reference[2 * FFTLength];
+	for (size_t i = 0; i < 2 * FFTLength; i++)
+	{
+		data[i] = reference[i] = (float32_t)rand() / RAND_MAX - 0.5f;
+	}
+
+	fftForward(data);
+	arm_cfft_f32(CFFT_F32(FFTLength), reference, ForwardFFT, 1);
+	double maxError = 0.0;
+	for (size_t k = 0; k < FFTLength; k++)
+	{
+		maxError = fmax(maxError, fabs(data[2 * fftBin(k)] - reference[2 * k]));
+		maxError = fmax(maxError, fabs(data[2 * fftBin(k) + 1] - reference[2 * k + 1]));
+	}
+	TEST_ASSERT_TRUE(maxError < 1e-5 * FFTLength);
+
+	// The inverse takes the bit-reversed spectrum back, unscaled
+	fftInverse(data);
+	arm_cfft_f32(CFFT_F32(FFTLength), reference, InverseFFT, 1);
+	double maxInverseError = 0.0;
+	for (size_t i = 0; i < 2 * FFTLength; i++)
+	{
+		maxInverseError = fmax(maxInverseError, fabs(data[i] / FFTLength - reference[i]));
+	}
+	printf("fft: forward max error %.2e, inverse max error %.2e\n", maxError, maxInverseError);
+	TEST_ASSERT_TRUE(maxInverseError < 1e-5);
+
+	fftForward(data);
+	fftReorder(data);
+	arm_cfft_f32(CFFT_F32(FFTLength), reference, ForwardFFT, 1);
+	double maxReorderError = 0.0;
+	for (size_t i = 0; i < 2 * FFTLength; i++)
+	{
+		maxReorderError = fmax(maxReorderError, fabs(data[i] / FFTLength - reference[i]));
+	}
+	TEST_ASSERT_TRUE(maxReorderError < 1e-5 * FFTLength);
+}
+
+/**
+ * @brief Throughput of the whole convolution and of every stage accounted by perf.h
+ *
+ */
+static void test_bench_convolve(void)
+{
+	generateInput();
+	TEST_ASSERT_TRUE(processFilters(0));
+	perfReset();
+
+	const uint64_t start = nanoseconds();
+	for (size_t block = 0; block < BenchBlocks; block++)
+	{
+		int16_t leftAudio[PartitionSize];
+		int16_t rightAudio[PartitionSize];
+		const size_t offset = PartitionSize * (block % (STREAM_SAMPLES / PartitionSize));
+		memcpy(leftAudio, &leftInput[offset], sizeof(leftAudio));
+		memcpy(rightAudio, &rightInput[offset], sizeof(rightAudio));
+		convolve(leftAudio, rightAudio);
+	}
+	const uint64_t elapsed = nanoseconds() - start;
+
+	size_t partitionCount;
+	const size_t audible = audiblePartitions(&partitionCount);
+	printf("convolve: %.0f blocks/s, %.0f ns/block, %zu of %zu partitions audible\n", 1e9 * BenchBlocks / (double)elapsed,
+		   (double)elapsed / BenchBlocks, audible, partitionCount);
+
+	perf_stat_t stats[PerfStageCount];
+	perfSnapshot(stats);
+	for (size_t i = 0; i < PerfStageCount; i++)
+	{
+		if (stats[i].count)
+		{
+			printf("  %-12s %10.0f ns avg %10lu ns max\n", perfStageName((enum PerfStage)i),
+				   (double)stats[i].total / stats[i].count, (unsigned long)stats[i].max);
+		}
+	}
+}
+
+/**
+ * @brief Per-call cost of each math512 kernel on a 512 float block, and of its block floating-point counterpart
+ *
+ */
+static void test_bench_math512(void)
+{
+	static float a[512];
+	static float b[512];
+	static float accum[512];
+	static int16_t qa[512];
+	static int16_t qb[512];
+	static int64_t qAccum[512];
+
+	for (size_t i = 0; i < 512; i++)
+	{
+		a[i] = (float)rand() / RAND_MAX;
+		b[i] = (float)rand() / RAND_MAX;
+		qa[i] = (int16_t)(rand() % 65535 - 32767);
+		qb[i] = (int16_t)(rand() % 65535 - 32767);
+	}
+
+	const char *names[] = {"cmac512", "hmac", "cp512", "clear512", "hmacQ15"};
+	for (size_t kernel = 0; kernel < sizeof(names) / sizeof(names[0]); kernel++)
+	{
+		const uint64_t start = nanoseconds();
+		for (size_t i = 0; i < KernelIterations; i++)
+		{
+			switch (kernel)
+			{
+			case 0:
+				cmac512(a, b, accum);
+				break;
+			case 1:
+				hmac(a, b, accum, 128);
+				break;
+			case 2:
+				cp512(a, accum);
+				break;
+			case 3:
+				clear512(accum);
+				break;
+			default:
+				hmacQ15(qa, qb, qAccum, 1, 128);
+			}
+		}
+		const uint64_t elapsed = nanoseconds() - start;
+		printf("%-10s %8.1f ns/call\n", names[kernel], (double)elapsed / KernelIterations);
+	}
+
+	TEST_ASSERT_TRUE(isfinite(accum[0]));
+}
+
+/**
+ * @brief Per-transform cost of the specialised kernel and of arm_cfft_f32 at the head partition length, both
+ * directions, each including a copy of the input. The CMSIS figure includes its bit reversal, the kernel's split
+ * and merge absorb it instead
+ *
+ */
+static void test_bench_fft(void)
+{
+	static float32_t input[2 * FFTLength];
+	static float32_t data[2 * FFTLength];
+	for (size_t i = 0; i < 2 * FFTLength; i++)
+	{
+		input[i] = (float32_t)rand() / RAND_MAX - 0.5f;
+	}
+
+	const char *names[] = {"fftForward", "fftInverse", "cfft_f32", "icfft_f32"};
+	for (size_t kernel = 0; kernel < sizeof(names) / sizeof(names[0]); kernel++)
+	{
+		const uint64_t start = nanoseconds();
+		for (size_t i = 0; i < FFTIterations; i++)
+		{
+			// Fresh input every time, the unscaled transforms would overflow if run back to back
+			memcpy(data, input, sizeof(data));
+			switch (kernel)
+			{
+			case 0:
+				fftForward(data);
+				break;
+			case 1:
+				fftInverse(data);
+				break;
+			case 2:
+				arm_cfft_f32(CFFT_F32(FFTLength), data, ForwardFFT, 1);
+				break;
+			default:
+				arm_cfft_f32(CFFT_F32(FFTLength), data, InverseFFT, 1);
+			}
+		}
+		const uint64_t elapsed = nanoseconds() - start;
+		printf("%-10s %8.1f ns/call (%u points)\n", names[kernel], (double)elapsed / FFTIterations, (unsigned)FFTLength);
+	}
+
+	TEST_ASSERT_TRUE(isfinite(data[0]));
+}
+
+int main(void)
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_convolve_matches_direct_convolution);
+	RUN_TEST(test_filter_cache_serves_revisited_angles);
+	RUN_TEST(test_filter_cache_serves_interpolated_angles);
+	RUN_TEST(test_q23_output_matches_direct_convolution);
+	RUN_TEST(test_interpolation_matches_blended_convolution);
+	RUN_TEST(test_missing_neighbour_snaps_to_available_pair);
+	RUN_TEST(test_progressive_update_matches_direct_convolution);
+#ifdef UPOLS_PACKED_IR
+	RUN_TEST(test_packed_taps_match_table);
+#endif
+#ifdef UPOLS_REVERB
+	RUN_TEST(test_reverb_matches_direct_convolution);
+#endif
+	RUN_TEST(test_silent_partitions_are_skipped);
+	RUN_TEST(test_overload_sheds_and_restores_tail);
+	RUN_TEST(test_instances_match_direct_convolution);
+	RUN_TEST(test_four_paths_match_direct_convolution);
+	RUN_TEST(test_mix_matches_direct_convolution);
+	RUN_TEST(test_fft_matches_cmsis);
+	RUN_TEST(test_bench_convolve);
+	RUN_TEST(test_bench_math512);
+	RUN_TEST(test_bench_fft);
+	return UNITY_END();
+}
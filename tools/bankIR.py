@@ -0,0 +1,193 @@
+"""
+bankIR.py - Precompute the partitioned HRTF spectra for every HRIR in tablIR.h
+
+Generates include/bankIR.h, a table of already-transformed filter partitions laid
+out exactly like filters_t in lib/upols/upols.c: for each partition, the left then
+right half-spectrum, each starting with the real DC and Nyquist bins followed by
+bins 1 to N - 1. Selecting an angle on the device then becomes a copy out of flash
+instead of PartitionCount forward FFTs.
+
+Runs automatically as a PlatformIO pre-build script and only regenerates the bank
+when tablIR.h or upols.h are newer than the existing output, or when the partition
+geometry selected by UPOLS_PARTITION_SIZE / UPOLS_PARTITION_COUNT has changed. Can also be run by
+hand from the project root: python tools/bankIR.py
+"""
+
+import cmath
+import os
+import re
+import struct
+import sys
+
+try:
+    Import("env")  # noqa: F821 - provided by PlatformIO / SCons
+    PROJECT_DIR = env.subst("$PROJECT_DIR")  # noqa: F821
+    CPPDEFINES = env.get("CPPDEFINES", [])  # noqa: F821
+except NameError:
+    PROJECT_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    CPPDEFINES = []
+
+TABLE_PATH = os.path.join(PROJECT_DIR, "include", "tablIR.h")
+UPOLS_PATH = os.path.join(PROJECT_DIR, "lib", "upols", "upols.h")
+BANK_PATH = os.path.join(PROJECT_DIR, "include", "bankIR.h")
+SCRIPT_PATH = os.path.join(PROJECT_DIR, "tools", "bankIR.py")
+
+
+def read_define(source, name):
+    """Resolve a geometry macro, a -D from build_flags wins over the default in upols.h"""
+    for define in CPPDEFINES:
+        if isinstance(define, (list, tuple)) and define[0] == name:
+            return int(define[1])
+    match = re.search(r"#define\s+" + name + r"\s+(\d+)", source)
+    if not match:
+        sys.exit("bankIR.py: could not find %s in %s" % (name, UPOLS_PATH))
+    return int(match.group(1))
+
+
+def read_enum(source, name):
+    """Pull an integer enumerator out of upols.h so the geometry is never duplicated"""
+    match = re.search(r"\b" + name + r"\s*=\s*(\d+)", source)
+    if not match:
+        sys.exit("bankIR.py: could not find %s in %s" % (name, UPOLS_PATH))
+    return int(match.group(1))
+
+
+def read_geometry():
+    with open(UPOLS_PATH, "r") as f:
+        upols = f.read()
+    partition_size = read_define(upols, "UPOLS_PARTITION_SIZE")
+    partition_count = read_define(upols, "UPOLS_PARTITION_COUNT")
+    table_samples = read_enum(upols, "TableImpulseSamples")
+    return partition_size, partition_count, table_samples
+
+
+def read_table(path):
+    """Return the float32 taps of irTable, ignoring entries that are commented out"""
+    with open(path, "r") as f:
+        source = f.read()
+    source = re.sub(r"/\*.*?\*/", "", source, flags=re.S)
+    source = re.sub(r"//[^\n]*", "", source)
+    match = re.search(r"irTable\s*\[\s*\]\s*=\s*\{(.*?)\}", source, flags=re.S)
+    if not match:
+        sys.exit("bankIR.py: irTable not found in %s" % path)
+    return [f32(float(tap)) for tap in match.group(1).split(",") if tap.strip()]
+
+
+def f32(value):
+    """Round a Python float to the nearest float32_t"""
+    return struct.unpack("f", struct.pack("f", value))[0]
+
+
+def fft(x):
+    """In-place iterative radix-2 forward DFT, same sign convention as arm_cfft_f32"""
+    n = len(x)
+    j = 0
+    for i in range(1, n):
+        bit = n >> 1
+        while j & bit:
+            j ^= bit
+            bit >>= 1
+        j ^= bit
+        if i < j:
+            x[i], x[j] = x[j], x[i]
+    length = 2
+    while length <= n:
+        w = cmath.exp(-2j * cmath.pi / length)
+        for start in range(0, n, length):
+            wn = 1
+            for k in range(length // 2):
+                u = x[start + k]
+                v = x[start + k + length // 2] * wn
+                x[start + k] = u + v
+                x[start + k + length // 2] = u - v
+                wn *= w
+        length <<= 1
+    return x
+
+
+def half_spectrum(taps, partition_size):
+    """Zero-pad one partition on the left, transform it and keep bins [0, N] packed as in transformPartition()"""
+    window = [0j] * (2 * partition_size)
+    for k in range(partition_size):
+        window[partition_size + k] = complex(taps[k], 0)
+    spectrum = fft(window)
+    half = [f32(spectrum[0].real), f32(spectrum[partition_size].real)]
+    for k in range(1, partition_size):
+        half.append(f32(spectrum[k].real))
+        half.append(f32(spectrum[k].imag))
+    return half
+
+
+def partition_spectra(left, right, partition_size, partition_count):
+    """Mirror processFilters(): left then right half-spectrum of each partition"""
+    spectra = []
+    for j in range(partition_count):
+        offset = partition_size * j
+        spectra += half_spectrum(left[offset:offset + partition_size], partition_size)
+        spectra += half_spectrum(right[offset:offset + partition_size], partition_size)
+    return spectra
+
+
+def format_floats(values, per_line=8):
+    lines = []
+    for i in range(0, len(values), per_line):
+        lines.append("\t" + ", ".join("%.9g" % v for v in values[i:i + per_line]))
+    return ",\n".join(lines)
+
+
+def generate():
+    partition_size, partition_count, table_samples = read_geometry()
+    impulse_samples = partition_size * partition_count
+
+    table = read_table(TABLE_PATH)
+    ir_count = len(table) // (2 * table_samples)
+    if ir_count == 0:
+        sys.exit("bankIR.py: irTable holds less than one HRIR pair")
+
+    entries = []
+    for i in range(ir_count):
+        offset = 2 * table_samples * i
+        left = table[offset:offset + impulse_samples]
+        right = table[offset + table_samples:offset + table_samples + impulse_samples]
+        spectra = partition_spectra(left, right, partition_size, partition_count)
+        entries.append("{\n" + format_floats(spectra) + "}")
+
+    with open(BANK_PATH, "w") as f:
+        f.write("/**\n")
+        f.write(" * @file bankIR.h\n")
+        f.write(" * @brief Frequency-domain HRTF bank generated by tools/bankIR.py from tablIR.h. Do not edit.\n")
+        f.write(" *\n")
+        f.write(" */\n\n")
+        f.write("#pragma once\n\n")
+        f.write("#include \"auricle.h\"\n\n")
+        f.write("#define BANK_IR_COUNT %d\n" % ir_count)
+        f.write("#define BANK_IR_PARTITION_SIZE %d\n" % partition_size)
+        f.write("#define BANK_IR_PARTITION_COUNT %d\n\n" % partition_count)
+        f.write("_section_progmem float32_t bankIR[BANK_IR_COUNT][%d] = {\n" % (4 * impulse_samples))
+        f.write(",\n".join(entries))
+        f.write("};\n")
+
+    print("bankIR.py: wrote %d HRTF set(s) to %s" % (ir_count, BANK_PATH))
+
+
+def stale():
+    if not os.path.exists(BANK_PATH):
+        return True
+    generated = os.path.getmtime(BANK_PATH)
+    if any(os.path.getmtime(path) > generated for path in (TABLE_PATH, UPOLS_PATH, SCRIPT_PATH)):
+        return True
+    with open(BANK_PATH, "r") as f:
+        header = f.read(1024)
+    partition_size, partition_count, _ = read_geometry()
+    return ("#define BANK_IR_PARTITION_SIZE %d\n" % partition_size) not in header or \
+        ("#define BANK_IR_PARTITION_COUNT %d\n" % partition_count) not in header
+
+
+def packed():
+    """Packed builds decode the HRIRs in place of the bank, see tools/packIR.py"""
+    return any(define == "UPOLS_PACKED_IR" or (isinstance(define, (list, tuple)) and define[0] == "UPOLS_PACKED_IR")
+               for define in CPPDEFINES)
+
+
+if not packed() and stale():
+    generate()
@@ -0,0 +1,44 @@
+"""
+cmsisHost.py - Build CMSIS-DSP for the host so lib/upols can run off-target
+
+PlatformIO pre-build script for env:native. The Teensy core ships CMSIS-DSP as a
+prebuilt Cortex-M7 library, so host builds compile it from source instead:
+
+  * CMSIS_DSP_PATH, if set, points at an existing CMSIS-DSP checkout
+  * otherwise the pinned release is cloned once into .pio/cmsis-dsp
+
+The sources are archived into a static library, so only the objects upols
+actually references end up in the test binary. CMSIS-DSP is configured for a
+generic host with __GNUC_PYTHON__, which it provides for exactly this purpose.
+"""
+
+import os
+import subprocess
+
+Import("env")  # noqa: F821 - provided by PlatformIO / SCons
+
+CMSIS_DSP_URL = "https://github.com/ARM-software/CMSIS-DSP.git"
+CMSIS_DSP_TAG = "v1.15.0"
+
+PROJECT_DIR = env.subst("$PROJECT_DIR")  # noqa: F821
+CMSIS_DSP_PATH = os.environ.get("CMSIS_DSP_PATH") or os.path.join(PROJECT_DIR, ".pio", "cmsis-dsp")
+
+if not os.path.isdir(os.path.join(CMSIS_DSP_PATH, "Include")):
+    print("cmsisHost.py: cloning CMSIS-DSP %s into %s" % (CMSIS_DSP_TAG, CMSIS_DSP_PATH))
+    subprocess.check_call(["git", "clone", "--depth", "1", "--branch", CMSIS_DSP_TAG, CMSIS_DSP_URL, CMSIS_DSP_PATH])
+
+env.Append(  # noqa: F821
+    CPPDEFINES=["__GNUC_PYTHON__"],
+    CPPPATH=[os.path.join(CMSIS_DSP_PATH, "Include"), os.path.join(CMSIS_DSP_PATH, "PrivateInclude")],
+)
+
+# Every function lives in its own arm_*.c, the per-group aggregate sources would duplicate them
+env.Append(  # noqa: F821
+    LIBS=[
+        env.BuildLibrary(  # noqa: F821
+            os.path.join("$BUILD_DIR", "cmsis-dsp"),
+            os.path.join(CMSIS_DSP_PATH, "Source"),
+            src_filter=["-<*>", "+<*/arm_*.c>"],
+        )
+    ]
+)
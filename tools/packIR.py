@@ -0,0 +1,155 @@
+"""
+packIR.py - Pack the HRIRs in tablIR.h into a block-floating-point binary asset
+
+Generates include/packIR.bin and include/packIR.h for builds with UPOLS_PACKED_IR. Every
+PACK_IR_BLOCK_SIZE taps of a channel share one exponent and are stored as Q15 mantissas
+relative to it, so a pair takes a little over half the flash of its float32_t taps and the
+200k-line text table is never compiled. The binary is pulled in with .incbin and decoded by
+lib/upols/upols.c as each partition is prepared.
+
+Layout, little-endian: the int16_t mantissas of every pair, left then right channel, followed
+by the int8_t exponent of every block in the same order. A block's taps are mantissa * 2^(e - 15).
+
+Runs automatically as a PlatformIO pre-build script, does nothing unless UPOLS_PACKED_IR is set,
+and only regenerates the asset when tablIR.h or upols.h are newer than the existing output. Can
+also be run by hand from the project root: python tools/packIR.py
+"""
+
+import math
+import os
+import re
+import struct
+import sys
+
+try:
+    Import("env")  # noqa: F821 - provided by PlatformIO / SCons
+    PROJECT_DIR = env.subst("$PROJECT_DIR")  # noqa: F821
+    CPPDEFINES = env.get("CPPDEFINES", [])  # noqa: F821
+    STANDALONE = False
+except NameError:
+    PROJECT_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    CPPDEFINES = []
+    STANDALONE = True
+
+TABLE_PATH = os.path.join(PROJECT_DIR, "include", "tablIR.h")
+UPOLS_PATH = os.path.join(PROJECT_DIR, "lib", "upols", "upols.h")
+BINARY_PATH = os.path.join(PROJECT_DIR, "include", "packIR.bin")
+HEADER_PATH = os.path.join(PROJECT_DIR, "include", "packIR.h")
+SCRIPT_PATH = os.path.join(PROJECT_DIR, "tools", "packIR.py")
+
+BLOCK_SIZE = 16  # Taps sharing an exponent, must divide the smallest partition size
+MIN_EXPONENT = -111  # Keeps 2^(e - 15) a normal float32_t, blocks quieter than this round to silence
+MAX_EXPONENT = 16
+
+
+def defined(name):
+    """Whether a macro is set from build_flags, with or without a value"""
+    for define in CPPDEFINES:
+        if define == name or (isinstance(define, (list, tuple)) and define[0] == name):
+            return True
+    return False
+
+
+def read_enum(source, name):
+    """Pull an integer enumerator out of upols.h so the geometry is never duplicated"""
+    match = re.search(r"\b" + name + r"\s*=\s*(\d+)", source)
+    if not match:
+        sys.exit("packIR.py: could not find %s in %s" % (name, UPOLS_PATH))
+    return int(match.group(1))
+
+
+def read_table(path):
+    """Return the float32 taps of irTable, ignoring entries that are commented out"""
+    with open(path, "r") as f:
+        source = f.read()
+    source = re.sub(r"/\*.*?\*/", "", source, flags=re.S)
+    source = re.sub(r"//[^\n]*", "", source)
+    match = re.search(r"irTable\s*\[\s*\]\s*=\s*\{(.*?)\}", source, flags=re.S)
+    if not match:
+        sys.exit("packIR.py: irTable not found in %s" % path)
+    return [f32(float(tap)) for tap in match.group(1).split(",") if tap.strip()]
+
+
+def f32(value):
+    """Round a Python float to the nearest float32_t"""
+    return struct.unpack("f", struct.pack("f", value))[0]
+
+
+def pack_block(taps):
+    """Pick the smallest exponent whose Q15 mantissas hold the block's peak and quantize against it"""
+    peak = max(abs(tap) for tap in taps)
+    exponent = math.frexp(peak)[1] if peak > 0.0 else MIN_EXPONENT
+    exponent = max(MIN_EXPONENT, exponent)
+    if exponent > MAX_EXPONENT:
+        sys.exit("packIR.py: tap of %g is out of range" % peak)
+    scale = math.ldexp(1.0, 15 - exponent)
+    mantissas = [max(-32767, min(32767, int(round(tap * scale)))) for tap in taps]
+    return exponent, mantissas
+
+
+def generate():
+    with open(UPOLS_PATH, "r") as f:
+        table_samples = read_enum(f.read(), "TableImpulseSamples")
+    if table_samples % BLOCK_SIZE:
+        sys.exit("packIR.py: TableImpulseSamples is not a multiple of %d" % BLOCK_SIZE)
+
+    table = read_table(TABLE_PATH)
+    ir_count = len(table) // (2 * table_samples)
+    if ir_count == 0:
+        sys.exit("packIR.py: irTable holds less than one HRIR pair")
+
+    mantissas = []
+    exponents = []
+    worst = 0.0
+    for offset in range(0, 2 * table_samples * ir_count, BLOCK_SIZE):
+        taps = table[offset:offset + BLOCK_SIZE]
+        exponent, block = pack_block(taps)
+        exponents.append(exponent)
+        mantissas += block
+        scale = math.ldexp(1.0, exponent - 15)
+        worst = max(worst, max(abs(tap - m * scale) for tap, m in zip(taps, block)))
+
+    with open(BINARY_PATH, "wb") as f:
+        f.write(struct.pack("<%dh" % len(mantissas), *mantissas))
+        f.write(struct.pack("<%db" % len(exponents), *exponents))
+
+    incbin = BINARY_PATH.replace("\\", "/")
+    with open(HEADER_PATH, "w") as f:
+        f.write("/**\n")
+        f.write(" * @file packIR.h\n")
+        f.write(" * @brief Block-floating-point HRIR table generated by tools/packIR.py from tablIR.h. Do not edit.\n")
+        f.write(" * Defines the packedIR symbol, so it can only be included by a single translation unit.\n")
+        f.write(" *\n")
+        f.write(" */\n\n")
+        f.write("#pragma once\n\n")
+        f.write("#include \"auricle.h\"\n\n")
+        f.write("#define PACK_IR_COUNT %d\n" % ir_count)
+        f.write("#define PACK_IR_SAMPLES %d\n" % table_samples)
+        f.write("#define PACK_IR_BLOCK_SIZE %d\n\n" % BLOCK_SIZE)
+        f.write("#ifdef ARDUINO\n")
+        f.write("#define PACK_IR_SECTION \".progmem\"\n")
+        f.write("#else\n")
+        f.write("#define PACK_IR_SECTION \".rodata\"\n")
+        f.write("#endif\n\n")
+        f.write("__asm__(\".section \" PACK_IR_SECTION \", \\\"a\\\"\\n\"\n")
+        f.write("\t\".balign 4\\n\"\n")
+        f.write("\t\".global packedIR\\n\"\n")
+        f.write("\t\"packedIR:\\n\"\n")
+        f.write("\t\".incbin \\\"%s\\\"\\n\"\n" % incbin)
+        f.write("\t\".previous\\n\");\n\n")
+        f.write("// Mantissas of every pair, left then right channel, followed by the int8_t exponent of each block\n")
+        f.write("extern const int16_t packedIR[];\n")
+
+    print("packIR.py: packed %d HRIR pair(s) into %s, %d bytes, worst error %.3g" %
+          (ir_count, BINARY_PATH, 2 * len(mantissas) + len(exponents), worst))
+
+
+def stale():
+    if not os.path.exists(BINARY_PATH) or not os.path.exists(HEADER_PATH):
+        return True
+    generated = min(os.path.getmtime(BINARY_PATH), os.path.getmtime(HEADER_PATH))
+    return any(os.path.getmtime(path) > generated for path in (TABLE_PATH, UPOLS_PATH, SCRIPT_PATH))
+
+
+if (STANDALONE or defined("UPOLS_PACKED_IR")) and stale():
+    generate()
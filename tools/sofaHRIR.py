@@ -0,0 +1,95 @@
+"""
+sofaHRIR.py - Convert a SOFA HRTF dataset into the .hrir format read by HrtfLoader
+
+SOFA files are netCDF-4, which is HDF5 underneath, so this only needs h5py:
+
+  pip install h5py
+  python tools/sofaHRIR.py subject.sofa subject.hrir [--partition-size 128]
+
+Every measurement of a SimpleFreeFieldHRIR dataset is written with its azimuth and
+elevation, taps grouped by partition so the loader reads each measurement front to
+back. See include/hrtfLoader.h for the layout. Copy the output to the SD card and
+load it from the shell with 'hrtf load subject.hrir'.
+"""
+
+import argparse
+import struct
+import sys
+
+HRIR_VERSION = 1
+SAMPLE_RATES = (44100, 44118)
+
+
+def read_sofa(path):
+    """Return the sample rate, [azimuth, elevation] of each measurement, and its left and right taps"""
+    try:
+        import h5py
+    except ImportError:
+        sys.exit("sofaHRIR.py: h5py is needed to read SOFA files, pip install h5py")
+
+    with h5py.File(path, "r") as sofa:
+        convention = sofa.attrs.get("SOFAConventions", b"")
+        if isinstance(convention, bytes):
+            convention = convention.decode()
+        if convention not in ("SimpleFreeFieldHRIR", "SingleRoomDRIR", "SingleRoomSRIR"):
+            print("sofaHRIR.py: %s convention, expecting impulse responses" % (convention or "unknown"))
+
+        sample_rate = int(round(float(sofa["Data.SamplingRate"][()].flatten()[0])))
+        ir = sofa["Data.IR"][()]  # [measurements, receivers, taps]
+        positions = sofa["SourcePosition"][()]  # [measurements, 3], spherical degrees
+
+        position_type = sofa["SourcePosition"].attrs.get("Type", b"spherical")
+        if isinstance(position_type, bytes):
+            position_type = position_type.decode()
+        if position_type != "spherical":
+            sys.exit("sofaHRIR.py: only spherical source positions are supported")
+
+    if ir.shape[1] != 2:
+        sys.exit("sofaHRIR.py: expected two receivers, found %d" % ir.shape[1])
+
+    directions = [(float(p[0]), float(p[1])) for p in positions]
+    return sample_rate, directions, ir
+
+
+def write_hrir(path, sample_rate, directions, ir, partition_size):
+    measurements, _, taps = ir.shape
+    partitions = (taps + partition_size - 1) // partition_size
+
+    with open(path, "wb") as f:
+        f.write(struct.pack("<4sHHIII", b"HRIR", HRIR_VERSION, measurements, sample_rate, taps, partition_size))
+        for azimuth, elevation in directions:
+            f.write(struct.pack("<ff", azimuth, elevation))
+
+        for m in range(measurements):
+            for j in range(partitions):
+                for receiver in range(2):
+                    block = [float(tap) for tap in ir[m, receiver, partition_size * j:partition_size * (j + 1)]]
+                    block += [0.0] * (partition_size - len(block))
+                    f.write(struct.pack("<%df" % partition_size, *block))
+
+    print("sofaHRIR.py: wrote %d measurements of %d taps to %s" % (measurements, taps, path))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("sofa", help="SOFA dataset to convert")
+    parser.add_argument("hrir", help="output .hrir file")
+    parser.add_argument("--partition-size", type=int, default=128, help="must match UPOLS_PARTITION_SIZE")
+    args = parser.parse_args()
+
+    if args.partition_size <= 0 or args.partition_size & (args.partition_size - 1):
+        sys.exit("sofaHRIR.py: the partition size must be a power of two")
+    if args.sofa == args.hrir:
+        sys.exit("sofaHRIR.py: refusing to overwrite the input")
+
+    sample_rate, directions, ir = read_sofa(args.sofa)
+    if sample_rate not in SAMPLE_RATES:
+        sys.exit("sofaHRIR.py: dataset is sampled at %d Hz, resample it to 44100 Hz first" % sample_rate)
+    if len(directions) > 0xFFFF:
+        sys.exit("sofaHRIR.py: too many measurements")
+
+    write_hrir(args.hrir, sample_rate, directions, ir, args.partition_size)
+
+
+if __name__ == "__main__":
+    main()